@@ -1,11 +1,273 @@
+#define _POSIX_C_SOURCE 200809L
 #include "phone_forward.h"
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include "phone_forward_parser.h"
 
 #define COUNT_OF_NUMBERS 12
 #define CHAR_TO_NUMBER(number) ((int)number - (int)'0')
 #define BASIC_ARRAY_LENGTH 25
+#define FIRST_CHUNK_LENGTH 16
+#define MAX_CHUNK_LENGTH 4096
+#define LABEL_LENGTH 30
+#define KEY_DIGITS 16
+#define BASIC_TABLE_LENGTH 64
+#define INTERN_BUFFER_LENGTH 64
+#define INTERNED(number) ((InternedNumber *)((char *)(number) - offsetof(InternedNumber, packed)))
+#define TINY_CHILDREN 2
+#define CHILD_ARRAY_STEP 4
+#define CHILD_ARRAY_CLASSES (COUNT_OF_NUMBERS / CHILD_ARRAY_STEP)
+#define CHILD_ARRAY_CLASS(count) (((count) - 1) / CHILD_ARRAY_STEP)
+#define BATCH_WIDTH 8
+#define READER_SLOTS 64
+#define CACHE_LINE 64
+#define NO_OFFSET UINT32_MAX
+#define SNAPSHOT_MAGIC "PHFWDSNP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x0102030405060708ULL
+#define SNAPSHOT_ALIGNMENT 8
+#define SOURCE_NODE_KEYS 30
+#define SOURCE_MIN_KEYS (SOURCE_NODE_KEYS / 4)
+#define SOURCE_MAX_HEIGHT 16
+#define KEY_BYTES sizeof(uint64_t)
+#define REVERSE_PENDING 4
+#define PATH_BUFFER_LENGTH 32
+#define TARGET_MASKS (1 << COUNT_OF_NUMBERS)
+#define TARGET_PAGE_LENGTH 64
+#ifdef __GNUC__
+#define PREFETCH(address) __builtin_prefetch(address)
+#else
+#define PREFETCH(address) ((void)(address))
+#endif
+
+/**
+ * Blok pamięci areny, z którego wydzielane są kolejne węzły.
+ */
+struct ArenaChunk {
+    /**
+    * Wskaźnik na poprzednio zaalokowany blok.
+    */
+    struct ArenaChunk *previous;
+    /**
+    * Liczba węzłów, które mieszczą się w bloku.
+    */
+    size_t length;
+    /**
+    * Liczba węzłów wydzielonych już z bloku.
+    */
+    size_t used;
+    /**
+    * Pamięć na węzły.
+    */
+    _Alignas(max_align_t) unsigned char nodes[];
+};
+
+/**
+ * Arena węzłów jednego rozmiaru. Węzły są alokowane blokami,
+ * a zwolnione węzły trafiają na listę wolnych i są używane ponownie.
+ */
+struct NodeArena {
+    /**
+    * Wskaźnik na ostatnio zaalokowany blok.
+    */
+    struct ArenaChunk *chunks;
+    /**
+    * Lista zwolnionych węzłów, połączona przez ich pierwsze słowo.
+    */
+    void *free_list;
+    /**
+    * Rozmiar pojedynczego węzła w bajtach.
+    */
+    size_t node_size;
+};
+
+/**
+ * typedef dla struktury NodeArena, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct NodeArena NodeArena;
+
+/**
+ * Spakowany numer przechowywany w tablicy internowanych numerów.
+ * Jeden egzemplarz numeru jest współdzielony przez wszystkie przekierowania
+ * danej bazy, w których numer występuje.
+ */
+struct InternedNumber {
+    /**
+    * Wskaźnik na kolejny numer w tym samym kubełku.
+    */
+    struct InternedNumber *next;
+    /**
+    * Zapamiętany skrót spakowanego numeru.
+    */
+    size_t hash;
+    /**
+    * Liczba odwołań do numeru.
+    */
+    size_t references;
+    /**
+    * Spakowany numer (zob. @ref pack_number).
+    */
+    char packed[];
+};
+
+/**
+ * typedef dla struktury InternedNumber, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct InternedNumber InternedNumber;
+
+/**
+ * Tablica haszująca internowanych numerów jednej bazy.
+ */
+struct InternTable {
+    /**
+    * Tablica kubełków, jej długość jest potęgą dwójki.
+    */
+    InternedNumber **buckets;
+    /**
+    * Liczba kubełków.
+    */
+    size_t bucket_count;
+    /**
+    * Liczba numerów w tablicy.
+    */
+    size_t count;
+    /**
+    * Stan odzyskiwania pamięci albo NULL. Jeśli nie jest NULL,
+    * numery bez odwołań są zwalniane dopiero po zakończeniu
+    * czytających je operacji.
+    */
+    struct Epochs *epochs;
+};
+
+/**
+ * typedef dla struktury InternTable, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct InternTable InternTable;
+
+/**
+ * Zbiór synów węzła trie. Cyfry, dla których istnieje syn, są zapisane
+ * w masce bitowej, a syn dla cyfry d leży w tablicy synów na pozycji
+ * równej liczbie ustawionych bitów maski poniżej bitu d. Węzeł z co najwyżej
+ * TINY_CHILDREN synami trzyma ich bezpośrednio w strukturze, węzeł z większą
+ * liczbą synów - w tablicy o pojemności zaokrąglonej do wielokrotności
+ * CHILD_ARRAY_STEP, wydzielonej z areny odpowiedniego rozmiaru.
+ */
+struct ChildSet {
+    /**
+    * Synowie węzła w kolejności rosnących cyfr.
+    */
+    union {
+        /**
+        * Synowie małego węzła.
+        */
+        void *tiny[TINY_CHILDREN];
+        /**
+        * Wskaźnik na tablicę synów dużego węzła.
+        */
+        void **array;
+    } children;
+    /**
+    * Maska cyfr, dla których istnieje syn.
+    */
+    unsigned short bitmap;
+    /**
+    * Liczba odwołań do węzła z ojców i korzeni baz. Węzeł ma więcej niż
+    * jedno odwołanie tylko wtedy, gdy współdzielą go klony bazy
+    * (zob. @ref phfwdClone).
+    */
+    unsigned short references;
+    /**
+    * Numer operacji zapisu, w której utworzono węzeł
+    * (zob. @ref phfwdEnableConcurrency).
+    */
+    unsigned version;
+};
+
+/**
+ * typedef dla struktury ChildSet, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct ChildSet ChildSet;
+
+/**
+ * Obiekt odłączony od struktury przekierowań, który współbieżni
+ * czytelnicy mogą jeszcze czytać.
+ */
+struct Retired {
+    /**
+    * Wskaźnik na odłączony obiekt.
+    */
+    void *object;
+    /**
+    * Arena, z której pochodzi węzeł, albo NULL dla numeru
+    * z tablicy internowanych numerów.
+    */
+    struct NodeArena *arena;
+    /**
+    * Epoka, w której obiekt odłączono.
+    */
+    unsigned long epoch;
+};
+
+/**
+ * typedef dla struktury Retired, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct Retired Retired;
+
+/**
+ * Miejsce, w którym czytelnik ogłasza epokę, w której zaczął czytać.
+ * Każde miejsce zajmuje osobną linię pamięci podręcznej.
+ */
+struct ReaderSlot {
+    /**
+    * Ogłoszona epoka albo zero, jeśli miejsce jest wolne.
+    */
+    _Alignas(CACHE_LINE) atomic_ulong epoch;
+};
+
+/**
+ * typedef dla struktury ReaderSlot, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct ReaderSlot ReaderSlot;
+
+/**
+ * Stan odzyskiwania pamięci w trybie współbieżnych czytelników.
+ * Obiekt odłączony w epoce e jest zwalniany, gdy każdy aktywny
+ * czytelnik ogłosił epokę większą niż e.
+ */
+struct Epochs {
+    /**
+    * Miejsca aktywnych czytelników.
+    */
+    struct ReaderSlot readers[READER_SLOTS];
+    /**
+    * Bieżąca epoka, zwiększana po każdej operacji zapisu.
+    */
+    atomic_ulong epoch;
+    /**
+    * Obiekty czekające na zwolnienie, w kolejności niemalejących epok.
+    */
+    struct Retired *retired;
+    /**
+    * Liczba obiektów czekających na zwolnienie.
+    */
+    size_t retired_count;
+    /**
+    * Rozmiar tablicy @p retired.
+    */
+    size_t retired_max;
+};
+
+/**
+ * typedef dla struktury Epochs, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct Epochs Epochs;
 
 /** @struct PhoneNumbers phone_forward.h
  * Implementacja struktury przechowującej numery telefonu
@@ -27,18 +289,69 @@ struct PhoneNumbers {
 
 /**
  * Struktura przechowująca przekierowania
- * od-do w formie trie.
+ * od-do w formie skompresowanego trie (radix tree).
+ * Krawędź prowadząca do węzła jest etykietowana ciągiem cyfr,
+ * a węzeł bez przekierowania ma co najmniej dwóch synów
+ * (chyba że jego etykieta jest pełna).
  */
 struct RedsFromTo {
     /**
-    * Tablica wskaźników na synów.
+    * Synowie węzła, indeksowani
+    * pierwszą cyfrą etykiety syna.
     */
-    struct RedsFromTo *children[COUNT_OF_NUMBERS];
+    struct ChildSet children;
     /**
-    * wskaźnik na napis reprezentujący numer
+    * wskaźnik na internowany, spakowany numer
     * na który jest przekierowanie.
     */
     char *redirection;
+    /**
+    * Cyfry na krawędzi prowadzącej do węzła,
+    * po dwie w bajcie (zob. @ref get_digit).
+    */
+    unsigned char label[LABEL_LENGTH/2];
+    /**
+    * Liczba cyfr w etykiecie, zero tylko dla korzenia.
+    */
+    unsigned char label_length;
+};
+
+/**
+ * Węzeł B+ drzewa przekierowań "od" jednego węzła RedsToFrom.
+ * Liście przechowują internowane, spakowane numery w porządku
+ * @ref compare_packed, a węzły wewnętrzne najmniejszy numer każdego
+ * poddrzewa. W trybie współbieżnych czytelników węzły są kopiowane przy
+ * zapisie, tak jak węzły trie (zob. @ref sourceNodeWritable).
+ */
+struct SourceNode {
+    /**
+    * Liczba numerów w poddrzewie.
+    */
+    size_t size;
+    /**
+    * Numer operacji zapisu, w której utworzono węzeł.
+    */
+    unsigned version;
+    /**
+    * Liczba numerów liścia albo synów węzła wewnętrznego.
+    */
+    unsigned short count;
+    /**
+    * Wysokość poddrzewa, zero dla liścia.
+    */
+    unsigned short height;
+    /**
+    * Liczba odwołań do węzła, tak jak w @ref ChildSet.
+    */
+    unsigned short references;
+    /**
+    * Numery liścia albo najmniejsze numery poddrzew synów.
+    */
+    char *keys[SOURCE_NODE_KEYS];
+    /**
+    * Synowie węzła wewnętrznego, liść nie ma tej tablicy.
+    */
+    struct SourceNode *children[];
 };
 
 /**
@@ -47,17 +360,70 @@ struct RedsFromTo {
  */
 struct RedsToFrom {
     /**
-    * Tablica wskaźników na synów.
+    * Synowie węzła.
+    */
+    struct ChildSet children;
+    /**
+    * Korzeń B+ drzewa przekierowań "od", gdyż może być
+    * kilka róznych przekierowań na jeden numer, albo NULL,
+    * jeśli ich nie ma.
+    */
+    struct SourceNode *redirections;
+};
+
+/**
+ * Operacja zapisu czekająca na zatwierdzenie transakcji
+ * (zob. @ref phfwdBegin).
+ */
+struct StagedOperation {
+    /**
+    * Numer "od" przekierowania albo prefiks usuwanych numerów. Napis
+    * zajmuje jeden blok pamięci razem z @p num2.
     */
-    struct RedsToFrom *children[COUNT_OF_NUMBERS];
+    char *num1;
     /**
-    * Wskaźnik na przekierowania "od" w formie
-    * struktury @p PhoneNumbers, gdyż może być
-    * kilka róznych przekierowań na jeden numer.
+    * Numer "do" przekierowania albo NULL, jeśli operacja usuwa
+    * przekierowania.
+    */
+    char *num2;
+};
+
+/**
+ * typedef dla struktury StagedOperation, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct StagedOperation StagedOperation;
+
+/**
+ * Pamięć węzłów i numerów bazy. Baza i jej klony (zob. @ref phfwdClone)
+ * współdzielą jedną pamięć, bo współdzielą węzły.
+ */
+struct NodeStore {
+    /** Arena, z której alokowane są węzły
+    * struktury RedsFromTo.
+    */
+    struct NodeArena rft_arena;
+    /** Arena, z której alokowane są węzły
+    * struktury RedsToFrom.
     */
-    struct PhoneNumbers *redirections;
+    struct NodeArena rtf_arena;
+    /** Areny tablic synów dużych węzłów,
+    * po jednej na każdą pojemność tablicy.
+    */
+    struct NodeArena child_arenas[CHILD_ARRAY_CLASSES];
+    /** Tablica numerów współdzielonych przez
+    * obie struktury przekierowań.
+    */
+    struct InternTable numbers;
+    /** Liczba baz korzystających z pamięci.
+    */
+    size_t members;
 };
 
+/**
+ * typedef dla struktury NodeStore, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct NodeStore NodeStore;
+
 /** @struct PhoneForward phone_forward.h
  * Implementacja struktury przechowującej przekierowania numerów telefonów
  */
@@ -70,6 +436,56 @@ struct PhoneForward {
     * przekierowania do-od.
     */
     struct RedsToFrom *reds_to_from;
+    /** Pamięć węzłów i numerów, współdzielona
+    * z klonami (zob. @ref phfwdClone).
+    */
+    struct NodeStore *store;
+    /** Korzeń struktury RedsFromTo widoczny
+    * dla czytelników.
+    */
+    _Atomic(struct RedsFromTo *) rft_published;
+    /** Korzeń struktury RedsToFrom widoczny
+    * dla czytelników.
+    */
+    _Atomic(struct RedsToFrom *) rtf_published;
+    /** Indeks najkrótszych numerów "do" albo NULL,
+    * jeśli zabrakło na niego pamięci.
+    */
+    struct TargetIndex *targets;
+    /** Indeks najkrótszych numerów "do" widoczny
+    * dla czytelników.
+    */
+    _Atomic(struct TargetIndex *) targets_published;
+    /** Numer bieżącej operacji zapisu.
+    */
+    unsigned version;
+    /** Stan odzyskiwania pamięci albo NULL,
+    * jeśli tryb współbieżnych czytelników jest wyłączony.
+    */
+    struct Epochs *epochs;
+    /** Zamrożona postać przekierowań albo NULL
+    * (zob. @ref phfwdFreeze).
+    */
+    _Atomic(struct Frozen *) frozen;
+    /** Odwzorowany w pamięci plik z zamrożoną postacią
+    * albo NULL (zob. @ref phfwdLoad).
+    */
+    void *mapping;
+    /** Długość odwzorowania @p mapping w bajtach.
+    */
+    size_t mapping_length;
+    /** Czy trwa transakcja (zob. @ref phfwdBegin).
+    */
+    bool transaction;
+    /** Operacje transakcji w kolejności dodania.
+    */
+    struct StagedOperation *staged;
+    /** Liczba operacji w @p staged.
+    */
+    size_t staged_count;
+    /** Pojemność tablicy @p staged.
+    */
+    size_t staged_max;
 };
 
 /**
@@ -82,451 +498,4695 @@ typedef struct RedsFromTo RedsFromTo;
  */
 typedef struct RedsToFrom RedsToFrom;
 
-/** @brief Funkcja alokująca strukturę PhoneNumbers.
- * Funkcja alokuje pamięc i zwraca wskaźnik na strukturę
- * PhoneNumbers, która musi potem zostać zwolniona funkcją
- * @ref phnumDelete.
- * @return Wskaźnik na nowo utworzoną strukturę.
-*/
-PhoneNumbers *declare_phone_numbers() {
-    PhoneNumbers *new = malloc(sizeof(PhoneNumbers));
-    new->current_length = 0;
-    new->max_length = BASIC_ARRAY_LENGTH;
-    new->array_of_numbers = malloc(BASIC_ARRAY_LENGTH*sizeof(char*));
-    for (int i = 0; i < BASIC_ARRAY_LENGTH; i++)
-        new->array_of_numbers[i] = NULL;
-    return new;
-}
+/**
+ * typedef dla struktury SourceNode, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct SourceNode SourceNode;
+
+/**
+ * Liczby najkrótszych numerów "do" o jednym zbiorze cyfr, według długości.
+ * Numer "do" jest najkrótszy, jeśli żaden jego prefiks nie jest numerem "do".
+ */
+struct TargetDepths {
+    /**
+    * Numer operacji zapisu, w której utworzono obiekt.
+    */
+    unsigned version;
+    /**
+    * Liczba odwołań do obiektu, więcej niż jedno, gdy współdzielą go
+    * klony bazy (zob. @ref phfwdClone).
+    */
+    unsigned references;
+    /**
+    * Długość tablicy @p counts.
+    */
+    size_t length;
+    /**
+    * Suma liczb w @p counts.
+    */
+    size_t total;
+    /**
+    * Liczby numerów o długości równej indeksowi.
+    */
+    size_t counts[];
+};
+
+/**
+ * typedef dla struktury TargetDepths, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct TargetDepths TargetDepths;
+
+/**
+ * Strona indeksu najkrótszych numerów "do", obejmująca TARGET_PAGE_LENGTH
+ * kolejnych zbiorów cyfr.
+ */
+struct TargetPage {
+    /**
+    * Numer operacji zapisu, w której utworzono obiekt.
+    */
+    unsigned version;
+    /**
+    * Liczba odwołań do obiektu, tak jak w @ref TargetDepths.
+    */
+    unsigned references;
+    /**
+    * Liczby numerów dla kolejnych zbiorów cyfr albo NULL, jeśli nie ma
+    * takich numerów.
+    */
+    struct TargetDepths *masks[TARGET_PAGE_LENGTH];
+};
+
+/**
+ * typedef dla struktury TargetPage, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct TargetPage TargetPage;
+
+/**
+ * Indeks najkrótszych numerów "do" według zbioru cyfr (bit i oznacza
+ * cyfrę i) i długości, z którego @ref phfwdNonTrivialCount liczy wynik bez
+ * przeglądania struktury RedsToFrom. W trybie współbieżnych czytelników
+ * obiekty indeksu są kopiowane przy zapisie, tak jak węzły trie.
+ */
+struct TargetIndex {
+    /**
+    * Numer operacji zapisu, w której utworzono obiekt.
+    */
+    unsigned version;
+    /**
+    * Liczba odwołań do obiektu, tak jak w @ref TargetDepths.
+    */
+    unsigned references;
+    /**
+    * Strony indeksu albo NULL.
+    */
+    struct TargetPage *pages[TARGET_MASKS / TARGET_PAGE_LENGTH];
+};
+
+/**
+ * typedef dla struktury TargetIndex, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct TargetIndex TargetIndex;
+
+/**
+ * Pozycja w B+ drzewie przekierowań "od", pozwalająca przeglądać numery
+ * w kolejności rosnącej.
+ */
+struct SourceCursor {
+    /**
+    * Węzły na ścieżce od korzenia do bieżącego liścia.
+    */
+    SourceNode const *path[SOURCE_MAX_HEIGHT];
+    /**
+    * Indeksy w kolejnych węzłach ścieżki.
+    */
+    unsigned short index[SOURCE_MAX_HEIGHT];
+    /**
+    * Indeks liścia w ścieżce albo -1, gdy numery się skończyły.
+    */
+    int depth;
+};
+
+/**
+ * typedef dla struktury SourceCursor, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct SourceCursor SourceCursor;
+
+/**
+ * Stan wyszukiwania najdłuższego przekierowanego prefiksu numeru.
+ * Pozwala przechodzić trie po jednej krawędzi, tak aby kilka
+ * wyszukiwań mogło się przeplatać (zob. @ref phfwdGetBatch).
+ */
+struct Lookup {
+    /**
+    * Wskaźnik na wyszukiwany numer.
+    */
+    char const *num;
+    /**
+    * Długość wyszukiwanego numeru.
+    */
+    int length;
+    /**
+    * Liczba cyfr numeru dopasowanych do ścieżki w trie.
+    */
+    int position;
+    /**
+    * Węzeł, do którego prowadzi kolejna krawędź, albo NULL,
+    * jeśli wyszukiwanie się zakończyło.
+    */
+    RedsFromTo *next;
+    /**
+    * Długość najdłuższego dotąd prefiksu z przekierowaniem.
+    */
+    int end_of_redirection;
+    /**
+    * Przekierowanie tego prefiksu albo NULL, jeśli go nie ma.
+    */
+    char *candidate;
+};
+
+/**
+ * typedef dla struktury Lookup, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct Lookup Lookup;
+
+/**
+ * Ciąg kandydatów do wyniku @ref phfwdReverseVisit pochodzących z jednego
+ * węzła struktury RedsToFrom. Kandydatem jest numer "od" z dopisanym
+ * sufiksem szukanego numeru, wspólnym dla całego węzła. Numery "od" są
+ * czytane w kolejności rosnącej, a kandydat jest zwracany dopiero wtedy,
+ * gdy żaden dalszy numer "od" nie może dać mniejszego kandydata
+ * (zob. @ref reverseStreamFill).
+ */
+struct ReverseStream {
+    /**
+    * Korzeń drzewa numerów "od", używany gdy @p offsets jest NULL.
+    */
+    SourceNode const *root;
+    /**
+    * Pozycja pierwszego nieprzeczytanego numeru w drzewie.
+    */
+    SourceCursor cursor;
+    /**
+    * Położenia numerów "od" w puli zamrożonej postaci albo NULL.
+    */
+    uint32_t const *offsets;
+    /**
+    * Pula numerów zamrożonej postaci.
+    */
+    char const *pool;
+    /**
+    * Liczba numerów "od" w zamrożonej postaci.
+    */
+    size_t count;
+    /**
+    * Indeks pierwszego nieprzeczytanego numeru w zamrożonej postaci.
+    */
+    size_t next;
+    /**
+    * Sufiks dopisywany do numerów "od".
+    */
+    char const *suffix;
+    /**
+    * Przeczytane, jeszcze nie zwrócone numery "od", od największego do
+    * najmniejszego kandydata. Każdy z nich jest prefiksem pierwszego
+    * nieprzeczytanego numeru, więc jest ich najwyżej tyle, ile ma on cyfr.
+    */
+    char const **pending;
+    /**
+    * Liczba numerów w @p pending.
+    */
+    size_t pending_count;
+    /**
+    * Pojemność tablicy @p pending.
+    */
+    size_t pending_max;
+    /**
+    * Pamięć na kilka pierwszych numerów @p pending.
+    */
+    char const *inline_pending[REVERSE_PENDING];
+};
+
+/**
+ * typedef dla struktury ReverseStream, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct ReverseStream ReverseStream;
+
+/**
+ * Przekierowanie usuwane ze struktury RedsToFrom przez @ref phfwdRemove
+ * albo dodawane do niej lub usuwane przez @ref phfwdCommit.
+ */
+struct RuleChange {
+    /**
+    * Internowany, spakowany numer "do".
+    */
+    char *target;
+    /**
+    * Internowany, spakowany numer "od".
+    */
+    char *source;
+    /**
+    * Numer kolejny zmiany; w @ref phfwdRemove przekierowania są zbierane
+    * w porządku numerów "od".
+    */
+    size_t order;
+    /**
+    * Czy przekierowanie jest dodawane, a nie usuwane.
+    */
+    bool added;
+};
+
+/**
+ * typedef dla struktury RuleChange, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct RuleChange RuleChange;
+
+/**
+ * Stan usuwania poddrzewa struktury RedsFromTo w @ref phfwdRemove, a także
+ * zbierania zmian struktury RedsToFrom w @ref phfwdCommit.
+ */
+struct Removal {
+    /**
+    * Zebrane zmiany struktury RedsToFrom.
+    */
+    RuleChange *rules;
+    /**
+    * Liczba zebranych przekierowań.
+    */
+    size_t count;
+    /**
+    * Pojemność tablicy @p rules.
+    */
+    size_t max;
+    /**
+    * Numer odpowiadający bieżącemu węzłowi.
+    */
+    char *number;
+    /**
+    * Rozmiar pamięci zaalokowanej na @p number.
+    */
+    size_t number_max;
+};
+
+/**
+ * typedef dla struktury Removal, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct Removal Removal;
+
+/**
+ * Zbiór wskaźników z adresowaniem otwartym. Pozwala policzyć raz węzły
+ * i numery współdzielone przez klony (zob. @ref phfwdStatsTotal).
+ */
+struct PointerSet {
+    /**
+    * Miejsca zbioru, NULL w wolnych.
+    */
+    void const **slots;
+    /**
+    * Liczba miejsc, potęga dwójki.
+    */
+    size_t size;
+    /**
+    * Liczba wskaźników w zbiorze.
+    */
+    size_t count;
+};
+
+/**
+ * typedef dla struktury PointerSet, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct PointerSet PointerSet;
+
+/**
+ * Stan zbierania statystyk w @ref phfwdStats i @ref phfwdStatsTotal.
+ */
+struct StatsWalk {
+    /**
+    * Wypełniane statystyki.
+    */
+    PhoneForwardStats *stats;
+    /**
+    * Liczba odwiedzonych węzłów, które mają synów, osobno dla węzłów
+    * "od" i "do".
+    */
+    size_t inner[2];
+    /**
+    * Liczba synów odwiedzonych węzłów, osobno dla węzłów "od" i "do".
+    */
+    size_t edges[2];
+    /**
+    * Obiekty już policzone albo NULL, gdy każdy obiekt jest odwiedzany
+    * tylko raz.
+    */
+    PointerSet *seen;
+    /**
+    * Czy nie udało się zaalokować pamięci.
+    */
+    bool failed;
+    /**
+    * Numer odpowiadający bieżącemu węzłowi RedsToFrom.
+    */
+    char *number;
+    /**
+    * Rozmiar pamięci zaalokowanej na @p number.
+    */
+    size_t number_max;
+};
+
+/**
+ * typedef dla struktury StatsWalk, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct StatsWalk StatsWalk;
+
+/**
+ * Węzeł zamrożonej struktury RedsFromTo. Synowie węzła leżą w tablicy
+ * węzłów obok siebie, w kolejności rosnących cyfr.
+ */
+struct FrozenRft {
+    /**
+    * Indeks pierwszego syna.
+    */
+    uint32_t first_child;
+    /**
+    * Położenie spakowanego przekierowania w puli numerów
+    * albo NO_OFFSET, jeśli węzeł nie ma przekierowania.
+    */
+    uint32_t redirection;
+    /**
+    * Maska cyfr, dla których istnieje syn.
+    */
+    unsigned short bitmap;
+    /**
+    * Liczba cyfr w etykiecie.
+    */
+    unsigned char label_length;
+    /**
+    * Cyfry na krawędzi prowadzącej do węzła, po dwie w bajcie.
+    */
+    unsigned char label[LABEL_LENGTH/2];
+};
+
+/**
+ * typedef dla struktury FrozenRft, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct FrozenRft FrozenRft;
+
+/**
+ * Węzeł zamrożonej struktury RedsToFrom.
+ */
+struct FrozenRtf {
+    /**
+    * Indeks pierwszego syna.
+    */
+    uint32_t first_child;
+    /**
+    * Indeks pierwszego przekierowania "od" w tablicy przekierowań.
+    */
+    uint32_t first_source;
+    /**
+    * Liczba przekierowań "od".
+    */
+    uint32_t source_count;
+    /**
+    * Maska cyfr, dla których istnieje syn.
+    */
+    unsigned short bitmap;
+};
+
+/**
+ * typedef dla struktury FrozenRtf, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct FrozenRtf FrozenRtf;
+
+/**
+ * Nagłówek zamrożonej postaci przekierowań. Za nagłówkiem, w tym samym
+ * bloku pamięci, leżą węzły RedsFromTo i RedsToFrom w kolejności
+ * przeszukiwania wszerz (korzeń ma indeks 0), tablica przekierowań "od"
+ * i pula spakowanych numerów. Części bloku odwołują się do siebie tylko
+ * przez indeksy i przesunięcia, więc blok można przenosić w pamięci.
+ */
+struct Frozen {
+    /**
+    * Rozmiar całego bloku w bajtach.
+    */
+    size_t size;
+    /**
+    * Liczba węzłów RedsFromTo.
+    */
+    size_t rft_count;
+    /**
+    * Liczba węzłów RedsToFrom.
+    */
+    size_t rtf_count;
+    /**
+    * Liczba przekierowań "od".
+    */
+    size_t source_count;
+    /**
+    * Rozmiar puli numerów w bajtach.
+    */
+    size_t pool_size;
+    /**
+    * Przesunięcie tablicy węzłów RedsFromTo względem początku bloku.
+    */
+    size_t rft_offset;
+    /**
+    * Przesunięcie tablicy węzłów RedsToFrom.
+    */
+    size_t rtf_offset;
+    /**
+    * Przesunięcie tablicy położeń przekierowań "od" w puli numerów.
+    */
+    size_t sources_offset;
+    /**
+    * Przesunięcie puli numerów.
+    */
+    size_t pool_offset;
+};
+
+/**
+ * typedef dla struktury Frozen, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct Frozen Frozen;
+
+/**
+ * Nagłówek pliku z zapisaną bazą przekierowań. Za nagłówkiem leży
+ * zamrożona postać bazy (zob. @ref Frozen) o rozmiarze @p size.
+ */
+struct SnapshotHeader {
+    /**
+    * Napis SNAPSHOT_MAGIC bez kończącego znaku '\0'.
+    */
+    char magic[8];
+    /**
+    * Wersja formatu, SNAPSHOT_VERSION.
+    */
+    uint32_t version;
+    /**
+    * Rozmiar typu size_t na maszynie, która zapisała plik.
+    */
+    uint32_t word_size;
+    /**
+    * Stała SNAPSHOT_BYTE_ORDER zapisana w kolejności bajtów maszyny,
+    * która zapisała plik.
+    */
+    uint64_t byte_order;
+    /**
+    * Rozmiar zamrożonej postaci w bajtach.
+    */
+    uint64_t size;
+    /**
+    * Skrót FNV-1a zamrożonej postaci (zob. @ref hash_packed).
+    */
+    uint64_t checksum;
+};
+
+/**
+ * typedef dla struktury SnapshotHeader, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct SnapshotHeader SnapshotHeader;
+
+/** @brief Funkcja alokująca strukturę PhoneNumbers.
+ * Funkcja alokuje pamięc i zwraca wskaźnik na strukturę
+ * PhoneNumbers, która musi potem zostać zwolniona funkcją
+ * @ref phnumDelete.
+ * @return Wskaźnik na nowo utworzoną strukturę.
+*/
+PhoneNumbers *declare_phone_numbers() {
+    PhoneNumbers *new = malloc(sizeof(PhoneNumbers));
+    new->current_length = 0;
+    new->max_length = BASIC_ARRAY_LENGTH;
+    new->array_of_numbers = malloc(BASIC_ARRAY_LENGTH*sizeof(char*));
+    for (int i = 0; i < BASIC_ARRAY_LENGTH; i++)
+        new->array_of_numbers[i] = NULL;
+    return new;
+}
+
+/** @brief Odczytuje cyfrę z tablicy spakowanych cyfr.
+ * Cyfry (wraz z ':' i ';' jako 10 i 11) są zapisane po dwie w bajcie,
+ * pierwsza w starszej połówce.
+ * @param[in] digits - wskaźnik na spakowane cyfry.
+ * @param[in] i - indeks cyfry.
+ * @return Wartość cyfry od 0 do COUNT_OF_NUMBERS-1.
+*/
+static inline int get_digit(unsigned char const *digits, size_t i) {
+    return i % 2 == 0 ? digits[i/2] >> 4 : digits[i/2] & 15;
+}
+
+/** @brief Zapisuje cyfrę w tablicy spakowanych cyfr.
+ * @param[out] digits - wskaźnik na spakowane cyfry.
+ * @param[in] i - indeks cyfry.
+ * @param[in] digit - wartość cyfry od 0 do COUNT_OF_NUMBERS-1.
+*/
+static inline void set_digit(unsigned char *digits, size_t i, int digit) {
+    if (i % 2 == 0)
+        digits[i/2] = (digits[i/2] & 15) | (digit << 4);
+    else
+        digits[i/2] = (digits[i/2] & 240) | digit;
+}
+
+/** @brief Odczytuje długość spakowanego numeru.
+ * Spakowany numer zaczyna się od długości zapisanej po 7 bitów na bajt
+ * (najstarszy bit oznacza, że długość ma kolejny bajt), po której
+ * następują cyfry zapisane po dwie w bajcie.
+ * @param[in] packed - wskaźnik na spakowany numer.
+ * @param[out] digits - wskaźnik, pod który zostanie zapisany adres cyfr.
+ * @return Liczba cyfr numeru.
+*/
+static size_t packed_length(char const *packed, unsigned char const **digits) {
+    unsigned char const *byte = (unsigned char const *)packed;
+    size_t length = 0;
+    int shift = 0;
+    while (*byte & 128) {
+        length |= (size_t)(*byte++ & 127) << shift;
+        shift += 7;
+    }
+    length |= (size_t)*byte++ << shift;
+    *digits = byte;
+    return length;
+}
+
+/** @brief Oblicza rozmiar spakowanego numeru.
+ * @param[in] length - liczba cyfr numeru.
+ * @return Liczba bajtów zajmowanych przez spakowany numer.
+*/
+static size_t packed_size(size_t length) {
+    size_t size = 1;
+    for (size_t rest = length; rest >= 128; rest >>= 7)
+        size++;
+    return size + (length+1)/2;
+}
+
+/** @brief Pakuje numer.
+ * Zapisuje pod adresem @p packed spakowaną postać numeru @p num, zajmującą
+ * około połowy pamięci zwykłego napisu.
+ * @param[in] num - wskaźnik na napis reprezentujący numer.
+ * @param[in] length - długość numeru @p num.
+ * @param[out] packed - wskaźnik na pamięć na co najmniej
+ *                      @ref packed_size(length) bajtów.
+*/
+static void pack_number(char const *num, size_t length, char *packed) {
+    unsigned char *byte = (unsigned char *)packed;
+    size_t rest = length;
+    while (rest >= 128) {
+        *byte++ = (rest & 127) | 128;
+        rest >>= 7;
+    }
+    *byte++ = rest;
+    for (size_t i = 0; i + 1 < length; i += 2)
+        byte[i/2] = (CHAR_TO_NUMBER(num[i]) << 4) | CHAR_TO_NUMBER(num[i+1]);
+    if (length % 2 == 1)
+        byte[length/2] = CHAR_TO_NUMBER(num[length-1]) << 4;
+}
+
+/** @brief Rozpakowuje numer.
+ * Zapisuje cyfry spakowanego numeru pod adresem @p result, bez kończącego
+ * znaku '\0'.
+ * @param[in] packed - wskaźnik na spakowany numer.
+ * @param[out] result - wskaźnik na pamięć na co najmniej tyle znaków, ile
+ *                      cyfr ma numer.
+ * @return Liczba zapisanych znaków.
+*/
+static size_t unpack_number(char const *packed, char *result) {
+    unsigned char const *digits;
+    size_t length = packed_length(packed, &digits);
+    for (size_t i = 0; i + 1 < length; i += 2) {
+        result[i] = (digits[i/2] >> 4) + '0';
+        result[i+1] = (digits[i/2] & 15) + '0';
+    }
+    if (length % 2 == 1)
+        result[length-1] = (digits[length/2] >> 4) + '0';
+    return length;
+}
+
+/** @brief Porównuje dwa spakowane numery.
+ * Porządek jest taki sam jak porządek funkcji strcmp na rozpakowanych
+ * numerach.
+ * @param[in] a - wskaźnik na pierwszy spakowany numer.
+ * @param[in] b - wskaźnik na drugi spakowany numer.
+ * @return Liczba ujemna, zero lub dodatnia, gdy @p a jest odpowiednio
+ *         mniejszy, równy lub większy od @p b.
+*/
+static int compare_packed(char const *a, char const *b) {
+    unsigned char const *digits_a, *digits_b;
+    size_t length_a = packed_length(a, &digits_a);
+    size_t length_b = packed_length(b, &digits_b);
+    size_t common = length_a < length_b ? length_a : length_b;
+    int result = memcmp(digits_a, digits_b, common/2);
+    if (result == 0 && common % 2 == 1)
+        result = (digits_a[common/2] >> 4) - (digits_b[common/2] >> 4);
+    if (result == 0)
+        return (length_a > length_b) - (length_a < length_b);
+    return result;
+}
+
+/** @brief Porównuje spakowany numer ze zwykłym napisem.
+ * @param[in] packed - wskaźnik na spakowany numer.
+ * @param[in] num - wskaźnik na napis reprezentujący numer.
+ * @return Liczba ujemna, zero lub dodatnia, gdy @p packed jest odpowiednio
+ *         mniejszy, równy lub większy od @p num.
+*/
+static int compare_packed_string(char const *packed, char const *num) {
+    unsigned char const *digits;
+    size_t length = packed_length(packed, &digits);
+    size_t i = 0;
+    while (i < length && num[i] != '\0') {
+        int difference = get_digit(digits, i) - CHAR_TO_NUMBER(num[i]);
+        if (difference != 0)
+            return difference;
+        i++;
+    }
+    return (i < length) - (num[i] != '\0');
+}
+
+/** @brief Odkłada obiekt do późniejszego zwolnienia.
+ * Obiekt zostanie zwolniony przez @ref epochReclaim, gdy żaden czytelnik
+ * nie będzie mógł go już czytać.
+ * @param[in, out] epochs - wskaźnik na stan odzyskiwania pamięci.
+ * @param[in] object - wskaźnik na odłączony obiekt.
+ * @param[in] arena - wskaźnik na arenę, z której pochodzi węzeł, albo NULL
+ *                    dla numeru z tablicy internowanych numerów.
+*/
+static void epochRetire(Epochs *epochs, void *object, NodeArena *arena) {
+    if (epochs->retired_count == epochs->retired_max) {
+        size_t max = epochs->retired_max == 0 ? BASIC_ARRAY_LENGTH : 2*epochs->retired_max;
+        Retired *retired = realloc(epochs->retired, max*sizeof(Retired));
+        if (retired == NULL) return; // leaking is safer than freeing too early
+        epochs->retired = retired;
+        epochs->retired_max = max;
+    }
+    Retired *entry = &epochs->retired[epochs->retired_count++];
+    entry->object = object;
+    entry->arena = arena;
+    entry->epoch = atomic_load_explicit(&epochs->epoch, memory_order_relaxed);
+}
+
+/**
+ * Miejsce, od którego wątek zaczyna szukać wolnego miejsca czytelnika,
+ * zero oznacza, że jeszcze go nie wybrano.
+ */
+static _Thread_local unsigned reader_hint;
+
+/**
+ * Liczba wątków, które wybrały już miejsce czytelnika.
+ */
+static atomic_uint reader_threads;
+
+/** @brief Rozpoczyna operację czytania.
+ * Zajmuje wolne miejsce czytelnika i ogłasza w nim bieżącą epokę. Jeśli
+ * wszystkie miejsca są zajęte, czeka na zwolnienie któregoś z nich.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @return Wskaźnik na zajęte miejsce albo NULL, jeśli tryb współbieżnych
+ *         czytelników jest wyłączony.
+*/
+static ReaderSlot *readerEnter(PhoneForward *pf) {
+    Epochs *epochs = pf->epochs;
+    if (epochs == NULL)
+        return NULL;
+    if (reader_hint == 0)
+        reader_hint = atomic_fetch_add_explicit(&reader_threads, 1, memory_order_relaxed) + 1;
+    for (unsigned i = reader_hint; ; i++) {
+        ReaderSlot *slot = &epochs->readers[i % READER_SLOTS];
+        unsigned long expected = 0;
+        if (atomic_load_explicit(&slot->epoch, memory_order_relaxed) == 0
+            && atomic_compare_exchange_strong(&slot->epoch, &expected, atomic_load(&epochs->epoch)))
+            return slot;
+    }
+}
+
+/** @brief Kończy operację czytania.
+ * @param[in] slot - wskaźnik na miejsce zwrócone przez @ref readerEnter.
+*/
+static void readerExit(ReaderSlot *slot) {
+    if (slot != NULL)
+        atomic_store_explicit(&slot->epoch, 0, memory_order_release);
+}
+
+/** @brief Inicjalizuje tablicę internowanych numerów.
+ * @param[out] table - wskaźnik na inicjalizowaną tablicę.
+*/
+static void internInit(InternTable *table) {
+    table->buckets = NULL;
+    table->bucket_count = 0;
+    table->count = 0;
+    table->epochs = NULL;
+}
+
+/** @brief Oblicza skrót spakowanego numeru.
+ * Używa funkcji FNV-1a.
+ * @param[in] packed - wskaźnik na spakowany numer.
+ * @param[in] size - rozmiar spakowanego numeru w bajtach.
+ * @return Skrót numeru.
+*/
+static size_t hash_packed(char const *packed, size_t size) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char)packed[i];
+        hash *= 1099511628211ULL;
+    }
+    return (size_t)hash;
+}
+
+/** @brief Zmienia liczbę kubełków tablicy internowanych numerów.
+ * Rozkłada wpisy według zapamiętanych skrótów.
+ * @param[in, out] table - wskaźnik na tablicę.
+ * @param[in] bucket_count - nowa liczba kubełków, potęga dwójki.
+ * @return @p true, jeśli udało się zaalokować pamięć.
+*/
+static bool internResize(InternTable *table, size_t bucket_count) {
+    InternedNumber **buckets = calloc(bucket_count, sizeof(InternedNumber*));
+    if (buckets == NULL) return false;
+    for (size_t i = 0; i < table->bucket_count; i++) {
+        InternedNumber *entry = table->buckets[i];
+        while (entry != NULL) {
+            InternedNumber *next = entry->next;
+            size_t index = entry->hash & (bucket_count - 1);
+            entry->next = buckets[index];
+            buckets[index] = entry;
+            entry = next;
+        }
+    }
+    free(table->buckets);
+    table->buckets = buckets;
+    table->bucket_count = bucket_count;
+    return true;
+}
+
+/** @brief Powiększa tablicę internowanych numerów.
+ * Podwaja liczbę kubełków.
+ * @param[in, out] table - wskaźnik na tablicę.
+ * @return @p true, jeśli udało się zaalokować pamięć.
+*/
+static bool internGrow(InternTable *table) {
+    return internResize(table, table->bucket_count == 0 ? BASIC_TABLE_LENGTH : 2*table->bucket_count);
+}
+
+/** @brief Przygotowuje tablicę internowanych numerów na nowe numery.
+ * Powiększa tablicę od razu do liczby kubełków potrzebnej po dodaniu
+ * @p count numerów, zamiast podwajać ją wielokrotnie.
+ * @param[in, out] table - wskaźnik na tablicę.
+ * @param[in] count - liczba numerów, które mogą zostać dodane.
+*/
+static void internReserve(InternTable *table, size_t count) {
+    size_t bucket_count = table->bucket_count > 0 ? table->bucket_count : BASIC_TABLE_LENGTH;
+    while (bucket_count < table->count + count)
+        bucket_count *= 2;
+    if (bucket_count != table->bucket_count)
+        internResize(table, bucket_count);
+}
+
+/** @brief Zwraca internowaną postać numeru.
+ * Wyszukuje numer @p num w tablicy, a jeśli go nie ma, dodaje go.
+ * Zwiększa licznik odwołań do numeru, który musi zostać potem zmniejszony
+ * funkcją @ref internRelease.
+ * @param[in, out] table - wskaźnik na tablicę internowanych numerów.
+ * @param[in] num - wskaźnik na napis reprezentujący numer.
+ * @param[in] length - długość numeru @p num.
+ * @return Wskaźnik na spakowany numer współdzielony przez wszystkich
+ *         użytkowników albo NULL, gdy nie udało się zaalokować pamięci.
+*/
+static char *internGet(InternTable *table, char const *num, size_t length) {
+    char buffer[INTERN_BUFFER_LENGTH];
+    size_t size = packed_size(length);
+    char *packed = size <= INTERN_BUFFER_LENGTH ? buffer : malloc(size);
+    if (packed == NULL) return NULL;
+    pack_number(num, length, packed);
+    size_t hash = hash_packed(packed, size);
+    InternedNumber *entry = NULL;
+    if (table->bucket_count > 0) {
+        entry = table->buckets[hash & (table->bucket_count - 1)];
+        while (entry != NULL && (entry->hash != hash || memcmp(entry->packed, packed, size) != 0))
+            entry = entry->next;
+    }
+    if (entry == NULL && (table->count < table->bucket_count || internGrow(table))) {
+        entry = malloc(sizeof(InternedNumber) + size);
+        if (entry != NULL) {
+            size_t index = hash & (table->bucket_count - 1);
+            entry->hash = hash;
+            entry->references = 0;
+            memcpy(entry->packed, packed, size);
+            entry->next = table->buckets[index];
+            table->buckets[index] = entry;
+            table->count++;
+        }
+    }
+    if (packed != buffer)
+        free(packed);
+    if (entry == NULL) return NULL;
+    entry->references++;
+    return entry->packed;
+}
+
+/** @brief Dodaje odwołanie do internowanego numeru.
+ * Nic nie robi, jeśli @p packed ma wartość NULL.
+ * @param[in] packed - wskaźnik zwrócony przez @ref internGet.
+*/
+static void internRetain(char const *packed) {
+    if (packed != NULL)
+        INTERNED(packed)->references++;
+}
+
+/** @brief Zwalnia odwołanie do internowanego numeru.
+ * Zmniejsza licznik odwołań, a gdy spadnie on do zera, usuwa numer
+ * z tablicy i zwalnia jego pamięć. Nic nie robi, jeśli @p packed ma
+ * wartość NULL.
+ * @param[in, out] table - wskaźnik na tablicę internowanych numerów.
+ * @param[in] packed - wskaźnik zwrócony przez @ref internGet.
+*/
+static void internRelease(InternTable *table, char const *packed) {
+    if (packed != NULL) {
+        InternedNumber *entry = INTERNED(packed);
+        if (--entry->references == 0) {
+            InternedNumber **link = &table->buckets[entry->hash & (table->bucket_count - 1)];
+            while (*link != entry)
+                link = &(*link)->next;
+            *link = entry->next;
+            table->count--;
+            if (table->epochs != NULL)
+                epochRetire(table->epochs, entry, NULL);
+            else
+                free(entry);
+        }
+    }
+}
+
+/** @brief Usuwa tablicę internowanych numerów.
+ * Zwalnia wszystkie numery niezależnie od liczby odwołań.
+ * @param[in, out] table - wskaźnik na usuwaną tablicę.
+*/
+static void internDelete(InternTable *table) {
+    for (size_t i = 0; i < table->bucket_count; i++) {
+        InternedNumber *entry = table->buckets[i];
+        while (entry != NULL) {
+            InternedNumber *next = entry->next;
+            free(entry);
+            entry = next;
+        }
+    }
+    free(table->buckets);
+    internInit(table);
+}
+
+/** @brief Inicjalizuje arenę.
+ * Inicjalizuje pustą arenę węzłów o rozmiarze @p node_size. Arena nie
+ * alokuje pamięci, dopóki nie zostanie z niej wydzielony pierwszy węzeł.
+ * @param[out] arena - wskaźnik na inicjalizowaną arenę.
+ * @param[in] node_size - rozmiar pojedynczego węzła w bajtach.
+*/
+static void arenaInit(NodeArena *arena, size_t node_size) {
+    arena->chunks = NULL;
+    arena->free_list = NULL;
+    arena->node_size = node_size;
+}
+
+/** @brief Wydziela węzeł z areny.
+ * Zwraca węzeł z listy wolnych, a jeśli jest ona pusta, kolejny węzeł
+ * z ostatniego bloku. Gdy blok się zapełni, alokuje nowy, dwa razy większy
+ * (ale nie większy niż MAX_CHUNK_LENGTH węzłów).
+ * @param[in] arena - wskaźnik na arenę.
+ * @return Wskaźnik na niezainicjalizowany węzeł lub NULL, gdy nie udało się
+ *         zaalokować pamięci.
+*/
+static void *arenaAlloc(NodeArena *arena) {
+    if (arena->free_list != NULL) {
+        void *node = arena->free_list;
+        memcpy(&arena->free_list, node, sizeof(void*));
+        return node;
+    }
+    struct ArenaChunk *chunk = arena->chunks;
+    if (chunk == NULL || chunk->used == chunk->length) {
+        size_t length = FIRST_CHUNK_LENGTH;
+        if (chunk != NULL && 2*chunk->length <= MAX_CHUNK_LENGTH)
+            length = 2*chunk->length;
+        else if (chunk != NULL)
+            length = MAX_CHUNK_LENGTH;
+        chunk = malloc(sizeof(struct ArenaChunk) + length*arena->node_size);
+        if (chunk == NULL) return NULL;
+        chunk->previous = arena->chunks;
+        chunk->length = length;
+        chunk->used = 0;
+        arena->chunks = chunk;
+    }
+    return chunk->nodes + arena->node_size*chunk->used++;
+}
+
+/** @brief Rezerwuje miejsce na węzły w arenie.
+ * Jeśli w ostatnim bloku zostało mniej niż @p count wolnych węzłów,
+ * alokuje od razu blok na @p count węzłów, tak aby kolejne wywołania
+ * @ref arenaAlloc nie alokowały pamięci.
+ * @param[in] arena - wskaźnik na arenę.
+ * @param[in] count - liczba węzłów, które zostaną wydzielone.
+*/
+static void arenaReserve(NodeArena *arena, size_t count) {
+    struct ArenaChunk *chunk = arena->chunks;
+    if (count <= MAX_CHUNK_LENGTH || (chunk != NULL && chunk->length - chunk->used >= count))
+        return; // a few chunks more are allocated as usual
+    chunk = malloc(sizeof(struct ArenaChunk) + count*arena->node_size);
+    if (chunk == NULL) return;
+    chunk->previous = arena->chunks;
+    chunk->length = count;
+    chunk->used = 0;
+    arena->chunks = chunk;
+}
+
+/** @brief Zwraca węzeł do areny.
+ * Węzeł trafia na listę wolnych i zostanie użyty przy kolejnym
+ * wywołaniu @ref arenaAlloc. Pierwsze słowo węzła zostaje nadpisane.
+ * @param[in] arena - wskaźnik na arenę.
+ * @param[in] node - wskaźnik na zwalniany węzeł.
+*/
+static void arenaFree(NodeArena *arena, void *node) {
+    memcpy(node, &arena->free_list, sizeof(void*));
+    arena->free_list = node;
+}
+
+/** @brief Usuwa arenę.
+ * Dla każdego wydzielonego kiedykolwiek węzła wywołuje @p release (jeśli
+ * nie jest NULL), przeglądając bloki po kolei, a następnie zwalnia całe bloki.
+ * Funkcja @p release musi poprawnie obsłużyć węzły leżące na liście wolnych.
+ * @param[in] arena - wskaźnik na usuwaną arenę.
+ * @param[in] release - funkcja zwalniająca dane przechowywane w węźle.
+*/
+static void arenaDelete(NodeArena *arena, void (*release)(void *)) {
+    struct ArenaChunk *chunk = arena->chunks;
+    while (chunk != NULL) {
+        struct ArenaChunk *previous = chunk->previous;
+        if (release != NULL)
+            for (size_t i = 0; i < chunk->used; i++)
+                release(chunk->nodes + arena->node_size*i);
+        free(chunk);
+        chunk = previous;
+    }
+    arenaInit(arena, arena->node_size);
+}
+
+/** @brief Liczy ustawione bity.
+ * @param[in] bitmap - maska bitowa.
+ * @return Liczba ustawionych bitów maski @p bitmap.
+*/
+static inline int count_bits(unsigned bitmap) {
+#ifdef __GNUC__
+    return __builtin_popcount(bitmap);
+#else
+    int count = 0;
+    for (; bitmap != 0; bitmap &= bitmap - 1)
+        count++;
+    return count;
+#endif
+}
+
+/** @brief Inicjalizuje pusty zbiór synów.
+ * @param[out] set - wskaźnik na inicjalizowany zbiór.
+*/
+static void childSetInit(ChildSet *set) {
+    set->bitmap = 0;
+    for (int i = 0; i < TINY_CHILDREN; i++)
+        set->children.tiny[i] = NULL;
+}
+
+/** @brief Zwraca liczbę synów.
+ * @param[in] set - wskaźnik na zbiór synów.
+ * @return Liczba synów.
+*/
+static inline int childSetCount(ChildSet const *set) {
+    return count_bits(set->bitmap);
+}
+
+/** @brief Zwraca syna dla danej cyfry.
+ * @param[in] set - wskaźnik na zbiór synów.
+ * @param[in] digit - cyfra od 0 do COUNT_OF_NUMBERS-1.
+ * @return Wskaźnik na syna albo NULL, jeśli go nie ma.
+*/
+static inline void *childSetGet(ChildSet const *set, int digit) {
+    unsigned bit = 1u << digit;
+    if ((set->bitmap & bit) == 0)
+        return NULL;
+    int slot = count_bits(set->bitmap & (bit - 1));
+    if (count_bits(set->bitmap) <= TINY_CHILDREN)
+        return set->children.tiny[slot];
+    return set->children.array[slot];
+}
+
+/** @brief Ustawia syna dla danej cyfry.
+ * Wstawia, podmienia albo (gdy @p child ma wartość NULL) usuwa syna.
+ * Przy zmianie liczby synów węzeł przechodzi między postacią małą
+ * a tablicą odpowiedniej pojemności, zwalniając poprzednią tablicę.
+ * @param[in] arenas - wskaźnik na areny tablic synów.
+ * @param[in, out] set - wskaźnik na zbiór synów.
+ * @param[in] digit - cyfra od 0 do COUNT_OF_NUMBERS-1.
+ * @param[in] child - wskaźnik na nowego syna albo NULL.
+ * @return @p false, jeśli nie udało się zaalokować pamięci, @p true
+ *         w przeciwnym razie.
+*/
+static bool childSetPut(NodeArena *arenas, ChildSet *set, int digit, void *child) {
+    unsigned bit = 1u << digit;
+    int count = count_bits(set->bitmap);
+    int slot = count_bits(set->bitmap & (bit - 1));
+    void **old = count <= TINY_CHILDREN ? set->children.tiny : set->children.array;
+    if (set->bitmap & bit && child != NULL) {
+        old[slot] = child;
+        return true;
+    }
+    if ((set->bitmap & bit) == 0 && child == NULL)
+        return true;
+    int new_count = child != NULL ? count + 1 : count - 1;
+    void *copy[COUNT_OF_NUMBERS];
+    int j = 0;
+    for (int i = 0; i < count; i++) {
+        if (i == slot && child != NULL)
+            copy[j++] = child;
+        if (i != slot || child != NULL)
+            copy[j++] = old[i];
+    }
+    if (slot == count)
+        copy[j++] = child;
+    void **new;
+    if (new_count <= TINY_CHILDREN)
+        new = set->children.tiny;
+    else if (count > TINY_CHILDREN && CHILD_ARRAY_CLASS(count) == CHILD_ARRAY_CLASS(new_count))
+        new = set->children.array;
+    else if ((new = arenaAlloc(&arenas[CHILD_ARRAY_CLASS(new_count)])) == NULL)
+        return false;
+    if (count > TINY_CHILDREN && new != old)
+        arenaFree(&arenas[CHILD_ARRAY_CLASS(count)], old);
+    memcpy(new, copy, new_count*sizeof(void*));
+    if (new_count > TINY_CHILDREN)
+        set->children.array = new;
+    set->bitmap ^= bit;
+    return true;
+}
+
+/** @brief Zwalnia pamięć zbioru synów.
+ * Zwraca tablicę synów dużego węzła do areny. Samych synów nie usuwa.
+ * @param[in] arenas - wskaźnik na areny tablic synów.
+ * @param[in, out] set - wskaźnik na zwalniany zbiór.
+*/
+static void childSetRelease(NodeArena *arenas, ChildSet *set) {
+    int count = count_bits(set->bitmap);
+    if (count > TINY_CHILDREN)
+        arenaFree(&arenas[CHILD_ARRAY_CLASS(count)], set->children.array);
+    childSetInit(set);
+}
+
+/** @brief Kopiuje tablicę synów.
+ * Po skopiowaniu węzła daje kopii własną tablicę synów, jeśli węzeł jest duży.
+ * @param[in] arenas - wskaźnik na areny tablic synów.
+ * @param[in, out] set - wskaźnik na zbiór synów kopii węzła.
+ * @return @p false, jeśli nie udało się zaalokować pamięci, @p true
+ *         w przeciwnym razie.
+*/
+static bool childSetCopy(NodeArena *arenas, ChildSet *set) {
+    int count = count_bits(set->bitmap);
+    if (count > TINY_CHILDREN) {
+        void **array = arenaAlloc(&arenas[CHILD_ARRAY_CLASS(count)]);
+        if (array == NULL) return false;
+        memcpy(array, set->children.array, count*sizeof(void*));
+        set->children.array = array;
+    }
+    return true;
+}
+
+/** @brief Dodaje odwołanie do każdego syna.
+ * Oba rodzaje węzłów zaczynają się od zbioru synów, więc funkcja
+ * obsługuje zarówno RedsFromTo, jak i RedsToFrom.
+ * @param[in] set - wskaźnik na zbiór synów.
+*/
+static void childSetShare(ChildSet const *set) {
+    int count = childSetCount(set);
+    void * const *children = count <= TINY_CHILDREN ? set->children.tiny : set->children.array;
+    for (int i = 0; i < count; i++)
+        ((ChildSet *)children[i])->references++;
+}
+
+/** @brief Zeruje numery wersji poddrzewa.
+ * Oba rodzaje węzłów zaczynają się od zbioru synów, więc funkcja
+ * obsługuje zarówno RedsFromTo, jak i RedsToFrom.
+ * @param[in, out] set - wskaźnik na zbiór synów korzenia poddrzewa.
+*/
+static void childSetResetVersions(ChildSet *set) {
+    set->version = 0;
+    for (int i = 0; i < COUNT_OF_NUMBERS; i++) {
+        ChildSet *child = childSetGet(set, i);
+        if (child != NULL)
+            childSetResetVersions(child);
+    }
+}
+
+/** @brief Funkcja alokująca strukturę RedsFromTo.
+ * Funkcja wydziela z areny węzeł RedsFromTo. Węzeł jest
+ * zwalniany razem z areną w @ref phfwdDelete.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @return Wskaźnik na nowo utworzoną strukturę.
+*/
+RedsFromTo *rftNew(PhoneForward *pf) {
+    RedsFromTo *new = arenaAlloc(&pf->store->rft_arena);
+    if (new == NULL) return NULL;
+    new->redirection = NULL;
+    new->label_length = 0;
+    childSetInit(&new->children);
+    new->children.references = 1;
+    new->children.version = pf->version;
+    return new;
+}
+
+/** @brief Zwraca rozmiar węzła B+ drzewa w bajtach.
+ * @param[in] height - wysokość węzła.
+ * @return Rozmiar węzła.
+*/
+static inline size_t source_node_bytes(unsigned short height) {
+    return sizeof(SourceNode) + (height > 0 ? SOURCE_NODE_KEYS*sizeof(SourceNode *) : 0);
+}
+
+/** @brief Alokuje pusty węzeł B+ drzewa przekierowań "od".
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] height - wysokość węzła, zero dla liścia.
+ * @return Wskaźnik na nowy węzeł albo NULL, gdy nie udało się zaalokować
+ *         pamięci.
+*/
+static SourceNode *sourceNodeNew(PhoneForward *pf, unsigned short height) {
+    SourceNode *new = malloc(source_node_bytes(height));
+    if (new == NULL)
+        return NULL;
+    new->size = 0;
+    new->version = pf->version;
+    new->count = 0;
+    new->height = height;
+    new->references = 1;
+    return new;
+}
+
+/** @brief Dodaje odwołania do zawartości węzła B+ drzewa.
+ * Wywoływana, gdy zawartość współdzielonego węzła zaczyna należeć także
+ * do kogoś innego: synowie węzła wewnętrznego dostają odwołanie, a numery
+ * liścia są zatrzymywane.
+ * @param[in] node - wskaźnik na węzeł.
+*/
+static void sourceNodeShare(SourceNode const *node) {
+    for (int i = 0; i < node->count; i++) {
+        if (node->height > 0)
+            node->children[i]->references++;
+        else
+            internRetain(node->keys[i]);
+    }
+}
+
+/** @brief Usuwa węzeł B+ drzewa odłączony od drzewa.
+ * Zawartość węzła należy odtąd do wywołującego. Węzeł współdzielony
+ * z klonem zostaje, traci tylko jedno odwołanie.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] node - wskaźnik na usuwany węzeł.
+*/
+static void sourceNodeDiscard(PhoneForward *pf, SourceNode *node) {
+    if (node->references > 1) {
+        sourceNodeShare(node);
+        node->references--;
+    }
+    else if (pf->epochs != NULL && node->version != pf->version)
+        epochRetire(pf->epochs, node, NULL);
+    else
+        free(node);
+}
+
+/** @brief Zwraca węzeł B+ drzewa, który można modyfikować.
+ * Węzeł współdzielony z czytelnikami albo z klonem jest kopiowany,
+ * a oryginał usuwany (zob. @ref sourceNodeDiscard). Synowie są
+ * współdzieleni przez kopię i oryginał.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] node - wskaźnik na węzeł.
+ * @return Wskaźnik na @p node albo na jego kopię lub NULL, gdy nie udało się
+ *         zaalokować pamięci; wtedy @p node pozostaje niezmieniony.
+*/
+static SourceNode *sourceNodeWritable(PhoneForward *pf, SourceNode *node) {
+    if (node->references == 1 && (pf->epochs == NULL || node->version == pf->version))
+        return node;
+    SourceNode *copy = malloc(source_node_bytes(node->height));
+    if (copy == NULL)
+        return NULL;
+    memcpy(copy, node, source_node_bytes(node->height));
+    copy->version = pf->version;
+    copy->references = 1;
+    sourceNodeDiscard(pf, node);
+    return copy;
+}
+
+/** @brief Zwalnia B+ drzewo przekierowań "od".
+ * Same numery są zwalniane razem z tablicą internowanych numerów.
+ * @param[in] node - wskaźnik na korzeń drzewa albo NULL.
+*/
+static void sourceTreeDelete(SourceNode *node) {
+    if (node == NULL)
+        return;
+    for (int i = 0; i < node->count && node->height > 0; i++)
+        sourceTreeDelete(node->children[i]);
+    free(node);
+}
+
+/** @brief Zeruje numery wersji węzłów B+ drzewa.
+ * @param[in, out] node - wskaźnik na korzeń drzewa albo NULL.
+*/
+static void sourceTreeResetVersions(SourceNode *node) {
+    if (node == NULL)
+        return;
+    node->version = 0;
+    for (int i = 0; i < node->count && node->height > 0; i++)
+        sourceTreeResetVersions(node->children[i]);
+}
+
+/** @brief Przelicza liczbę numerów w poddrzewie węzła.
+ * @param[in, out] node - wskaźnik na węzeł B+ drzewa.
+*/
+static void source_node_resize(SourceNode *node) {
+    if (node->height == 0) {
+        node->size = node->count;
+        return;
+    }
+    node->size = 0;
+    for (int i = 0; i < node->count; i++)
+        node->size += node->children[i]->size;
+}
+
+/** @brief Przenosi klucze (i synów) między węzłami B+ drzewa.
+ * Obszary mogą na siebie nachodzić.
+ * @param[out] to - wskaźnik na węzeł docelowy.
+ * @param[in] to_index - indeks, od którego wpisujemy.
+ * @param[in] from - wskaźnik na węzeł źródłowy tej samej wysokości.
+ * @param[in] from_index - indeks, od którego czytamy.
+ * @param[in] count - liczba przenoszonych kluczy.
+*/
+static void source_node_move(SourceNode *to, int to_index, SourceNode const *from, int from_index, int count) {
+    memmove(&to->keys[to_index], &from->keys[from_index], count*sizeof(char *));
+    if (to->height > 0)
+        memmove(&to->children[to_index], &from->children[from_index], count*sizeof(SourceNode *));
+}
+
+/** @brief Wyszukuje miejsce numeru w węźle B+ drzewa.
+ * @param[in] node - wskaźnik na węzeł.
+ * @param[in] num - wskaźnik na szukany numer.
+ * @param[in] compare - funkcja porównująca klucz węzła z @p num
+ *                      (@ref compare_packed albo @ref compare_packed_string).
+ * @return W liściu indeks pierwszego klucza nie mniejszego niż @p num,
+ *         w węźle wewnętrznym indeks syna, w którego poddrzewie może być
+ *         @p num.
+*/
+static int source_position(SourceNode const *node, char const *num, int (*compare)(char const *, char const *)) {
+    int i = 0;
+    int j = node->count;
+    while (i < j) {
+        int m = (i+j)/2;
+        if (compare(node->keys[m], num) < 0)
+            i = m+1;
+        else
+            j = m;
+    }
+    if (node->height > 0 && (i == node->count || compare(node->keys[i], num) > 0))
+        i = i > 0 ? i-1 : 0;
+    return i;
+}
+
+/** @brief Wyszukuje numer w B+ drzewie.
+ * @param[in] root - wskaźnik na korzeń drzewa albo NULL.
+ * @param[in] num - wskaźnik na szukany numer.
+ * @param[in] compare - funkcja porównująca klucz z @p num.
+ * @return Wskaźnik na numer zapisany w drzewie albo NULL, jeśli go nie ma.
+*/
+static char *sourcesFind(SourceNode const *root, char const *num, int (*compare)(char const *, char const *)) {
+    if (root == NULL)
+        return NULL;
+    while (root->height > 0)
+        root = root->children[source_position(root, num, compare)];
+    int i = source_position(root, num, compare);
+    return i < root->count && compare(root->keys[i], num) == 0 ? root->keys[i] : NULL;
+}
+
+/** @brief Wstawia klucz do węzła B+ drzewa.
+ * Pełny węzeł jest najpierw dzielony na pół.
+ * @param[in, out] node - wskaźnik na węzeł, który można modyfikować.
+ * @param[in] i - indeks, pod który wstawiamy klucz.
+ * @param[in] key - wskaźnik na wstawiany klucz.
+ * @param[in] child - wskaźnik na wstawianego syna albo NULL w liściu.
+ * @param[in, out] spare - tablica pustych węzłów według wysokości; węzeł
+ *                         wysokości @p node jest zabierany, gdy węzeł
+ *                         jest dzielony.
+ * @return Wskaźnik na nowego prawego brata węzła albo NULL, jeśli węzeł
+ *         nie został podzielony.
+*/
+static SourceNode *source_node_put(SourceNode *node, int i, char *key, SourceNode *child, SourceNode **spare) {
+    SourceNode *sibling = NULL;
+    if (node->count == SOURCE_NODE_KEYS) {
+        int half = SOURCE_NODE_KEYS / 2;
+        sibling = spare[node->height];
+        spare[node->height] = NULL;
+        source_node_move(sibling, 0, node, half, SOURCE_NODE_KEYS - half);
+        sibling->count = SOURCE_NODE_KEYS - half;
+        node->count = half;
+        if (i > half) {
+            node = sibling;
+            i -= half;
+        }
+    }
+    source_node_move(node, i+1, node, i, node->count - i);
+    node->keys[i] = key;
+    if (node->height > 0)
+        node->children[i] = child;
+    node->count++;
+    return sibling;
+}
+
+/** @brief Wstawia numer do poddrzewa B+ drzewa.
+ * Numeru nie może być jeszcze w drzewie. Węzły są kopiowane przed zmianą
+ * czegokolwiek, więc gdy zabraknie pamięci, poddrzewo zawiera te same
+ * numery co przedtem.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in, out] node - wskaźnik na korzeń poddrzewa, po zmianie być może
+ *                        na jego kopię.
+ * @param[in] num - wskaźnik na internowany, spakowany numer.
+ * @param[in, out] spare - puste węzły dla dzielonych węzłów
+ *                         (zob. @ref source_node_put).
+ * @param[out] sibling - nowy prawy brat korzenia poddrzewa albo NULL.
+ * @return Wartość @p false, jeśli nie udało się zaalokować pamięci.
+*/
+static bool source_insert(PhoneForward *pf, SourceNode **node, char *num, SourceNode **spare, SourceNode **sibling) {
+    SourceNode *writable = sourceNodeWritable(pf, *node);
+    if (writable == NULL)
+        return false;
+    *node = writable;
+    int i = source_position(writable, num, compare_packed);
+    if (writable->height == 0)
+        *sibling = source_node_put(writable, i, num, NULL, spare);
+    else {
+        SourceNode *child_sibling;
+        if (!source_insert(pf, &writable->children[i], num, spare, &child_sibling))
+            return false;
+        writable->keys[i] = writable->children[i]->keys[0];
+        *sibling = child_sibling == NULL ? NULL : source_node_put(writable, i+1, child_sibling->keys[0], child_sibling, spare);
+    }
+    writable->size++;
+    if (*sibling != NULL) {
+        source_node_resize(writable);
+        source_node_resize(*sibling);
+    }
+    return true;
+}
+
+/** @brief Wstawia numer do B+ drzewa przekierowań "od".
+ * Węzły potrzebne do podziałów są alokowane z góry, więc gdy zabraknie
+ * pamięci, drzewo zawiera te same numery co przedtem.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in, out] root - wskaźnik na korzeń drzewa, NULL oznacza puste drzewo.
+ * @param[in] num - wskaźnik na internowany, spakowany numer.
+ * @return @p true, jeśli numer został wstawiony, @p false, jeśli
+ *         taki numer już był w drzewie albo nie udało się zaalokować
+ *         pamięci. Wtedy @p num nie jest zapamiętywany i wywołujący musi
+ *         go sam zwolnić.
+*/
+static bool sourcesInsert(PhoneForward *pf, SourceNode **root, char *num) {
+    if (*root == NULL) {
+        SourceNode *leaf = sourceNodeNew(pf, 0);
+        if (leaf == NULL)
+            return false;
+        *root = leaf;
+    }
+    else if (sourcesFind(*root, num, compare_packed) != NULL)
+        return false;
+    int split = 0; // the lowest levels, whose nodes on the path are full, are split
+    for (SourceNode const *node = *root;; node = node->children[source_position(node, num, compare_packed)]) {
+        split = node->count == SOURCE_NODE_KEYS ? split + 1 : 0;
+        if (node->height == 0)
+            break;
+    }
+    int spares = split > (*root)->height ? split + 1 : split; // a split root needs a new root
+    SourceNode *spare[SOURCE_MAX_HEIGHT + 1] = {NULL};
+    bool result = true;
+    for (int height = 0; height < spares && result; height++)
+        result = (spare[height] = sourceNodeNew(pf, height)) != NULL;
+    SourceNode *sibling = NULL;
+    if (result)
+        result = source_insert(pf, root, num, spare, &sibling);
+    if (sibling != NULL) { // the root was split, the tree grows by one level
+        SourceNode *node = *root;
+        SourceNode *new = spare[node->height + 1];
+        spare[node->height + 1] = NULL;
+        new->keys[0] = node->keys[0];
+        new->children[0] = node;
+        new->keys[1] = sibling->keys[0];
+        new->children[1] = sibling;
+        new->count = 2;
+        new->size = node->size + sibling->size;
+        *root = new;
+    }
+    for (int height = 0; height < spares; height++)
+        free(spare[height]);
+    return result;
+}
+
+/** @brief Zwraca indeks lewego z synów, których dotyczy @ref source_rebalance.
+ * @param[in] node - wskaźnik na węzeł wewnętrzny.
+ * @param[in] i - indeks syna, który ma za mało kluczy.
+ * @return Indeks lewego z dwóch sąsiednich synów.
+*/
+static inline int source_rebalance_left(SourceNode const *node, int i) {
+    return i+1 < node->count ? i : i-1;
+}
+
+/** @brief Uzupełnia syna węzła B+ drzewa, który ma za mało kluczy.
+ * Syn jest łączony z sąsiednim bratem, a jeśli razem się nie mieszczą,
+ * klucze są dzielone między nich po równo.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in, out] node - wskaźnik na węzeł, który można modyfikować.
+ * @param[in] i - indeks syna; ten syn i jego brat muszą dać się
+ *                modyfikować (zob. @ref sourcesWritablePath).
+*/
+static void source_rebalance(PhoneForward *pf, SourceNode *node, int i) {
+    int left = source_rebalance_left(node, i);
+    SourceNode *a = node->children[left];
+    SourceNode *b = node->children[left+1];
+    if (a->count + b->count <= SOURCE_NODE_KEYS) {
+        source_node_move(a, a->count, b, 0, b->count);
+        a->count += b->count;
+        a->size += b->size;
+        sourceNodeDiscard(pf, b);
+        source_node_move(node, left+1, node, left+2, node->count - left - 2);
+        node->count--;
+    }
+    else {
+        int target = (a->count + b->count) / 2;
+        if (a->count < target) {
+            int moved = target - a->count;
+            source_node_move(a, a->count, b, 0, moved);
+            source_node_move(b, 0, b, moved, b->count - moved);
+            a->count += moved;
+            b->count -= moved;
+        }
+        else {
+            int moved = a->count - target;
+            source_node_move(b, moved, b, 0, b->count);
+            source_node_move(b, 0, a, target, moved);
+            a->count -= moved;
+            b->count += moved;
+        }
+        source_node_resize(a);
+        source_node_resize(b);
+        node->keys[left+1] = b->keys[0];
+    }
+    node->keys[left] = a->keys[0];
+}
+
+/** @brief Kopiuje węzły B+ drzewa, które zmieni usunięcie numeru.
+ * Są to węzły na ścieżce do numeru i bracia synów, którzy mogą wymagać
+ * uzupełnienia (zob. @ref source_rebalance). Potem usunięcie numeru nie
+ * wymaga już alokowania pamięci.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in, out] root - wskaźnik na korzeń drzewa albo na NULL.
+ * @param[in] num - wskaźnik na usuwany numer.
+ * @param[in] compare - funkcja porównująca klucz z @p num.
+ * @return Wartość @p false, jeśli nie udało się zaalokować pamięci; wtedy
+ *         drzewo zawiera te same numery, a część węzłów mogła już zostać
+ *         skopiowana.
+*/
+static bool sourcesWritablePath(PhoneForward *pf, SourceNode **root, char const *num, int (*compare)(char const *, char const *)) {
+    for (SourceNode **link = root; *link != NULL;) {
+        SourceNode *node = sourceNodeWritable(pf, *link);
+        if (node == NULL)
+            return false;
+        *link = node;
+        if (node->height == 0)
+            break;
+        int i = source_position(node, num, compare);
+        if (node->children[i]->count <= SOURCE_MIN_KEYS) { // the child loses at most one key
+            int brother = source_rebalance_left(node, i) == i ? i+1 : i-1;
+            SourceNode *copy = sourceNodeWritable(pf, node->children[brother]);
+            if (copy == NULL)
+                return false;
+            node->children[brother] = copy;
+        }
+        link = &node->children[i];
+    }
+    return true;
+}
+
+/** @brief Usuwa numer z poddrzewa B+ drzewa.
+ * Numer musi być w drzewie, a węzły zmieniane przez usunięcie muszą dać
+ * się modyfikować (zob. @ref sourcesWritablePath).
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in, out] node - wskaźnik na korzeń poddrzewa.
+ * @param[in] num - wskaźnik na usuwany numer.
+ * @param[in] compare - funkcja porównująca klucz z @p num.
+ * @param[out] removed - usunięty, internowany numer.
+*/
+static void source_remove(PhoneForward *pf, SourceNode *node, char const *num, int (*compare)(char const *, char const *), char **removed) {
+    int i = source_position(node, num, compare);
+    node->size--;
+    if (node->height == 0) {
+        *removed = node->keys[i];
+        source_node_move(node, i, node, i+1, node->count - i - 1);
+        node->count--;
+        return;
+    }
+    SourceNode *child = node->children[i];
+    source_remove(pf, child, num, compare, removed);
+    if (child->count < SOURCE_MIN_KEYS)
+        source_rebalance(pf, node, i);
+    else
+        node->keys[i] = child->keys[0];
+}
+
+/** @brief Usuwa numer z B+ drzewa przekierowań "od".
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in, out] root - wskaźnik na korzeń drzewa, po usunięciu ostatniego
+ *                        numeru staje się NULL.
+ * @param[in] num - wskaźnik na usuwany numer.
+ * @param[in] compare - funkcja porównująca klucz z @p num
+ *                      (@ref compare_packed albo @ref compare_packed_string).
+ * @return Wskaźnik na usunięty, internowany numer albo NULL, jeśli numeru
+ *         nie było w drzewie albo nie udało się zaalokować pamięci.
+*/
+static char *sourcesRemove(PhoneForward *pf, SourceNode **root, char const *num, int (*compare)(char const *, char const *)) {
+    if (sourcesFind(*root, num, compare) == NULL)
+        return NULL;
+    if (!sourcesWritablePath(pf, root, num, compare))
+        return NULL;
+    char *removed;
+    SourceNode *node = *root;
+    source_remove(pf, node, num, compare, &removed);
+    if (node->count == 0 || (node->height > 0 && node->count == 1)) { // the tree shrinks by one level
+        SourceNode *child = node->height > 0 ? node->children[0] : NULL;
+        sourceNodeDiscard(pf, node);
+        node = child;
+    }
+    *root = node;
+    return removed;
+}
+
+/** @brief Usuwa całe B+ drzewo odłączone od struktury.
+ * Numery drzewa należą odtąd do wywołującego.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] node - wskaźnik na korzeń drzewa albo NULL.
+*/
+static void sourceTreeDiscard(PhoneForward *pf, SourceNode *node) {
+    if (node == NULL)
+        return;
+    SourceNode *children[SOURCE_NODE_KEYS];
+    int count = node->height > 0 ? node->count : 0;
+    memcpy(children, node->children, count*sizeof(SourceNode *));
+    sourceNodeDiscard(pf, node); // a shared node first gives its children an extra reference
+    for (int i = 0; i < count; i++)
+        sourceTreeDiscard(pf, children[i]);
+}
+
+/** @brief Buduje B+ drzewo z posortowanych numerów.
+ * Numery są dzielone po równo między liście, a liście między węzły
+ * kolejnych poziomów.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] keys - tablica internowanych numerów w porządku
+ *                   @ref compare_packed, bez powtórzeń.
+ * @param[in] count - liczba numerów.
+ * @param[out] level - pamięć pomocnicza na co najmniej
+ *                     count / SOURCE_NODE_KEYS + 1 wskaźników.
+ * @return Wskaźnik na korzeń drzewa albo NULL, gdy @p count jest zerem lub
+ *         nie udało się zaalokować pamięci.
+*/
+static SourceNode *sourcesBuild(PhoneForward *pf, char * const *keys, size_t count, SourceNode **level) {
+    if (count == 0)
+        return NULL;
+    size_t level_count = (count + SOURCE_NODE_KEYS - 1) / SOURCE_NODE_KEYS;
+    for (size_t i = 0, used = 0; i < level_count; i++) {
+        size_t taken = (count - used) / (level_count - i);
+        SourceNode *leaf = level[i] = sourceNodeNew(pf, 0);
+        if (leaf == NULL) {
+            while (i > 0)
+                free(level[--i]);
+            return NULL;
+        }
+        memcpy(leaf->keys, &keys[used], taken*sizeof(char *));
+        leaf->count = leaf->size = taken;
+        used += taken;
+    }
+    for (unsigned short height = 1; level_count > 1; height++) {
+        size_t parents = (level_count + SOURCE_NODE_KEYS - 1) / SOURCE_NODE_KEYS;
+        for (size_t i = 0, used = 0; i < parents; i++) { // level[i] is written after level[used] is read
+            size_t taken = (level_count - used) / (parents - i);
+            SourceNode *node = sourceNodeNew(pf, height);
+            if (node == NULL) { // level[0..i) holds the built nodes and level[used..level_count) the rest
+                for (size_t j = 0; j < i; j++)
+                    sourceTreeDelete(level[j]);
+                for (size_t j = used; j < level_count; j++)
+                    sourceTreeDelete(level[j]);
+                return NULL;
+            }
+            for (size_t j = 0; j < taken; j++) {
+                node->children[j] = level[used + j];
+                node->keys[j] = level[used + j]->keys[0];
+            }
+            node->count = taken;
+            source_node_resize(node);
+            level[i] = node;
+            used += taken;
+        }
+        level_count = parents;
+    }
+    return level[0];
+}
+
+/** @brief Ustawia pozycję na najmniejszym numerze B+ drzewa.
+ * @param[out] cursor - wskaźnik na pozycję.
+ * @param[in] root - wskaźnik na korzeń drzewa albo NULL.
+*/
+static void sourceCursorFirst(SourceCursor *cursor, SourceNode const *root) {
+    cursor->depth = -1;
+    for (SourceNode const *node = root; node != NULL; node = node->height > 0 ? node->children[0] : NULL) {
+        cursor->depth++;
+        cursor->path[cursor->depth] = node;
+        cursor->index[cursor->depth] = 0;
+    }
+}
+
+/** @brief Zwraca numer na bieżącej pozycji.
+ * @param[in] cursor - wskaźnik na pozycję.
+ * @return Wskaźnik na spakowany numer albo NULL, gdy numery się skończyły.
+*/
+static inline char *sourceCursorGet(SourceCursor const *cursor) {
+    if (cursor->depth < 0)
+        return NULL;
+    return cursor->path[cursor->depth]->keys[cursor->index[cursor->depth]];
+}
+
+/** @brief Przesuwa pozycję na następny numer.
+ * @param[in, out] cursor - wskaźnik na pozycję.
+*/
+static void sourceCursorNext(SourceCursor *cursor) {
+    int depth = cursor->depth;
+    while (depth >= 0 && ++cursor->index[depth] == cursor->path[depth]->count)
+        depth--;
+    if (depth < 0) {
+        cursor->depth = -1;
+        return;
+    }
+    for (depth++; depth <= cursor->depth; depth++) {
+        cursor->path[depth] = cursor->path[depth-1]->children[cursor->index[depth-1]];
+        cursor->index[depth] = 0;
+    }
+}
+
+/** @brief Zeruje numery wersji węzłów poddrzewa RedsToFrom.
+ * Działa jak @ref childSetResetVersions, obejmuje też drzewa przekierowań.
+ * @param[in, out] rtf - wskaźnik na korzeń poddrzewa.
+*/
+static void rtfResetVersions(RedsToFrom *rtf) {
+    rtf->children.version = 0;
+    sourceTreeResetVersions(rtf->redirections);
+    for (int i = 0; i < COUNT_OF_NUMBERS; i++) {
+        RedsToFrom *child = childSetGet(&rtf->children, i);
+        if (child != NULL)
+            rtfResetVersions(child);
+    }
+}
+
+/** @brief Funkcja alokująca strukturę RedsToFrom.
+ * Funkcja wydziela z areny węzeł RedsToFrom. Węzeł jest
+ * zwalniany razem z areną w @ref phfwdDelete.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @return Wskaźnik na nowo utworzoną strukturę.
+*/
+RedsToFrom *rtfNew(PhoneForward *pf) {
+    RedsToFrom *new = arenaAlloc(&pf->store->rtf_arena);
+    if (new == NULL) return NULL;
+    new->redirections = NULL;
+    childSetInit(&new->children);
+    new->children.references = 1;
+    new->children.version = pf->version;
+    return new;
+}
+
+/** @brief Zwalnia dane przechowywane w węźle RedsToFrom.
+ * Funkcja przekazywana do @ref arenaDelete. Zwalnia tylko drzewo
+ * przekierowań, same numery są zwalniane razem z tablicą internowanych
+ * numerów.
+ * @param[in] node - wskaźnik na węzeł RedsToFrom.
+ */
+static void rtfRelease(void *node) {
+    sourceTreeDelete(((RedsToFrom *)node)->redirections);
+}
+
+/** @brief Sprawdza, czy węzeł może być czytany przez czytelników lub klony.
+ * W trybie współbieżnych czytelników węzeł utworzony przed bieżącą
+ * operacją zapisu jest osiągalny z opublikowanego korzenia i nie wolno go
+ * modyfikować. Tak samo węzeł, do którego prowadzi więcej niż jedno
+ * odwołanie (zob. @ref phfwdClone).
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] set - wskaźnik na zbiór synów węzła.
+ * @return @p true, jeśli węzeł jest współdzielony.
+*/
+static inline bool nodeShared(PhoneForward *pf, ChildSet const *set) {
+    return set->references > 1 || (pf->epochs != NULL && set->version != pf->version);
+}
+
+/** @brief Dodaje odwołania do zawartości węzła.
+ * Działa jak @ref sourceNodeShare dla węzła RedsFromTo albo RedsToFrom.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] arena - wskaźnik na arenę, z której pochodzi węzeł.
+ * @param[in] node - wskaźnik na węzeł.
+*/
+static void nodeShare(PhoneForward *pf, NodeArena *arena, void *node) {
+    childSetShare(node);
+    if (arena == &pf->store->rtf_arena) {
+        SourceNode *tree = ((RedsToFrom *)node)->redirections;
+        if (tree != NULL)
+            tree->references++;
+    }
+    else
+        internRetain(((RedsFromTo *)node)->redirection);
+}
+
+/** @brief Zwalnia węzeł wraz z jego danymi.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] arena - wskaźnik na arenę, z której pochodzi węzeł.
+ * @param[in] node - wskaźnik na zwalniany węzeł.
+*/
+static void nodeRelease(PhoneForward *pf, NodeArena *arena, void *node) {
+    if (arena == &pf->store->rtf_arena) {
+        RedsToFrom *rtf = node;
+        rtf->redirections = NULL; // the tree now belongs to the copy of the node, or is empty
+        childSetRelease(pf->store->child_arenas, &rtf->children);
+    }
+    else
+        childSetRelease(pf->store->child_arenas, &((RedsFromTo *)node)->children);
+    arenaFree(arena, node);
+}
+
+/** @brief Usuwa węzeł odłączony od struktury.
+ * Zawartość węzła należy odtąd do wywołującego. Węzeł współdzielony
+ * z klonem zostaje i traci jedno odwołanie, węzeł współdzielony
+ * z czytelnikami jest odkładany do późniejszego zwolnienia, pozostałe są
+ * zwalniane od razu.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] arena - wskaźnik na arenę, z której pochodzi węzeł.
+ * @param[in] node - wskaźnik na usuwany węzeł.
+ * @param[in] set - wskaźnik na zbiór synów węzła.
+*/
+static void nodeDiscard(PhoneForward *pf, NodeArena *arena, void *node, ChildSet *set) {
+    if (set->references > 1) {
+        nodeShare(pf, arena, node);
+        set->references--;
+    }
+    else if (nodeShared(pf, set))
+        epochRetire(pf->epochs, node, arena);
+    else
+        nodeRelease(pf, arena, node);
+}
+
+/** @brief Zwalnia odłożone obiekty.
+ * Zwalnia obiekty odłączone w epokach wcześniejszych niż epoka
+ * ogłoszona przez każdego aktywnego czytelnika.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] all - czy zwolnić wszystkie obiekty (gdy nie ma czytelników).
+*/
+static void epochReclaim(PhoneForward *pf, bool all) {
+    Epochs *epochs = pf->epochs;
+    unsigned long oldest = ULONG_MAX;
+    for (int i = 0; i < READER_SLOTS && !all; i++) {
+        unsigned long epoch = atomic_load(&epochs->readers[i].epoch);
+        if (epoch != 0 && epoch < oldest)
+            oldest = epoch;
+    }
+    size_t count = 0;
+    while (count < epochs->retired_count && (all || epochs->retired[count].epoch < oldest)) {
+        Retired *entry = &epochs->retired[count++];
+        if (entry->arena == NULL)
+            free(entry->object);
+        else
+            nodeRelease(pf, entry->arena, entry->object);
+    }
+    if (count > 0) {
+        epochs->retired_count -= count;
+        memmove(epochs->retired, &epochs->retired[count], epochs->retired_count*sizeof(Retired));
+    }
+}
+
+/** @brief Zwraca węzeł RedsFromTo, który można modyfikować.
+ * Węzeł współdzielony jest kopiowany, a oryginał usuwany
+ * (zob. @ref nodeDiscard). Wywołujący musi podpiąć kopię w miejsce
+ * oryginału.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] rft - wskaźnik na węzeł.
+ * @return Wskaźnik na @p rft albo na jego kopię lub NULL, gdy nie udało się
+ *         zaalokować pamięci; wtedy @p rft pozostaje niezmieniony.
+*/
+static RedsFromTo *rftWritable(PhoneForward *pf, RedsFromTo *rft) {
+    if (!nodeShared(pf, &rft->children))
+        return rft;
+    RedsFromTo *copy = arenaAlloc(&pf->store->rft_arena);
+    if (copy == NULL)
+        return NULL;
+    *copy = *rft;
+    if (!childSetCopy(pf->store->child_arenas, &copy->children)) {
+        arenaFree(&pf->store->rft_arena, copy);
+        return NULL;
+    }
+    copy->children.version = pf->version;
+    copy->children.references = 1;
+    nodeDiscard(pf, &pf->store->rft_arena, rft, &rft->children);
+    return copy;
+}
+
+/** @brief Zwraca węzeł RedsToFrom, który można modyfikować.
+ * Działa jak @ref rftWritable. Kopia przejmuje drzewo przekierowań,
+ * którego węzły są kopiowane dopiero przy jego zmianie.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] rtf - wskaźnik na węzeł.
+ * @return Wskaźnik na @p rtf albo na jego kopię lub NULL, gdy nie udało się
+ *         zaalokować pamięci; wtedy @p rtf pozostaje niezmieniony.
+*/
+static RedsToFrom *rtfWritable(PhoneForward *pf, RedsToFrom *rtf) {
+    if (!nodeShared(pf, &rtf->children))
+        return rtf;
+    RedsToFrom *copy = arenaAlloc(&pf->store->rtf_arena);
+    if (copy == NULL)
+        return NULL;
+    *copy = *rtf;
+    if (!childSetCopy(pf->store->child_arenas, &copy->children)) {
+        arenaFree(&pf->store->rtf_arena, copy);
+        return NULL;
+    }
+    copy->children.version = pf->version;
+    copy->children.references = 1;
+    nodeDiscard(pf, &pf->store->rtf_arena, rtf, &rtf->children);
+    return copy;
+}
+
+/** @brief Usuwa obiekt indeksu najkrótszych numerów "do".
+ * Obiekt współdzielony z klonem zostaje i traci jedno odwołanie, obiekt
+ * współdzielony z czytelnikami jest odkładany do późniejszego zwolnienia,
+ * pozostałe są zwalniane od razu.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] object - wskaźnik na obiekt.
+*/
+static void targetsDiscard(PhoneForward *pf, void *object) {
+    unsigned *header = object; // objects of the index start with their version and references
+    if (header[1] > 1)
+        header[1]--;
+    else if (pf->epochs != NULL && header[0] != pf->version)
+        epochRetire(pf->epochs, object, NULL);
+    else
+        free(object);
+}
+
+/** @brief Tworzy pusty indeks najkrótszych numerów "do".
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @return Wskaźnik na indeks albo NULL, gdy nie udało się zaalokować pamięci.
+*/
+static TargetIndex *targetsNew(PhoneForward *pf) {
+    TargetIndex *index = calloc(1, sizeof(TargetIndex));
+    if (index != NULL) {
+        index->version = pf->version;
+        index->references = 1;
+    }
+    return index;
+}
+
+/** @brief Zwraca kopię obiektu indeksu, którą można modyfikować.
+ * Obiekt współdzielony z czytelnikami albo z klonem jest kopiowany,
+ * a oryginał usuwany (zob. @ref targetsDiscard). Obiekty indeksu
+ * zaczynają się od numeru wersji i liczby odwołań.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] object - wskaźnik na obiekt.
+ * @param[in] size - rozmiar obiektu w bajtach.
+ * @param[in] children - wskaźnik na tablicę obiektów, do których odwołuje
+ *                       się @p object.
+ * @param[in] count - długość tablicy @p children.
+ * @return Wskaźnik na @p object albo na jego kopię, NULL, gdy nie udało się
+ *         zaalokować pamięci.
+*/
+static void *targetsWritable(PhoneForward *pf, void *object, size_t size, void * const *children, int count) {
+    unsigned *header = object;
+    if (header[1] == 1 && (pf->epochs == NULL || header[0] == pf->version))
+        return object;
+    unsigned *copy = malloc(size);
+    if (copy == NULL) return NULL;
+    memcpy(copy, object, size);
+    copy[0] = pf->version;
+    copy[1] = 1;
+    for (int i = 0; i < count && header[1] > 1; i++) // the original stays with the clone, both refer to the children
+        if (children[i] != NULL)
+            ((unsigned *)children[i])[1]++;
+    targetsDiscard(pf, object);
+    return copy;
+}
+
+/** @brief Usuwa indeks najkrótszych numerów "do".
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] index - wskaźnik na indeks albo NULL.
+*/
+static void targetsDelete(PhoneForward *pf, TargetIndex *index) {
+    if (index == NULL)
+        return;
+    for (int i = 0; i < TARGET_MASKS / TARGET_PAGE_LENGTH && index->references == 1; i++) {
+        TargetPage *page = index->pages[i];
+        if (page == NULL)
+            continue;
+        for (int j = 0; j < TARGET_PAGE_LENGTH && page->references == 1; j++)
+            if (page->masks[j] != NULL)
+                targetsDiscard(pf, page->masks[j]);
+        targetsDiscard(pf, page);
+    }
+    targetsDiscard(pf, index);
+}
+
+/** @brief Zeruje numery wersji obiektów indeksu.
+ * @param[in, out] index - wskaźnik na indeks albo NULL.
+*/
+static void targetsResetVersions(TargetIndex *index) {
+    if (index == NULL)
+        return;
+    index->version = 0;
+    for (int i = 0; i < TARGET_MASKS / TARGET_PAGE_LENGTH; i++)
+        if (index->pages[i] != NULL) {
+            index->pages[i]->version = 0;
+            for (int j = 0; j < TARGET_PAGE_LENGTH; j++)
+                if (index->pages[i]->masks[j] != NULL)
+                    index->pages[i]->masks[j]->version = 0;
+        }
+}
+
+/** @brief Zmienia liczbę najkrótszych numerów "do" w indeksie.
+ * Gdy zabraknie pamięci, usuwa indeks, a @ref phfwdNonTrivialCount
+ * przegląda wtedy strukturę RedsToFrom.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] mask - zbiór cyfr numeru.
+ * @param[in] depth - długość numeru.
+ * @param[in] add - czy numer przybywa, czy ubywa.
+*/
+static void targetsUpdate(PhoneForward *pf, unsigned mask, size_t depth, bool add) {
+    if (pf->targets == NULL)
+        return;
+    TargetIndex *index = targetsWritable(pf, pf->targets, sizeof(TargetIndex), (void * const *)pf->targets->pages, TARGET_MASKS / TARGET_PAGE_LENGTH);
+    TargetPage *page = NULL;
+    if (index != NULL) {
+        pf->targets = index;
+        page = index->pages[mask / TARGET_PAGE_LENGTH];
+        page = page != NULL ? targetsWritable(pf, page, sizeof(TargetPage), (void * const *)page->masks, TARGET_PAGE_LENGTH) : calloc(1, sizeof(TargetPage));
+    }
+    if (page == NULL) {
+        targetsDelete(pf, pf->targets);
+        pf->targets = NULL;
+        return;
+    }
+    page->version = pf->version;
+    page->references = 1;
+    index->pages[mask / TARGET_PAGE_LENGTH] = page;
+    TargetDepths *depths = page->masks[mask % TARGET_PAGE_LENGTH];
+    if (depths == NULL || depth >= depths->length || depths->references > 1 || (pf->epochs != NULL && depths->version != pf->version)) {
+        size_t length = depths != NULL ? depths->length : 0;
+        size_t new_length = depth < length ? length : (depth < 2*length ? 2*length : depth + 1);
+        TargetDepths *copy = malloc(sizeof(TargetDepths) + new_length*sizeof(size_t));
+        if (copy == NULL) {
+            targetsDelete(pf, pf->targets);
+            pf->targets = NULL;
+            return;
+        }
+        copy->version = pf->version;
+        copy->references = 1;
+        copy->length = new_length;
+        copy->total = depths != NULL ? depths->total : 0;
+        if (length > 0)
+            memcpy(copy->counts, depths->counts, length*sizeof(size_t));
+        memset(&copy->counts[length], 0, (new_length - length)*sizeof(size_t));
+        if (depths != NULL)
+            targetsDiscard(pf, depths);
+        page->masks[mask % TARGET_PAGE_LENGTH] = depths = copy;
+    }
+    if (add) {
+        depths->counts[depth]++;
+        depths->total++;
+    }
+    else {
+        depths->counts[depth]--;
+        if (--depths->total == 0) {
+            targetsDiscard(pf, depths);
+            page->masks[mask % TARGET_PAGE_LENGTH] = NULL;
+        }
+    }
+}
+
+/** @brief Zmienia w indeksie liczby numerów "do" najkrótszych w poddrzewie.
+ * Uwzględnia numery "do" z poddrzewa węzła RedsToFrom, których żaden
+ * prefiks w poddrzewie nie jest numerem "do".
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] rtf - wskaźnik na korzeń poddrzewa.
+ * @param[in] mask - zbiór cyfr numeru korzenia.
+ * @param[in] depth - długość numeru korzenia.
+ * @param[in] add - czy numery przybywają, czy ubywają.
+*/
+static void targetsBelow(PhoneForward *pf, RedsToFrom const *rtf, unsigned mask, size_t depth, bool add) {
+    for (int i = 0; i < COUNT_OF_NUMBERS && pf->targets != NULL; i++) {
+        RedsToFrom const *child = childSetGet(&rtf->children, i);
+        if (child == NULL)
+            continue;
+        if (child->redirections != NULL)
+            targetsUpdate(pf, mask | 1u << i, depth + 1, add);
+        else
+            targetsBelow(pf, child, mask | 1u << i, depth + 1, add);
+    }
+}
+
+/** @brief Uaktualnia indeks, gdy pojawia się albo znika numer "do".
+ * Wywoływana tylko dla numeru, którego żaden prefiks nie jest numerem "do".
+ * Najkrótsze numery "do" z jego poddrzewa przestają albo zaczynają być
+ * najkrótsze.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] rtf - wskaźnik na węzeł numeru.
+ * @param[in] mask - zbiór cyfr numeru.
+ * @param[in] depth - długość numeru.
+ * @param[in] add - czy numer pojawia się, czy znika.
+*/
+static void targetsChanged(PhoneForward *pf, RedsToFrom const *rtf, unsigned mask, size_t depth, bool add) {
+    targetsUpdate(pf, mask, depth, add);
+    targetsBelow(pf, rtf, mask, depth, !add);
+}
+
+/** @brief Uaktualnia indeks, gdy numer przestaje albo zaczyna być numerem "do".
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] num - wskaźnik na spakowany numer.
+ * @param[in] rtf - wskaźnik na węzeł numeru, już bez przekierowań albo
+ *                  z pierwszymi przekierowaniami.
+ * @param[in] add - czy numer zaczyna być numerem "do".
+*/
+static void targetsToggled(PhoneForward *pf, char const *num, RedsToFrom const *rtf, bool add) {
+    if (pf->targets == NULL)
+        return;
+    unsigned char const *digits;
+    size_t length = packed_length(num, &digits);
+    unsigned mask = 0;
+    RedsToFrom const *node = pf->reds_to_from;
+    for (size_t i = 0; i < length; i++) {
+        if (node->redirections != NULL) // a shorter number hides this one
+            return;
+        int digit = get_digit(digits, i);
+        mask |= 1u << digit;
+        node = childSetGet(&node->children, digit);
+    }
+    targetsChanged(pf, rtf, mask, length, add);
+}
+
+/** @brief Rozpoczyna operację zapisu.
+ * W trybie współbieżnych czytelników wszystkie istniejące węzły stają się
+ * współdzielone. Po przepełnieniu licznika operacji zeruje numery wersji
+ * wszystkich węzłów.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+*/
+static void writerBegin(PhoneForward *pf) {
+    if (pf->epochs != NULL && ++pf->version == 0) {
+        childSetResetVersions(&pf->reds_from_to->children);
+        rtfResetVersions(pf->reds_to_from);
+        targetsResetVersions(pf->targets);
+        pf->version = 1;
+    }
+}
+
+/** @brief Kończy operację zapisu.
+ * Publikuje nowe korzenie, rozpoczyna kolejną epokę i zwalnia obiekty,
+ * których nikt już nie czyta.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+*/
+static void writerEnd(PhoneForward *pf) {
+    atomic_store(&pf->rft_published, pf->reds_from_to);
+    atomic_store(&pf->rtf_published, pf->reds_to_from);
+    atomic_store(&pf->targets_published, pf->targets);
+    if (pf->epochs != NULL) {
+        atomic_fetch_add(&pf->epochs->epoch, 1);
+        if (pf->epochs->retired_count > 0)
+            epochReclaim(pf, false);
+    }
+}
+
+/** @brief Usuwa zamrożoną postać.
+ * Postać odczytaną z pliku zostawia w odwzorowaniu, które jest usuwane
+ * w @ref phfwdDelete. W trybie współbieżnych czytelników odkłada postać
+ * do późniejszego zwolnienia.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] image - wskaźnik na zamrożoną postać albo NULL.
+*/
+static void frozenDelete(PhoneForward *pf, Frozen *image) {
+    char *address = (char *)image;
+    char *mapping = pf->mapping;
+    if (image == NULL || (mapping != NULL && address >= mapping && address < mapping + pf->mapping_length))
+        return;
+    if (pf->epochs != NULL)
+        epochRetire(pf->epochs, image, NULL);
+    else
+        free(image);
+}
+
+bool phfwdEnableConcurrency(PhoneForward *pf) {
+    if (pf == NULL)
+        return false;
+    if (pf->epochs != NULL)
+        return true;
+    if (pf->store->members > 1) // clones do not take part in reclamation
+        return false;
+    Epochs *epochs = aligned_alloc(_Alignof(Epochs), sizeof(Epochs));
+    if (epochs == NULL)
+        return false;
+    for (int i = 0; i < READER_SLOTS; i++)
+        atomic_init(&epochs->readers[i].epoch, 0);
+    atomic_init(&epochs->epoch, 1);
+    epochs->retired = NULL;
+    epochs->retired_count = 0;
+    epochs->retired_max = 0;
+    pf->epochs = epochs;
+    pf->store->numbers.epochs = epochs;
+    return true;
+}
+
+PhoneForward *phfwdNew() {
+	PhoneForward *new = malloc(sizeof(PhoneForward));
+	if (new == NULL) return NULL;
+    new->store = malloc(sizeof(NodeStore));
+    if (new->store == NULL) {
+        free(new);
+        return NULL;
+    }
+    arenaInit(&new->store->rft_arena, sizeof(RedsFromTo));
+    arenaInit(&new->store->rtf_arena, sizeof(RedsToFrom));
+    for (int i = 0; i < CHILD_ARRAY_CLASSES; i++)
+        arenaInit(&new->store->child_arenas[i], (i+1)*CHILD_ARRAY_STEP*sizeof(void*));
+    internInit(&new->store->numbers);
+    new->store->members = 1;
+    new->version = 0;
+    new->epochs = NULL;
+    new->reds_from_to = rftNew(new);
+    new->reds_to_from = rtfNew(new);
+    new->targets = targetsNew(new);
+    atomic_init(&new->rft_published, new->reds_from_to);
+    atomic_init(&new->rtf_published, new->reds_to_from);
+    atomic_init(&new->targets_published, new->targets);
+    atomic_init(&new->frozen, NULL);
+    new->mapping = NULL;
+    new->mapping_length = 0;
+    new->transaction = false;
+    new->staged = NULL;
+    new->staged_count = 0;
+    new->staged_max = 0;
+    if (new->reds_from_to == NULL || new->reds_to_from == NULL) {
+        phfwdDelete(new);
+        return NULL;
+    }
+    return new;  
+}
+
+void phnumDelete(PhoneNumbers const *pnum) {
+    if (pnum != NULL) {
+        for (size_t i = 0; i < pnum->current_length; i++) 
+            free(pnum->array_of_numbers[i]);
+        free(pnum->array_of_numbers);
+        free((void*)pnum);
+    }
+}
+
+/** @brief Usuwa odwołanie do B+ drzewa przekierowań "od".
+ * Węzły, do których nie prowadzi już żadne odwołanie, są zwalniane razem
+ * z odwołaniami do numerów.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] node - wskaźnik na korzeń drzewa albo NULL.
+*/
+static void sourceTreeDrop(PhoneForward *pf, SourceNode *node) {
+    if (node == NULL)
+        return;
+    if (node->references > 1) {
+        node->references--;
+        return;
+    }
+    for (int i = 0; i < node->count; i++) {
+        if (node->height > 0)
+            sourceTreeDrop(pf, node->children[i]);
+        else
+            internRelease(&pf->store->numbers, node->keys[i]);
+    }
+    free(node);
+}
+
+/** @brief Usuwa odwołanie do poddrzewa RedsFromTo.
+ * Działa jak @ref sourceTreeDrop.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] rft - wskaźnik na korzeń poddrzewa.
+*/
+static void rftDrop(PhoneForward *pf, RedsFromTo *rft) {
+    if (rft->children.references > 1) {
+        rft->children.references--;
+        return;
+    }
+    internRelease(&pf->store->numbers, rft->redirection);
+    for (int i = 0; i < COUNT_OF_NUMBERS; i++) {
+        RedsFromTo *child = childSetGet(&rft->children, i);
+        if (child != NULL)
+            rftDrop(pf, child);
+    }
+    nodeRelease(pf, &pf->store->rft_arena, rft);
+}
+
+/** @brief Usuwa odwołanie do poddrzewa RedsToFrom.
+ * Działa jak @ref sourceTreeDrop.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] rtf - wskaźnik na korzeń poddrzewa.
+*/
+static void rtfDrop(PhoneForward *pf, RedsToFrom *rtf) {
+    if (rtf->children.references > 1) {
+        rtf->children.references--;
+        return;
+    }
+    sourceTreeDrop(pf, rtf->redirections);
+    for (int i = 0; i < COUNT_OF_NUMBERS; i++) {
+        RedsToFrom *child = childSetGet(&rtf->children, i);
+        if (child != NULL)
+            rtfDrop(pf, child);
+    }
+    nodeRelease(pf, &pf->store->rtf_arena, rtf);
+}
+
+/** @brief Porzuca operacje transakcji.
+ * Zwalnia zapamiętane operacje i kończy transakcję.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+*/
+static void stagedClear(PhoneForward *pf) {
+    for (size_t i = 0; i < pf->staged_count; i++)
+        free(pf->staged[i].num1);
+    free(pf->staged);
+    pf->staged = NULL;
+    pf->staged_count = 0;
+    pf->staged_max = 0;
+    pf->transaction = false;
+}
+
+void phfwdDelete(PhoneForward *pf) {
+    if (pf != NULL) {
+        stagedClear(pf);
+        frozenDelete(pf, atomic_load(&pf->frozen));
+        targetsDelete(pf, pf->targets);
+        if (pf->epochs != NULL) {
+            epochReclaim(pf, true);
+            free(pf->epochs->retired);
+            free(pf->epochs);
+        }
+        if (pf->mapping != NULL)
+            munmap(pf->mapping, pf->mapping_length);
+        if (--pf->store->members > 0) { // clones still use the store, only nodes of this base are freed
+            if (pf->reds_from_to != NULL)
+                rftDrop(pf, pf->reds_from_to);
+            if (pf->reds_to_from != NULL)
+                rtfDrop(pf, pf->reds_to_from);
+            free(pf);
+            return;
+        }
+        arenaDelete(&pf->store->rft_arena, NULL);
+        arenaDelete(&pf->store->rtf_arena, rtfRelease);
+        for (int i = 0; i < CHILD_ARRAY_CLASSES; i++)
+            arenaDelete(&pf->store->child_arenas[i], NULL);
+        internDelete(&pf->store->numbers);
+        free(pf->store);
+        free(pf);
+    }
+}
+
+
+
+/**
+ * Funkcja sprawdzająca czy napis jest numerem.
+ * @param[in] num - wskaźnik na napis.
+ * @return @p true jeśli napis jest numerem,
+           @p false w przeciwnym razie.
+*/
+bool is_string_a_number(const char *num) {
+    if (num == NULL) return false;
+    int length = strlen(num);
+    if (length == 0) return false;
+    for(int i = 0; i < length; i++) 
+        if (!is_number(num[i])) return false;
+    return true;
+}
+
+/** @brief Zwraca syna węzła RedsToFrom, którego można modyfikować.
+ * Kopiuje syna współdzielonego albo tworzy brakującego i podpina go
+ * pod @p rtf.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in, out] rtf - wskaźnik na ojca, którego można modyfikować.
+ * @param[in] index - cyfra syna.
+ * @return Wskaźnik na syna albo NULL, gdy nie udało się zaalokować pamięci;
+ *         wtedy @p rtf pozostaje niezmieniony.
+*/
+static RedsToFrom *rtfWritableChild(PhoneForward *pf, RedsToFrom *rtf, int index) {
+    RedsToFrom *child = childSetGet(&rtf->children, index);
+    if (child != NULL) { // replacing a child never allocates
+        child = rtfWritable(pf, child);
+        if (child != NULL)
+            childSetPut(pf->store->child_arenas, &rtf->children, index, child);
+        return child;
+    }
+    child = rtfNew(pf);
+    if (child != NULL && !childSetPut(pf->store->child_arenas, &rtf->children, index, child)) {
+        arenaFree(&pf->store->rtf_arena, child);
+        return NULL;
+    }
+    return child;
+}
+
+/** @brief Zwraca węzeł RedsToFrom numeru, który można modyfikować.
+ * Kopiuje węzły współdzielone z czytelnikami na całej ścieżce i tworzy
+ * brakujące węzły.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] num - wskaźnik na spakowany numer.
+ * @param[out] path - tablica na węzły ścieżki od korzenia do węzła numeru
+ *                    (o długości numeru powiększonej o jeden) albo NULL.
+ * @return Wskaźnik na węzeł numeru @p num albo NULL, gdy nie udało się
+ *         zaalokować pamięci. Skopiowane i utworzone dotąd węzły zostają
+ *         w strukturze.
+*/
+static RedsToFrom *rtfWritablePath(PhoneForward *pf, char const *num, RedsToFrom **path) {
+    RedsToFrom *rtf = rtfWritable(pf, pf->reds_to_from);
+    if (rtf == NULL)
+        return NULL;
+    pf->reds_to_from = rtf;
+    unsigned char const *digits;
+    size_t length = packed_length(num, &digits);
+    for (size_t i = 0; i < length; i++) {
+        if (path != NULL)
+            path[i] = rtf;
+        int index = get_digit(digits, i);
+        RedsToFrom *child = rtfWritableChild(pf, rtf, index);
+        if (child == NULL)
+            return NULL;
+        rtf = child;
+    }
+    if (path != NULL)
+        path[length] = rtf;
+    return rtf;
+}
+
+/** @brief Usuwa puste węzły z końca ścieżki RedsToFrom.
+ * Idąc od węzła numeru w górę, odłącza od ojca i zwalnia węzły bez
+ * przekierowań i bez synów. Korzeń nie jest usuwany.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] path - węzły ścieżki od korzenia do węzła numeru, które można
+ *                   modyfikować (zob. @ref rtfWritablePath).
+ * @param[in] digits - wskaźnik na cyfry spakowanego numeru.
+ * @param[in] length - długość numeru.
+ * @param[in] kept - liczba początkowych cyfr numeru, których węzły zostają.
+*/
+static void rtfPrune(PhoneForward *pf, RedsToFrom **path, unsigned char const *digits, size_t length, size_t kept) {
+    while (length > kept && path[length]->redirections == NULL && childSetCount(&path[length]->children) == 0) {
+        childSetPut(pf->store->child_arenas, &path[length-1]->children, get_digit(digits, length-1), NULL);
+        nodeDiscard(pf, &pf->store->rtf_arena, path[length], &path[length]->children);
+        length--;
+    }
+}
+
+/** @brief Przygotowuje usunięcie przekierowania ze struktury RedsToFrom.
+ * Kopiuje węzły, które zmieni @ref removeFromRTF, więc potem usunięcie
+ * nie może się nie udać z braku pamięci.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] num - wskaźnik na spakowane przekierowanie "do".
+ * @param[in] num2 - wskaźnik na przekierowanie "od".
+ * @return Wartość @p false, jeśli nie udało się zaalokować pamięci.
+*/
+static bool prepareRemoveFromRTF(PhoneForward *pf, char const *num, char const *num2) {
+    RedsToFrom *rtf = rtfWritablePath(pf, num, NULL);
+    return rtf != NULL && sourcesWritablePath(pf, &rtf->redirections, num2, compare_packed_string);
+}
+
+/** @brief Funkcja usuwająca przekierowanie ze struktury RedsToFrom.
+ * Funkcja usuwa przekierowanie na numer @p num z numeru @p num2
+ * i usuwa węzły, które stały się puste.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] num - wskaźnik na spakowane przekierowanie "do".
+ * @parm[in] num2 - wskaźnik na przekierowanie "od".
+*/
+void removeFromRTF(PhoneForward *pf, char const *num, char const *num2) {
+    RedsToFrom *buffer[PATH_BUFFER_LENGTH];
+    unsigned char const *digits;
+    size_t length = packed_length(num, &digits);
+    RedsToFrom **path = length < PATH_BUFFER_LENGTH ? buffer : malloc((length + 1)*sizeof(RedsToFrom *));
+    RedsToFrom *rtf = rtfWritablePath(pf, num, path);
+    if (rtf == NULL) {
+        if (path != buffer)
+            free(path);
+        return;
+    }
+    char *removed = sourcesRemove(pf, &rtf->redirections, num2, compare_packed_string);
+    if (removed != NULL)
+        internRelease(&pf->store->numbers, removed);
+    if (removed != NULL && rtf->redirections == NULL)
+        targetsToggled(pf, num, rtf, false);
+    if (path != NULL) // without memory for the path, empty nodes stay until phfwdCompact
+        rtfPrune(pf, path, digits, length, 0);
+    if (path != buffer)
+        free(path);
+}
+
+/** @brief Oblicza długość wspólnego prefiksu etykiety i numeru.
+ * @param[in] rft - wskaźnik na węzeł, którego etykietę porównujemy.
+ * @param[in] num - wskaźnik na porównywany fragment numeru.
+ * @param[in] length - długość fragmentu @p num.
+ * @return Liczba początkowych cyfr etykiety zgodnych z @p num.
+*/
+static int common_label_length(RedsFromTo *rft, char const *num, int length) {
+    int i = 0;
+    while (i < rft->label_length && i < length && get_digit(rft->label, i) == CHAR_TO_NUMBER(num[i]))
+        i++;
+    return i;
+}
+
+/** @brief Dzieli krawędź prowadzącą do węzła.
+ * Tworzy nowy węzeł z pierwszymi @p length cyframi etykiety węzła @p child
+ * i podwiesza pod nim @p child z pozostałą częścią etykiety.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] child - wskaźnik na węzeł, którego krawędź dzielimy.
+ * @param[in] length - długość etykiety nowego węzła, mniejsza niż
+ *                     długość etykiety @p child.
+ * @return Wskaźnik na nowy węzeł, który zastępuje @p child u ojca, albo
+ *         NULL, gdy nie udało się zaalokować pamięci.
+*/
+static RedsFromTo *rftSplit(PhoneForward *pf, RedsFromTo *child, int length) {
+    RedsFromTo *new = rftNew(pf);
+    if (new == NULL)
+        return NULL;
+    memcpy(new->label, child->label, (length+1)/2);
+    new->label_length = length;
+    child->label_length -= length;
+    for (int i = 0; i < child->label_length; i++)
+        set_digit(child->label, i, get_digit(child->label, i + length));
+    childSetPut(pf->store->child_arenas, &new->children, get_digit(child->label, 0), child);
+    return new;
+}
+
+/** @brief Funkcja dodająca przekierowanie do struktury RedsFromTo.
+ * Funkcja dodaje przekierowanie z numeru @p from na numer @p to
+ * do struktury RedsFromTo.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] from - wskaźnik na napis reprezentujący numer z którego jest
+ *                   przekierowanie.
+ * @param[in] to - wskaźnik na napis reprezentujący numer na który jest
+                   przekierowanie.
+ * @param[in] length1 - długość numeru @p from.
+ * @param[in] length2 - długość numeru @p to.
+ * @param[out] replaced - wskaźnik na miejsce, w którym funkcja zapisuje
+ *                        zastąpione przekierowanie (razem z odwołaniem
+ *                        do niego) albo NULL; wtedy zastąpione
+ *                        przekierowanie jest od razu usuwane ze struktury
+ *                        RedsToFrom.
+ * @return Wskaźnik na węzeł numeru @p from albo NULL, gdy nie udało się
+ *         zaalokować pamięci; wtedy przekierowania się nie zmieniają, choć
+ *         w strukturze mogą zostać węzły bez przekierowań.
+*/
+RedsFromTo *addToRFT(PhoneForward *pf, char const *from, char const *to, int length1, int length2, char **replaced) {
+// length1 is length of num1 and length2 is length of num2
+    char *redirection = internGet(&pf->store->numbers, to, length2);
+    RedsFromTo *rft = redirection != NULL ? rftWritable(pf, pf->reds_from_to) : NULL;
+    if (rft != NULL)
+        pf->reds_from_to = rft;
+    int index;
+    int i = 0;
+    while (i < length1 && rft != NULL) {
+        index = CHAR_TO_NUMBER(from[i]);
+        RedsFromTo *child = childSetGet(&rft->children, index);
+        if (child != NULL) {
+            child = rftWritable(pf, child);
+            if (child != NULL) // replacing a child never allocates
+                childSetPut(pf->store->child_arenas, &rft->children, index, child);
+        }
+        else if ((child = rftNew(pf)) != NULL) { // new leaf takes as many digits as fit in its label
+            child->label_length = length1 - i < LABEL_LENGTH ? length1 - i : LABEL_LENGTH;
+            for (int j = 0; j < child->label_length; j++)
+                set_digit(child->label, j, CHAR_TO_NUMBER(from[i+j]));
+            if (!childSetPut(pf->store->child_arenas, &rft->children, index, child)) {
+                arenaFree(&pf->store->rft_arena, child);
+                child = NULL;
+            }
+        }
+        if (child == NULL) {
+            rft = NULL;
+            break;
+        }
+        int common = common_label_length(child, &from[i], length1 - i);
+        if (common < child->label_length) {
+            child = rftSplit(pf, child, common);
+            if (child != NULL)
+                childSetPut(pf->store->child_arenas, &rft->children, index, child);
+        }
+        i += common;
+        rft = child;
+    }
+    if (rft == NULL) {
+        if (redirection != NULL)
+            internRelease(&pf->store->numbers, redirection);
+        return NULL;
+    }
+    if (replaced != NULL)
+        *replaced = rft->redirection;
+    else if (rft->redirection != NULL) {
+        removeFromRTF(pf, rft->redirection, from);
+        internRelease(&pf->store->numbers, rft->redirection);
+    }
+    rft->redirection = redirection;
+    return rft;
+}
+
+
+/** @brief Funkcja dodająca przekierowanie do struktury RedsToFrom.
+ * Funkcja dodaje przekierowanie z numeru @p from na numer @p to
+ * do struktury RedsToFrom.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] from - wskaźnik na napis reprezentujący numer z którego jest
+ *                   przekierowanie.
+ * @param[in] to - wskaźnik na napis reprezentujący numer na który jest
+                   przekierowanie.
+ * @param[in] length1 - długość numeru @p from.
+ * @param[in] length2 - długość numeru @p to.
+ * @return Wartość @p false, jeśli nie udało się zaalokować pamięci; wtedy
+ *         przekierowanie nie zostało dodane.
+*/
+bool addToRTF(PhoneForward *pf, char const *from, char const *to, int length1, int length2) {
+    char *number = internGet(&pf->store->numbers, from, length1);
+    RedsToFrom *rtf = number != NULL ? rtfWritable(pf, pf->reds_to_from) : NULL;
+    if (rtf != NULL)
+        pf->reds_to_from = rtf;
+    int index;
+    unsigned mask = 0;
+    bool hidden = false; // whether a prefix of "to" is already a target
+    for (int i = 0; i < length2 && rtf != NULL; i++) {
+        index = CHAR_TO_NUMBER(to[i]);
+        hidden = hidden || rtf->redirections != NULL;
+        mask |= 1u << index;
+        rtf = rtfWritableChild(pf, rtf, index);
+    }
+    if (rtf == NULL) {
+        if (number != NULL)
+            internRelease(&pf->store->numbers, number);
+        return false;
+    }
+    bool first = rtf->redirections == NULL;
+    if (sourcesInsert(pf, &rtf->redirections, number)) {
+        if (first && !hidden)
+            targetsChanged(pf, rtf, mask, length2, true);
+        return true;
+    }
+    bool present = sourcesFind(rtf->redirections, number, compare_packed) != NULL; // otherwise memory ran out
+    internRelease(&pf->store->numbers, number);
+    return present;
+}
+
+/** @brief Zwraca tablicę węzłów RedsFromTo zamrożonej postaci.
+ * @param[in] image - wskaźnik na zamrożoną postać.
+ * @return Wskaźnik na węzeł o indeksie 0.
+*/
+static inline FrozenRft const *frozenRft(Frozen const *image) {
+    return (FrozenRft const *)((char const *)image + image->rft_offset);
+}
+
+/** @brief Zwraca tablicę węzłów RedsToFrom zamrożonej postaci.
+ * @param[in] image - wskaźnik na zamrożoną postać.
+ * @return Wskaźnik na węzeł o indeksie 0.
+*/
+static inline FrozenRtf const *frozenRtf(Frozen const *image) {
+    return (FrozenRtf const *)((char const *)image + image->rtf_offset);
+}
+
+/** @brief Zwraca tablicę przekierowań "od" zamrożonej postaci.
+ * @param[in] image - wskaźnik na zamrożoną postać.
+ * @return Wskaźnik na tablicę położeń numerów w puli.
+*/
+static inline uint32_t const *frozenSources(Frozen const *image) {
+    return (uint32_t const *)((char const *)image + image->sources_offset);
+}
+
+/** @brief Zwraca pulę numerów zamrożonej postaci.
+ * @param[in] image - wskaźnik na zamrożoną postać.
+ * @return Wskaźnik na początek puli.
+*/
+static inline char *frozenPool(Frozen const *image) {
+    return (char *)image + image->pool_offset;
+}
+
+/** @brief Zwraca indeks syna węzła zamrożonej postaci.
+ * @param[in] first_child - indeks pierwszego syna węzła.
+ * @param[in] bitmap - maska cyfr, dla których istnieje syn.
+ * @param[in] digit - cyfra od 0 do COUNT_OF_NUMBERS-1.
+ * @return Indeks syna albo NO_OFFSET, jeśli go nie ma.
+*/
+static inline uint32_t frozenChild(uint32_t first_child, unsigned bitmap, int digit) {
+    unsigned bit = 1u << digit;
+    if ((bitmap & bit) == 0)
+        return NO_OFFSET;
+    return first_child + count_bits(bitmap & (bit - 1));
+}
+
+/** @brief Układa węzły trie w kolejności przeszukiwania wszerz.
+ * Oba rodzaje węzłów zaczynają się od zbioru synów, więc funkcja
+ * obsługuje zarówno RedsFromTo, jak i RedsToFrom. Synowie każdego węzła
+ * trafiają do tablicy obok siebie, w kolejności rosnących cyfr.
+ * @param[in] root - wskaźnik na zbiór synów korzenia.
+ * @param[out] count - wskaźnik, pod który zostanie zapisana liczba węzłów.
+ * @return Tablica węzłów, którą trzeba zwolnić funkcją free, albo NULL,
+ *         gdy nie udało się zaalokować pamięci.
+*/
+static ChildSet **breadth_first_order(ChildSet *root, size_t *count) {
+    size_t max_length = BASIC_ARRAY_LENGTH;
+    size_t length = 1;
+    ChildSet **queue = malloc(max_length*sizeof(ChildSet*));
+    if (queue == NULL) return NULL;
+    queue[0] = root;
+    for (size_t head = 0; head < length; head++) {
+        for (int i = 0; i < COUNT_OF_NUMBERS; i++) {
+            ChildSet *child = childSetGet(queue[head], i);
+            if (child == NULL)
+                continue;
+            if (length == max_length) {
+                ChildSet **bigger = realloc(queue, 2*max_length*sizeof(ChildSet*));
+                if (bigger == NULL) {
+                    free(queue);
+                    return NULL;
+                }
+                queue = bigger;
+                max_length *= 2;
+            }
+            queue[length++] = child;
+        }
+    }
+    *count = length;
+    return queue;
+}
+
+/** @brief Zamraża przekierowania.
+ * Przepisuje obie struktury przekierowań do jednego bloku pamięci.
+ * Numery są zapisywane w puli raz, w kolejności z tablicy internowanych
+ * numerów. Na czas budowania ich położenia w puli zastępują zapamiętane
+ * skróty, które na końcu są obliczane ponownie.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] rft_queue - węzły RedsFromTo w kolejności przeszukiwania wszerz.
+ * @param[in] rft_count - liczba węzłów RedsFromTo.
+ * @param[in] rtf_queue - węzły RedsToFrom w kolejności przeszukiwania wszerz.
+ * @param[in] rtf_count - liczba węzłów RedsToFrom.
+ * @return Wskaźnik na zamrożoną postać albo NULL, gdy nie udało się
+ *         zaalokować pamięci lub struktura jest za duża.
+*/
+static Frozen *frozenBuild(PhoneForward *pf, ChildSet **rft_queue, size_t rft_count, ChildSet **rtf_queue, size_t rtf_count) {
+    size_t source_count = 0;
+    size_t pool_size = 0;
+    for (size_t i = 0; i < rtf_count; i++) {
+        SourceNode *redirections = ((RedsToFrom *)rtf_queue[i])->redirections;
+        if (redirections != NULL)
+            source_count += redirections->size;
+    }
+    for (size_t i = 0; i < pf->store->numbers.bucket_count; i++)
+        for (InternedNumber *entry = pf->store->numbers.buckets[i]; entry != NULL; entry = entry->next) {
+            unsigned char const *digits;
+            pool_size += packed_size(packed_length(entry->packed, &digits));
+        }
+    if (rft_count >= NO_OFFSET || rtf_count >= NO_OFFSET || source_count >= NO_OFFSET || pool_size >= NO_OFFSET)
+        return NULL;
+    size_t rft_offset = sizeof(Frozen);
+    size_t rtf_offset = rft_offset + rft_count*sizeof(FrozenRft);
+    size_t sources_offset = rtf_offset + rtf_count*sizeof(FrozenRtf);
+    size_t pool_offset = sources_offset + source_count*sizeof(uint32_t);
+    Frozen *image = calloc(1, pool_offset + pool_size); // padding is saved to snapshots
+    if (image == NULL) return NULL;
+    image->size = pool_offset + pool_size;
+    image->rft_count = rft_count;
+    image->rtf_count = rtf_count;
+    image->source_count = source_count;
+    image->pool_size = pool_size;
+    image->rft_offset = rft_offset;
+    image->rtf_offset = rtf_offset;
+    image->sources_offset = sources_offset;
+    image->pool_offset = pool_offset;
+    char *pool = frozenPool(image);
+    size_t offset = 0;
+    for (size_t i = 0; i < pf->store->numbers.bucket_count; i++)
+        for (InternedNumber *entry = pf->store->numbers.buckets[i]; entry != NULL; entry = entry->next) {
+            unsigned char const *digits;
+            size_t size = packed_size(packed_length(entry->packed, &digits));
+            memcpy(&pool[offset], entry->packed, size);
+            entry->hash = offset;
+            offset += size;
+        }
+    FrozenRft *rft_nodes = (FrozenRft *)frozenRft(image);
+    uint32_t next = 1;
+    for (size_t i = 0; i < rft_count; i++) {
+        RedsFromTo *rft = (RedsFromTo *)rft_queue[i];
+        FrozenRft *node = &rft_nodes[i];
+        node->first_child = next;
+        node->bitmap = rft->children.bitmap;
+        node->label_length = rft->label_length;
+        memcpy(node->label, rft->label, sizeof(node->label));
+        node->redirection = rft->redirection != NULL ? INTERNED(rft->redirection)->hash : NO_OFFSET;
+        next += childSetCount(&rft->children);
+    }
+    FrozenRtf *rtf_nodes = (FrozenRtf *)frozenRtf(image);
+    uint32_t *sources = (uint32_t *)frozenSources(image);
+    uint32_t source = 0;
+    next = 1;
+    for (size_t i = 0; i < rtf_count; i++) {
+        RedsToFrom *rtf = (RedsToFrom *)rtf_queue[i];
+        FrozenRtf *node = &rtf_nodes[i];
+        node->first_child = next;
+        node->bitmap = rtf->children.bitmap;
+        node->first_source = source;
+        node->source_count = 0;
+        SourceCursor cursor;
+        for (sourceCursorFirst(&cursor, rtf->redirections); sourceCursorGet(&cursor) != NULL; sourceCursorNext(&cursor)) {
+            sources[source++] = INTERNED(sourceCursorGet(&cursor))->hash;
+            node->source_count++;
+        }
+        next += childSetCount(&rtf->children);
+    }
+    for (size_t i = 0; i < pf->store->numbers.bucket_count; i++)
+        for (InternedNumber *entry = pf->store->numbers.buckets[i]; entry != NULL; entry = entry->next) {
+            unsigned char const *digits;
+            entry->hash = hash_packed(entry->packed, packed_size(packed_length(entry->packed, &digits)));
+        }
+    return image;
+}
+
+/** @brief Tworzy zamrożoną postać przekierowań.
+ * Struktury wskaźnikowe pozostają bez zmian.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @return Wskaźnik na zamrożoną postać albo NULL, gdy nie udało się
+ *         zaalokować pamięci lub struktura jest za duża.
+*/
+static Frozen *frozenCompile(PhoneForward *pf) {
+    size_t rft_count, rtf_count;
+    ChildSet **rft_queue = breadth_first_order(&pf->reds_from_to->children, &rft_count);
+    ChildSet **rtf_queue = breadth_first_order(&pf->reds_to_from->children, &rtf_count);
+    Frozen *image = NULL;
+    if (rft_queue != NULL && rtf_queue != NULL)
+        image = frozenBuild(pf, rft_queue, rft_count, rtf_queue, rtf_count);
+    free(rft_queue);
+    free(rtf_queue);
+    return image;
+}
+
+bool phfwdFreeze(PhoneForward *pf) {
+    if (pf == NULL || pf->epochs != NULL || pf->store->members > 1)
+        return false;
+    if (atomic_load(&pf->frozen) != NULL)
+        return true;
+    Frozen *image = frozenCompile(pf);
+    if (image == NULL)
+        return false;
+    arenaDelete(&pf->store->rft_arena, NULL);
+    arenaDelete(&pf->store->rtf_arena, rtfRelease);
+    for (int i = 0; i < CHILD_ARRAY_CLASSES; i++)
+        arenaDelete(&pf->store->child_arenas[i], NULL);
+    internDelete(&pf->store->numbers);
+    pf->reds_from_to = rftNew(pf);
+    pf->reds_to_from = rtfNew(pf);
+    writerEnd(pf);
+    atomic_store(&pf->frozen, image);
+    return true;
+}
+
+/** @brief Kopiuje poddrzewo do nowych aren.
+ * Węzły są wydzielane w kolejności w głąb, więc kolejne węzły ścieżki
+ * leżą blisko siebie. Obsługuje oba rodzaje węzłów, podobnie jak
+ * @ref childSetResetVersions. Kopie współdzielą z oryginałami numery
+ * i drzewa przekierowań.
+ * @param[in] arena - wskaźnik na arenę kopii węzłów.
+ * @param[in] child_arenas - wskaźnik na areny kopii tablic synów.
+ * @param[in] set - wskaźnik na zbiór synów korzenia poddrzewa.
+ * @return Wskaźnik na kopię korzenia albo NULL, gdy nie udało się
+ *         zaalokować pamięci.
+*/
+static void *nodeCompact(NodeArena *arena, NodeArena *child_arenas, ChildSet const *set) {
+    ChildSet *copy = arenaAlloc(arena);
+    if (copy == NULL) return NULL;
+    memcpy(copy, set, arena->node_size);
+    if (!childSetCopy(child_arenas, copy)) return NULL;
+    int count = childSetCount(copy);
+    void **children = count <= TINY_CHILDREN ? copy->children.tiny : copy->children.array;
+    for (int i = 0; i < count; i++)
+        if ((children[i] = nodeCompact(arena, child_arenas, children[i])) == NULL)
+            return NULL;
+    return copy;
+}
+
+/** @brief Przebudowuje drzewa przekierowań poddrzewa RedsToFrom.
+ * Drzewa wyższe niż jeden liść są budowane od nowa z pełnych węzłów.
+ * Drzewo, dla którego zabrakło pamięci, zostaje bez zmian.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in, out] rtf - wskaźnik na korzeń poddrzewa.
+*/
+static void rtfCompactSources(PhoneForward *pf, RedsToFrom *rtf) {
+    SourceNode *tree = rtf->redirections;
+    if (tree != NULL && tree->height > 0) {
+        char **keys = malloc(tree->size*sizeof(char *));
+        SourceNode **level = malloc((tree->size/SOURCE_NODE_KEYS + 1)*sizeof(SourceNode *));
+        if (keys != NULL && level != NULL) {
+            size_t count = 0;
+            SourceCursor cursor;
+            for (sourceCursorFirst(&cursor, tree); sourceCursorGet(&cursor) != NULL; sourceCursorNext(&cursor))
+                keys[count++] = sourceCursorGet(&cursor);
+            SourceNode *built = sourcesBuild(pf, keys, count, level);
+            if (built != NULL) {
+                rtf->redirections = built;
+                sourceTreeDelete(tree);
+            }
+        }
+        free(keys);
+        free(level);
+    }
+    for (int i = 0; i < COUNT_OF_NUMBERS; i++) {
+        RedsToFrom *child = childSetGet(&rtf->children, i);
+        if (child != NULL)
+            rtfCompactSources(pf, child);
+    }
+}
+
+bool phfwdCompact(PhoneForward *pf) {
+    if (pf == NULL || pf->epochs != NULL || pf->store->members > 1)
+        return false;
+    if (atomic_load(&pf->frozen) != NULL) // the frozen image is already dense
+        return true;
+    NodeArena rft_arena, rtf_arena, child_arenas[CHILD_ARRAY_CLASSES];
+    arenaInit(&rft_arena, sizeof(RedsFromTo));
+    arenaInit(&rtf_arena, sizeof(RedsToFrom));
+    for (int i = 0; i < CHILD_ARRAY_CLASSES; i++)
+        arenaInit(&child_arenas[i], (i+1)*CHILD_ARRAY_STEP*sizeof(void*));
+    RedsFromTo *rft = nodeCompact(&rft_arena, child_arenas, &pf->reds_from_to->children);
+    RedsToFrom *rtf = rft != NULL ? nodeCompact(&rtf_arena, child_arenas, &pf->reds_to_from->children) : NULL;
+    if (rtf == NULL) {
+        arenaDelete(&rft_arena, NULL);
+        arenaDelete(&rtf_arena, NULL);
+        for (int i = 0; i < CHILD_ARRAY_CLASSES; i++)
+            arenaDelete(&child_arenas[i], NULL);
+        return false;
+    }
+    arenaDelete(&pf->store->rft_arena, NULL);
+    arenaDelete(&pf->store->rtf_arena, NULL); // the trees now belong to the copies
+    for (int i = 0; i < CHILD_ARRAY_CLASSES; i++) {
+        arenaDelete(&pf->store->child_arenas[i], NULL);
+        pf->store->child_arenas[i] = child_arenas[i];
+    }
+    pf->store->rft_arena = rft_arena;
+    pf->store->rtf_arena = rtf_arena;
+    pf->reds_from_to = rft;
+    pf->reds_to_from = rtf;
+    rtfCompactSources(pf, rtf);
+    size_t bucket_count = BASIC_TABLE_LENGTH;
+    while (bucket_count < 2*pf->store->numbers.count)
+        bucket_count *= 2;
+    if (bucket_count < pf->store->numbers.bucket_count)
+        internResize(&pf->store->numbers, bucket_count);
+    if (pf->mapping != NULL) { // nothing points into a thawed snapshot
+        munmap(pf->mapping, pf->mapping_length);
+        pf->mapping = NULL;
+        pf->mapping_length = 0;
+    }
+    writerEnd(pf);
+    return true;
+}
+
+/** @brief Oblicza rozmiar tablicy synów.
+ * @param[in] set - wskaźnik na zbiór synów.
+ * @return Liczba bajtów tablicy synów dużego węzła, zero dla małego.
+*/
+static size_t child_set_bytes(ChildSet const *set) {
+    int count = childSetCount(set);
+    return count > TINY_CHILDREN ? (CHILD_ARRAY_CLASS(count) + 1)*CHILD_ARRAY_STEP*sizeof(void*) : 0;
+}
+
+/** @brief Oblicza rozmiar bloków areny.
+ * @param[in] arena - wskaźnik na arenę.
+ * @return Liczba bajtów wszystkich bloków areny.
+*/
+static size_t arena_bytes(NodeArena const *arena) {
+    size_t bytes = 0;
+    for (struct ArenaChunk const *chunk = arena->chunks; chunk != NULL; chunk = chunk->previous)
+        bytes += sizeof(struct ArenaChunk) + chunk->length*arena->node_size;
+    return bytes;
+}
+
+/** @brief Dodaje wskaźnik do zbioru.
+ * @param[in, out] set - wskaźnik na zbiór.
+ * @param[in] object - dodawany wskaźnik, różny od NULL.
+ * @return Wartość 1, jeśli wskaźnika nie było w zbiorze, 0, jeśli już był,
+ *         -1, jeśli nie udało się zaalokować pamięci.
+*/
+static int pointerSetInsert(PointerSet *set, void const *object) {
+    if (2*(set->count + 1) > set->size) { // at most half full, so that probing stays short
+        size_t size = set->size > 0 ? 2*set->size : BASIC_TABLE_LENGTH;
+        void const **slots = calloc(size, sizeof(void const *));
+        if (slots == NULL)
+            return -1;
+        for (size_t i = 0; i < set->size; i++)
+            if (set->slots[i] != NULL) {
+                size_t index = hash_packed((char const *)&set->slots[i], sizeof(void const *)) & (size - 1);
+                while (slots[index] != NULL)
+                    index = (index + 1) & (size - 1);
+                slots[index] = set->slots[i];
+            }
+        free(set->slots);
+        set->slots = slots;
+        set->size = size;
+    }
+    size_t index = hash_packed((char const *)&object, sizeof(void const *)) & (set->size - 1);
+    while (set->slots[index] != NULL) {
+        if (set->slots[index] == object)
+            return 0;
+        index = (index + 1) & (set->size - 1);
+    }
+    set->slots[index] = object;
+    set->count++;
+    return 1;
+}
+
+/** @brief Sprawdza, czy obiekt trzeba policzyć w statystykach.
+ * Obiekt współdzielony przez klony jest liczony tylko przy pierwszych
+ * odwiedzinach.
+ * @param[in, out] walk - wskaźnik na stan zbierania statystyk.
+ * @param[in] object - wskaźnik na obiekt.
+ * @return Wartość @p true, jeśli obiektu jeszcze nie policzono.
+*/
+static bool stats_fresh(StatsWalk *walk, void const *object) {
+    if (walk->seen == NULL)
+        return true;
+    int result = pointerSetInsert(walk->seen, object);
+    if (result < 0)
+        walk->failed = true;
+    return result > 0;
+}
+
+/** @brief Oblicza rozmiar B+ drzewa.
+ * Pomija węzły, które już policzono.
+ * @param[in, out] walk - wskaźnik na stan zbierania statystyk.
+ * @param[in] node - wskaźnik na korzeń drzewa albo NULL.
+ * @return Liczba bajtów węzłów drzewa.
+*/
+static size_t source_tree_bytes(StatsWalk *walk, SourceNode const *node) {
+    if (node == NULL || !stats_fresh(walk, node))
+        return 0;
+    size_t bytes = source_node_bytes(node->height);
+    for (int i = 0; i < node->count && node->height > 0; i++)
+        bytes += source_tree_bytes(walk, node->children[i]);
+    return bytes;
+}
+
+/** @brief Uwzględnia węzeł w statystykach kształtu.
+ * @param[in, out] walk - wskaźnik na stan zbierania statystyk.
+ * @param[in] reverse - czy węzeł jest węzłem "do".
+ * @param[in] depth - głębokość węzła.
+ * @param[in] children - liczba synów węzła.
+*/
+static void stats_node(StatsWalk *walk, bool reverse, size_t depth, int children) {
+    size_t *depths = reverse ? walk->stats->reverse_depths : walk->stats->forward_depths;
+    depths[depth < PHFWD_STATS_DEPTHS ? depth : PHFWD_STATS_DEPTHS - 1]++;
+    if (children > 0)
+        walk->inner[reverse]++;
+    walk->edges[reverse] += children;
+}
+
+/** @brief Uwzględnia listę przekierowań wśród najdłuższych.
+ * Numer listy to pierwsze @p length znaków bufora numeru w @p walk.
+ * @param[in, out] walk - wskaźnik na stan zbierania statystyk.
+ * @param[in] length - długość numeru.
+ * @param[in] count - długość listy.
+*/
+static void stats_list(StatsWalk *walk, size_t length, size_t count) {
+    PhoneForwardStats *stats = walk->stats;
+    int i = PHFWD_STATS_LARGEST;
+    while (i > 0 && stats->largest_counts[i-1] < count)
+        i--;
+    if (i == PHFWD_STATS_LARGEST)
+        return;
+    char *number = malloc(length + 1);
+    if (number == NULL)
+        return;
+    memcpy(number, walk->number, length);
+    number[length] = '\0';
+    free(stats->largest_numbers[PHFWD_STATS_LARGEST-1]);
+    memmove(&stats->largest_counts[i+1], &stats->largest_counts[i], (PHFWD_STATS_LARGEST-1 - i)*sizeof(size_t));
+    memmove(&stats->largest_numbers[i+1], &stats->largest_numbers[i], (PHFWD_STATS_LARGEST-1 - i)*sizeof(char *));
+    stats->largest_counts[i] = count;
+    stats->largest_numbers[i] = number;
+}
+
+/** @brief Dopisuje cyfrę do numeru bieżącego węzła RedsToFrom.
+ * @param[in, out] walk - wskaźnik na stan zbierania statystyk.
+ * @param[in] length - pozycja cyfry.
+ * @param[in] digit - cyfra.
+*/
+static void stats_digit(StatsWalk *walk, size_t length, int digit) {
+    if (length + 1 > walk->number_max) {
+        walk->number_max = 2*(length + 1);
+        walk->number = realloc(walk->number, walk->number_max);
+    }
+    walk->number[length] = digit + '0';
+}
+
+/** @brief Zbiera statystyki poddrzewa RedsFromTo.
+ * Węzły, które już policzono, zwiększają tylko liczbę przekierowań.
+ * @param[in] rft - wskaźnik na korzeń poddrzewa.
+ * @param[in] depth - głębokość korzenia.
+ * @param[in, out] walk - wskaźnik na stan zbierania statystyk.
+*/
+static void rftStats(RedsFromTo const *rft, size_t depth, StatsWalk *walk) {
+    int count = childSetCount(&rft->children);
+    if (rft->redirection != NULL)
+        walk->stats->rules++;
+    if (stats_fresh(walk, rft)) {
+        walk->stats->forward_nodes++;
+        walk->stats->forward_bytes += sizeof(RedsFromTo) + child_set_bytes(&rft->children);
+        stats_node(walk, false, depth, count);
+    }
+    void * const *children = count <= TINY_CHILDREN ? rft->children.children.tiny : rft->children.children.array;
+    for (int i = 0; i < count; i++)
+        rftStats(children[i], depth + 1, walk);
+}
+
+/** @brief Zbiera statystyki poddrzewa RedsToFrom.
+ * Bufor numeru w @p walk zawiera numer korzenia poddrzewa. Pomija
+ * poddrzewa i listy, które już policzono: węzeł współdzielony przez klony
+ * ma współdzielonych także wszystkich potomków.
+ * @param[in] rtf - wskaźnik na korzeń poddrzewa.
+ * @param[in] depth - głębokość korzenia, równa długości jego numeru.
+ * @param[in, out] walk - wskaźnik na stan zbierania statystyk.
+*/
+static void rtfStats(RedsToFrom const *rtf, size_t depth, StatsWalk *walk) {
+    if (!stats_fresh(walk, rtf))
+        return;
+    walk->stats->reverse_nodes++;
+    walk->stats->reverse_bytes += sizeof(RedsToFrom) + child_set_bytes(&rtf->children);
+    size_t list_bytes = source_tree_bytes(walk, rtf->redirections);
+    walk->stats->list_bytes += list_bytes;
+    if (list_bytes > 0) // a list kept by a copied node is listed once
+        stats_list(walk, depth, rtf->redirections->size);
+    stats_node(walk, true, depth, childSetCount(&rtf->children));
+    for (int i = 0; i < COUNT_OF_NUMBERS; i++) {
+        RedsToFrom const *child = childSetGet(&rtf->children, i);
+        if (child != NULL) {
+            stats_digit(walk, depth, i);
+            rtfStats(child, depth + 1, walk);
+        }
+    }
+}
+
+/** @brief Zbiera statystyki poddrzewa zamrożonej struktury RedsFromTo.
+ * @param[in] image - wskaźnik na zamrożoną postać.
+ * @param[in] index - indeks korzenia poddrzewa.
+ * @param[in] depth - głębokość korzenia.
+ * @param[in, out] walk - wskaźnik na stan zbierania statystyk.
+*/
+static void frozenRftStats(Frozen const *image, uint32_t index, size_t depth, StatsWalk *walk) {
+    FrozenRft const *node = &frozenRft(image)[index];
+    int count = count_bits(node->bitmap);
+    if (node->redirection != NO_OFFSET)
+        walk->stats->rules++;
+    stats_node(walk, false, depth, count);
+    for (int i = 0; i < count; i++)
+        frozenRftStats(image, node->first_child + i, depth + 1, walk);
+}
+
+/** @brief Zbiera statystyki poddrzewa zamrożonej struktury RedsToFrom.
+ * Działa jak @ref rtfStats.
+ * @param[in] image - wskaźnik na zamrożoną postać.
+ * @param[in] index - indeks korzenia poddrzewa.
+ * @param[in] depth - głębokość korzenia.
+ * @param[in, out] walk - wskaźnik na stan zbierania statystyk.
+*/
+static void frozenRtfStats(Frozen const *image, uint32_t index, size_t depth, StatsWalk *walk) {
+    FrozenRtf const *node = &frozenRtf(image)[index];
+    if (node->source_count > 0)
+        stats_list(walk, depth, node->source_count);
+    stats_node(walk, true, depth, count_bits(node->bitmap));
+    uint32_t child = node->first_child;
+    for (int i = 0; i < COUNT_OF_NUMBERS; i++)
+        if (node->bitmap & (1u << i)) {
+            stats_digit(walk, depth, i);
+            frozenRtfStats(image, child++, depth + 1, walk);
+        }
+}
+
+/** @brief Dolicza strukturę do statystyk.
+ * Numery i areny wspólnej pamięci klonów są liczone raz, gdy @p walk
+ * pamięta policzone obiekty. Wolne bajty to bajty aren pomniejszone
+ * o policzone węzły.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in, out] walk - wskaźnik na stan zbierania statystyk.
+*/
+static void stats_collect(PhoneForward *pf, StatsWalk *walk) {
+    PhoneForwardStats *stats = walk->stats;
+    Frozen *image = atomic_load(&pf->frozen);
+    if (image != NULL) { // a frozen structure has no clones, so nothing in it is shared
+        stats->frozen = true;
+        stats->forward_nodes += image->rft_count;
+        stats->reverse_nodes += image->rtf_count;
+        stats->forward_bytes += image->rft_count*sizeof(FrozenRft);
+        stats->reverse_bytes += image->rtf_count*sizeof(FrozenRtf);
+        stats->list_bytes += image->source_count*sizeof(uint32_t);
+        stats->number_bytes += image->pool_size;
+        stats->free_bytes += image->size - image->rft_count*sizeof(FrozenRft) - image->rtf_count*sizeof(FrozenRtf)
+                             - image->source_count*sizeof(uint32_t) - image->pool_size;
+        for (size_t offset = 0; offset < image->pool_size; stats->numbers++) {
+            unsigned char const *digits;
+            offset += packed_size(packed_length(frozenPool(image) + offset, &digits));
+        }
+        frozenRftStats(image, 0, 0, walk);
+        frozenRtfStats(image, 0, 0, walk);
+        return;
+    }
+    if (stats_fresh(walk, pf->store)) { // added before the nodes of the store are subtracted
+        stats->numbers += pf->store->numbers.count;
+        stats->number_bytes += pf->store->numbers.bucket_count*sizeof(InternedNumber *);
+        for (size_t i = 0; i < pf->store->numbers.bucket_count; i++)
+            for (InternedNumber *entry = pf->store->numbers.buckets[i]; entry != NULL; entry = entry->next) {
+                unsigned char const *digits;
+                stats->number_bytes += sizeof(InternedNumber) + packed_size(packed_length(entry->packed, &digits));
+            }
+        stats->free_bytes += arena_bytes(&pf->store->rft_arena) + arena_bytes(&pf->store->rtf_arena);
+        for (int i = 0; i < CHILD_ARRAY_CLASSES; i++)
+            stats->free_bytes += arena_bytes(&pf->store->child_arenas[i]);
+    }
+    size_t node_bytes = stats->forward_bytes + stats->reverse_bytes;
+    rftStats(pf->reds_from_to, 0, walk);
+    rtfStats(pf->reds_to_from, 0, walk);
+    stats->free_bytes -= stats->forward_bytes + stats->reverse_bytes - node_bytes;
+}
+
+/** @brief Kończy zbieranie statystyk.
+ * Oblicza średnią liczbę synów i zwalnia bufor numeru.
+ * @param[in, out] walk - wskaźnik na stan zbierania statystyk.
+*/
+static void stats_finish(StatsWalk *walk) {
+    if (walk->inner[false] > 0)
+        walk->stats->forward_fanout = (double)walk->edges[false] / walk->inner[false];
+    if (walk->inner[true] > 0)
+        walk->stats->reverse_fanout = (double)walk->edges[true] / walk->inner[true];
+    free(walk->number);
+}
+
+bool phfwdStats(PhoneForward *pf, PhoneForwardStats *stats) {
+    if (pf == NULL || stats == NULL)
+        return false;
+    memset(stats, 0, sizeof(PhoneForwardStats));
+    StatsWalk walk = {stats, {0, 0}, {0, 0}, NULL, false, malloc(BASIC_ARRAY_LENGTH), BASIC_ARRAY_LENGTH};
+    if (walk.number == NULL)
+        return false;
+    stats_collect(pf, &walk);
+    stats_finish(&walk);
+    return true;
+}
+
+bool phfwdStatsTotal(PhoneForward * const *pfs, size_t count, PhoneForwardStats *stats) {
+    if ((pfs == NULL && count > 0) || stats == NULL)
+        return false;
+    for (size_t i = 0; i < count; i++)
+        if (pfs[i] == NULL)
+            return false;
+    memset(stats, 0, sizeof(PhoneForwardStats));
+    PointerSet seen = {NULL, 0, 0};
+    StatsWalk walk = {stats, {0, 0}, {0, 0}, &seen, false, malloc(BASIC_ARRAY_LENGTH), BASIC_ARRAY_LENGTH};
+    if (walk.number == NULL)
+        return false;
+    for (size_t i = 0; i < count && !walk.failed; i++)
+        stats_collect(pfs[i], &walk);
+    stats_finish(&walk);
+    free(seen.slots);
+    if (walk.failed)
+        phfwdStatsClear(stats);
+    return !walk.failed;
+}
+
+void phfwdStatsClear(PhoneForwardStats *stats) {
+    if (stats != NULL)
+        for (int i = 0; i < PHFWD_STATS_LARGEST; i++) {
+            free(stats->largest_numbers[i]);
+            stats->largest_numbers[i] = NULL;
+        }
+}
+
+/** @brief Odtwarza przekierowania z poddrzewa zamrożonej postaci.
+ * Napis @p num zawiera numer odpowiadający ojcu węzła, funkcja dopisuje
+ * do niego etykietę węzła, podobnie jak @ref rftCollect.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] image - wskaźnik na zamrożoną postać.
+ * @param[in] index - indeks korzenia poddrzewa.
+ * @param[in] current_index - aktualna długość @p num.
+ * @param[in] max_index - rozmiar pamięci zaalokowanej na @p num.
+ * @param[in] num - wskaźnik na prefiks.
+ * @return Wskaźnik na uaktualniony napis @p num.
+*/
+static char *frozenThawRec(PhoneForward *pf, Frozen const *image, uint32_t index, int current_index, int *max_index, char *num) {
+    FrozenRft const *node = &frozenRft(image)[index];
+    if (current_index + node->label_length + 1 > *max_index) {
+        *max_index = 2*(current_index + node->label_length + 1);
+        num = realloc(num, *max_index);
+    }
+    for (int i = 0; i < node->label_length; i++)
+        num[current_index++] = get_digit(node->label, i) + '0';
+    num[current_index] = '\0';
+    if (node->redirection != NO_OFFSET) {
+        char const *packed = frozenPool(image) + node->redirection;
+        unsigned char const *digits;
+        size_t length = packed_length(packed, &digits);
+        char *to = malloc(length + 1);
+        to[unpack_number(packed, to)] = '\0';
+        addToRFT(pf, num, to, current_index, length, NULL);
+        addToRTF(pf, num, to, current_index, length);
+        free(to);
+    }
+    for (int i = 0; i < count_bits(node->bitmap); i++)
+        num = frozenThawRec(pf, image, node->first_child + i, current_index, max_index, num);
+    return num;
+}
+
+/** @brief Rozmraża przekierowania.
+ * Odtwarza wskaźnikowe struktury przekierowań z zamrożonej postaci
+ * i usuwa ją. Wywoływana przed każdą operacją zapisu.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+*/
+static void frozenThaw(PhoneForward *pf) {
+    Frozen *image = atomic_load(&pf->frozen);
+    if (image == NULL)
+        return;
+    int max_index = BASIC_ARRAY_LENGTH;
+    char *number = malloc(max_index);
+    TargetIndex *targets = pf->targets; // the index already describes the image
+    pf->targets = targets != NULL ? NULL : targetsNew(pf);
+    writerBegin(pf);
+    number = frozenThawRec(pf, image, 0, 0, &max_index, number);
+    if (targets != NULL)
+        pf->targets = targets;
+    writerEnd(pf);
+    free(number);
+    atomic_store(&pf->frozen, NULL);
+    frozenDelete(pf, image);
+}
+
+bool phfwdSave(PhoneForward *pf, FILE *file) {
+    if (pf == NULL || file == NULL)
+        return false;
+    Frozen *image = atomic_load(&pf->frozen);
+    Frozen *compiled = NULL;
+    if (image == NULL && (image = compiled = frozenCompile(pf)) == NULL)
+        return false;
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.word_size = sizeof(size_t);
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.size = image->size;
+    header.checksum = hash_packed((char const *)image, image->size);
+    bool result = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(image, image->size, 1, file) == 1;
+    free(compiled);
+    return result;
+}
+
+/** @brief Sprawdza nagłówek zapisanej bazy.
+ * @param[in] header - wskaźnik na nagłówek.
+ * @param[in] available - liczba bajtów pliku od początku nagłówka.
+ * @return @p true, jeśli nagłówek pochodzi z pliku w obsługiwanym formacie
+ *         i zamrożona postać mieści się w pliku.
+*/
+static bool snapshot_header_valid(SnapshotHeader const *header, size_t available) {
+    return memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0
+        && header->version == SNAPSHOT_VERSION
+        && header->word_size == sizeof(size_t)
+        && header->byte_order == SNAPSHOT_BYTE_ORDER
+        && header->size >= sizeof(Frozen)
+        && header->size <= available - sizeof(SnapshotHeader);
+}
+
+/** @brief Sprawdza układ zamrożonej postaci.
+ * @param[in] image - wskaźnik na zamrożoną postać.
+ * @param[in] size - rozmiar postaci według nagłówka pliku.
+ * @return @p true, jeśli części postaci leżą po sobie i wypełniają
+ *         dokładnie @p size bajtów.
+*/
+static bool frozen_layout_valid(Frozen const *image, size_t size) {
+    return image->size == size
+        && image->rft_count > 0 && image->rft_count < NO_OFFSET
+        && image->rtf_count > 0 && image->rtf_count < NO_OFFSET
+        && image->rft_offset == sizeof(Frozen)
+        && image->rtf_offset == image->rft_offset + image->rft_count*sizeof(FrozenRft)
+        && image->sources_offset == image->rtf_offset + image->rtf_count*sizeof(FrozenRtf)
+        && image->pool_offset == image->sources_offset + image->source_count*sizeof(uint32_t)
+        && image->pool_offset + image->pool_size == size;
+}
+
+PhoneForward *phfwdLoad(char const *path, size_t offset) {
+    if (path == NULL || offset % SNAPSHOT_ALIGNMENT != 0)
+        return NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    PhoneForward *pf = NULL;
+    SnapshotHeader header;
+    struct stat status;
+    if (fstat(fd, &status) == 0 && (size_t)status.st_size >= offset + sizeof(header)
+        && pread(fd, &header, sizeof(header), offset) == sizeof(header)
+        && snapshot_header_valid(&header, status.st_size - offset)) {
+        size_t start = offset - offset % sysconf(_SC_PAGESIZE); // mmap needs a page-aligned offset
+        size_t length = offset - start + sizeof(header) + header.size;
+        void *mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, start);
+        if (mapping != MAP_FAILED) {
+            Frozen *image = (Frozen *)((char *)mapping + (offset - start) + sizeof(header));
+            if (hash_packed((char const *)image, header.size) == header.checksum
+                && frozen_layout_valid(image, header.size) && (pf = phfwdNew()) != NULL) {
+                pf->mapping = mapping;
+                pf->mapping_length = length;
+                targetsDelete(pf, pf->targets); // built at the first change, reading the image now would touch all of it
+                pf->targets = NULL;
+                atomic_store(&pf->targets_published, NULL);
+                atomic_store(&pf->frozen, image);
+            }
+            else
+                munmap(mapping, length);
+        }
+    }
+    close(fd);
+    return pf;
+}
+
+PhoneForward *phfwdClone(PhoneForward *pf) {
+    if (pf == NULL || pf->epochs != NULL || pf->store->members >= USHRT_MAX - 1)
+        return NULL;
+    frozenThaw(pf);
+    PhoneForward *new = malloc(sizeof(PhoneForward));
+    if (new == NULL) return NULL;
+    new->store = pf->store;
+    new->store->members++;
+    new->version = 0;
+    new->epochs = NULL;
+    new->reds_from_to = pf->reds_from_to;
+    new->reds_to_from = pf->reds_to_from;
+    new->reds_from_to->children.references++;
+    new->reds_to_from->children.references++;
+    new->targets = pf->targets;
+    if (new->targets != NULL)
+        new->targets->references++;
+    atomic_init(&new->rft_published, new->reds_from_to);
+    atomic_init(&new->rtf_published, new->reds_to_from);
+    atomic_init(&new->targets_published, new->targets);
+    atomic_init(&new->frozen, NULL);
+    new->mapping = NULL;
+    new->mapping_length = 0;
+    new->transaction = false;
+    new->staged = NULL;
+    new->staged_count = 0;
+    new->staged_max = 0;
+    return new;
+}
+
+/** @brief Wyszukuje przekierowanie numeru w zamrożonej postaci.
+ * Wypełnia stan @p lookup tak, jak pełne wyszukiwanie rozpoczęte funkcją
+ * @ref lookupStart.
+ * @param[in] image - wskaźnik na zamrożoną postać.
+ * @param[out] lookup - wskaźnik na stan wyszukiwania.
+ * @param[in] num - wskaźnik na napis reprezentujący poprawny numer.
+*/
+static void frozenLookup(Frozen const *image, Lookup *lookup, char const *num) {
+    FrozenRft const *nodes = frozenRft(image);
+    FrozenRft const *node = &nodes[0];
+    lookup->num = num;
+    lookup->length = strlen(num);
+    lookup->position = 0;
+    lookup->end_of_redirection = 0;
+    lookup->candidate = NULL;
+    lookup->next = NULL;
+    while (lookup->position < lookup->length) {
+        uint32_t child = frozenChild(node->first_child, node->bitmap, CHAR_TO_NUMBER(num[lookup->position]));
+        if (child == NO_OFFSET)
+            return;
+        node = &nodes[child];
+        int i = 0;
+        while (i < node->label_length && lookup->position + i < lookup->length
+               && get_digit(node->label, i) == CHAR_TO_NUMBER(num[lookup->position + i]))
+            i++;
+        if (i < node->label_length)
+            return;
+        lookup->position += node->label_length;
+        if (node->redirection != NO_OFFSET) {
+            lookup->end_of_redirection = lookup->position;
+            lookup->candidate = frozenPool(image) + node->redirection;
+        }
+    }
+}
+
+bool phfwdAdd(PhoneForward *pf, char const *num1, char const *num2) {
+    if (strcmp(num1, num2) == 0 || !is_string_a_number(num1) || !is_string_a_number(num2) || pf == NULL) 
+        return false;
+    int length1 = strlen(num1);
+    int length2 = strlen(num2);
+    frozenThaw(pf);
+    writerBegin(pf);
+    char *replaced = NULL;
+    RedsFromTo *rft = addToRFT(pf, num1, num2, length1, length2, &replaced);
+    bool result = rft != NULL;
+    if (result && replaced != NULL && replaced != rft->redirection) // removing the replaced rule must not fail later
+        result = prepareRemoveFromRTF(pf, replaced, num1);
+    if (result)
+        result = addToRTF(pf, num1, num2, length1, length2);
+    if (rft != NULL && !result) {
+        internRelease(&pf->store->numbers, rft->redirection);
+        rft->redirection = replaced;
+    }
+    else if (replaced != NULL) {
+        if (replaced != rft->redirection)
+            removeFromRTF(pf, replaced, num1);
+        internRelease(&pf->store->numbers, replaced);
+    }
+    writerEnd(pf);
+    return result;
+}
+
+
+/** @brief Sortuje stabilnie tablicę według liczbowego klucza.
+ * Sortuje pozycyjnie, od najmniej znaczącego bajtu klucza, pomijając bajty
+ * równe we wszystkich elementach. Elementy o równych kluczach zachowują
+ * kolejność.
+ * @param[in, out] items - wskaźnik na tablicę.
+ * @param[in] count - liczba elementów.
+ * @param[in] size - rozmiar elementu w bajtach.
+ * @param[in] key - funkcja zwracająca klucz elementu.
+ * @return Wartość @p false, jeśli nie udało się zaalokować pamięci i tablica
+ *         nie została posortowana.
+*/
+static bool radix_sort(void *items, size_t count, size_t size, uint64_t (*key)(void const *)) {
+    if (count < 2)
+        return true;
+    unsigned char *buffer = malloc(count*size);
+    size_t (*counts)[256] = calloc(KEY_BYTES, sizeof(*counts)); // one count table per key byte
+    if (buffer == NULL || counts == NULL) {
+        free(buffer);
+        free(counts);
+        return false;
+    }
+    unsigned char *from = items, *to = buffer;
+    for (size_t i = 0; i < count; i++) { // one pass counts all the bytes
+        uint64_t value = key(from + i*size);
+        for (size_t byte = 0; byte < KEY_BYTES; byte++)
+            counts[byte][value >> 8*byte & 0xff]++;
+    }
+    uint64_t first = key(from);
+    for (size_t byte = 0; byte < KEY_BYTES; byte++) {
+        if (counts[byte][first >> 8*byte & 0xff] == count)
+            continue;
+        size_t offset = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            size_t digit_count = counts[byte][digit];
+            counts[byte][digit] = offset;
+            offset += digit_count;
+        }
+        for (size_t i = 0; i < count; i++)
+            memcpy(to + counts[byte][key(from + i*size) >> 8*byte & 0xff]++*size, from + i*size, size);
+        unsigned char *swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != items)
+        memcpy(items, from, count*size);
+    free(buffer);
+    free(counts);
+    return true;
+}
+
+/** @brief Porównuje zmiany przekierowań.
+ * Funkcja przekazywana do qsort, porządkuje zmiany według numeru "do",
+ * numeru "od", a potem kolejności zebrania.
+ * @param[in] a - wskaźnik na pierwszą zmianę.
+ * @param[in] b - wskaźnik na drugą zmianę.
+ * @return Liczba ujemna, zero lub dodatnia, gdy pierwsza zmiana jest
+ *         odpowiednio mniejsza, równa lub większa od drugiej.
+*/
+static int compare_rule_changes(void const *a, void const *b) {
+    RuleChange const *x = a, *y = b;
+    if (x->target != y->target) // numbers are interned, so equal numbers are the same pointer
+        return compare_packed(x->target, y->target);
+    if (x->source != y->source)
+        return compare_packed(x->source, y->source);
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+/** @brief Porównuje zmiany przekierowań zebrane w kolejności numerów "od".
+ * Funkcja przekazywana do qsort, porządkuje zmiany według adresu numeru
+ * "do", a potem kolejności zebrania, która wtedy odpowiada kolejności
+ * numerów "od", więc numerów nie trzeba czytać.
+ * @param[in] a - wskaźnik na pierwszą zmianę.
+ * @param[in] b - wskaźnik na drugą zmianę.
+ * @return Liczba ujemna, zero lub dodatnia, gdy pierwsza zmiana jest
+ *         odpowiednio mniejsza, równa lub większa od drugiej.
+*/
+static int compare_rule_changes_by_order(void const *a, void const *b) {
+    RuleChange const *x = a, *y = b;
+    if (x->target != y->target)
+        return (uintptr_t)x->target < (uintptr_t)y->target ? -1 : 1;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+/** @brief Zwraca klucz zmiany przekierowania do sortowania pozycyjnego.
+ * @param[in] rule - wskaźnik na zmianę.
+ * @return Adres numeru "do".
+*/
+static uint64_t rule_change_key(void const *rule) {
+    return (uintptr_t)((RuleChange const *)rule)->target;
+}
+
+/** @brief Zmienia drzewo przekierowań węzła RedsToFrom numer po numerze.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in, out] root - wskaźnik na korzeń drzewa.
+ * @param[in] rules - zmiany o wspólnym numerze "do", najwyżej jedna na numer.
+ * @param[in] count - liczba zmian.
+*/
+static void sourcesApplyEach(PhoneForward *pf, SourceNode **root, RuleChange const *rules, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (!rules[i].added)
+            internRelease(&pf->store->numbers, sourcesRemove(pf, root, rules[i].source, compare_packed));
+        else {
+            internRetain(rules[i].source); // the tree keeps its own reference
+            if (!sourcesInsert(pf, root, rules[i].source))
+                internRelease(&pf->store->numbers, rules[i].source);
+        }
+    }
+}
+
+/** @brief Zmienia drzewo przekierowań węzła RedsToFrom.
+ * Gdy zmienia się znaczna część drzewa, drzewo jest budowane od nowa
+ * w jednym przejściu, scalającym pozostałe i dodawane numery, w przeciwnym
+ * razie numery są usuwane i wstawiane pojedynczo.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in, out] root - wskaźnik na korzeń drzewa.
+ * @param[in] rules - zmiany o wspólnym numerze "do", posortowane według
+ *                    numeru "od", najwyżej jedna na numer.
+ * @param[in] count - liczba zmian.
+*/
+static void sourcesApply(PhoneForward *pf, SourceNode **root, RuleChange const *rules, size_t count) {
+    SourceNode *tree = *root;
+    size_t size = tree != NULL ? tree->size : 0, added = 0;
+    for (size_t i = 0; i < count; i++)
+        added += rules[i].added;
+    char **kept = NULL;
+    SourceNode **level = NULL;
+    bool all = added == 0 && count == size; // changes lost for lack of memory may leave numbers that are not in the tree
+    SourceCursor cursor;
+    sourceCursorFirst(&cursor, tree);
+    for (size_t i = 0; all && i < count; i++, sourceCursorNext(&cursor))
+        all = rules[i].source == sourceCursorGet(&cursor);
+    if (all) { // every number of the tree is removed
+        sourceTreeDiscard(pf, tree);
+        for (size_t i = 0; i < count; i++)
+            internRelease(&pf->store->numbers, rules[i].source);
+        *root = NULL;
+        return;
+    }
+    if (count*16 >= size) {
+        kept = malloc((size + added)*sizeof(char *));
+        level = malloc(((size + added)/SOURCE_NODE_KEYS + 1)*sizeof(SourceNode *));
+    }
+    if (kept == NULL || level == NULL) {
+        free(kept);
+        free(level);
+        sourcesApplyEach(pf, root, rules, count);
+        return;
+    }
+    size_t capacity = size + added, kept_count = 0, removed_count = 0; // removed numbers are gathered at the end of kept
+    size_t j = 0;
+    for (sourceCursorFirst(&cursor, tree); sourceCursorGet(&cursor) != NULL; sourceCursorNext(&cursor)) {
+        char *source = sourceCursorGet(&cursor);
+        for (; j < count && compare_packed(rules[j].source, source) < 0; j++)
+            if (rules[j].added) {
+                internRetain(rules[j].source);
+                kept[kept_count++] = rules[j].source;
+            }
+        if (j < count && rules[j].source == source && !rules[j].added) // numbers are interned, so equal numbers are the same pointer
+            kept[capacity - ++removed_count] = source;
+        else
+            kept[kept_count++] = source;
+        if (j < count && rules[j].source == source)
+            j++;
+    }
+    for (; j < count; j++)
+        if (rules[j].added) {
+            internRetain(rules[j].source);
+            kept[kept_count++] = rules[j].source;
+        }
+    SourceNode *built = sourcesBuild(pf, kept, kept_count, level);
+    free(level);
+    if (built == NULL && kept_count > 0) { // the tree is left as it was and changed number by number
+        for (size_t i = 0; i < count; i++)
+            if (rules[i].added)
+                internRelease(&pf->store->numbers, rules[i].source);
+        free(kept);
+        sourcesApplyEach(pf, root, rules, count);
+        return;
+    }
+    sourceTreeDiscard(pf, tree); // before the release, a shared tree keeps its own references
+    for (size_t i = capacity - removed_count; i < capacity; i++)
+        internRelease(&pf->store->numbers, kept[i]);
+    *root = built;
+    free(kept);
+}
+
+/** @brief Wprowadza zebrane zmiany do struktury RedsToFrom.
+ * Zmiany tego samego przekierowania są najpierw sumowane, więc
+ * przekierowanie dodane i usunięte w jednej transakcji nie zmienia
+ * struktury. Pozostałe zmiany są grupowane według numeru "do": każdy
+ * węzeł jest odwiedzany raz, a kolejne numery "do" korzystają ze wspólnej
+ * części ścieżki. Kolejność numerów "do" wpływa tylko na to, jak długie są
+ * wspólne części. Zwalnia odwołania do numerów przechowywane w @p rules.
+ * Gdy zabraknie pamięci na węzły numeru "do", jego zmiany są pomijane.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in, out] rules - tablica zmian, zostaje posortowana.
+ * @param[in] count - liczba zmian.
+ * @param[in] by_source - czy zmiany zebrano w kolejności numerów "od".
+*/
+static void rtfApplyRules(PhoneForward *pf, RuleChange *rules, size_t count, bool by_source) {
+    if (count == 0)
+        return;
+    if (!by_source) // changes collected in order of sources only have to be grouped by target
+        qsort(rules, count, sizeof(RuleChange), compare_rule_changes);
+    else if (!radix_sort(rules, count, sizeof(RuleChange), rule_change_key))
+        qsort(rules, count, sizeof(RuleChange), compare_rule_changes_by_order);
+    size_t net_count = 0;
+    for (size_t first = 0, last; first < count; first = last) {
+        int balance = 0; // changes of one rule alternate, so their sum is -1, 0 or 1
+        for (last = first; last < count && rules[last].target == rules[first].target && rules[last].source == rules[first].source; last++)
+            balance += rules[last].added ? 1 : -1;
+        for (size_t i = first + (balance != 0); i < last; i++) {
+            internRelease(&pf->store->numbers, rules[i].source);
+            internRelease(&pf->store->numbers, rules[i].target);
+        }
+        if (balance != 0) {
+            rules[net_count] = rules[first];
+            rules[net_count++].added = balance > 0;
+        }
+    }
+    count = net_count;
+    size_t max_length = 0;
+    for (size_t i = 0; i < count; i++) {
+        unsigned char const *digits;
+        size_t length = packed_length(rules[i].target, &digits);
+        if (length > max_length)
+            max_length = length;
+    }
+    RedsToFrom **path = count > 0 ? malloc((max_length + 1)*sizeof(RedsToFrom *)) : NULL;
+    size_t path_length = 0; // nodes of the first path_length digits of the target are already in path
+    for (size_t first = 0, last; first < count; first = last) {
+        last = first;
+        while (last < count && rules[last].target == rules[first].target)
+            last++;
+        unsigned char const *digits;
+        size_t length = packed_length(rules[first].target, &digits);
+        RedsToFrom *rtf = NULL;
+        if (path != NULL) {
+            if (first == 0 && (path[0] = rtfWritable(pf, pf->reds_to_from)) != NULL)
+                pf->reds_to_from = path[0];
+            for (; path_length < length && path[path_length] != NULL; path_length++)
+                path[path_length + 1] = rtfWritableChild(pf, path[path_length], get_digit(digits, path_length));
+            if (path_length == length)
+                rtf = path[length];
+            if (rtf == NULL) { // without memory the shared path is given up, as if it was never allocated
+                free(path);
+                path = NULL;
+            }
+        }
+        if (path == NULL) // no memory for the shared path: a walk from the root for each target
+            rtf = rtfWritablePath(pf, rules[first].target, NULL);
+        if (rtf == NULL) // without memory for the nodes of the target its changes are lost
+            continue;
+        bool before = rtf->redirections != NULL;
+        sourcesApply(pf, &rtf->redirections, &rules[first], last - first);
+        if (before != (rtf->redirections != NULL))
+            targetsToggled(pf, rules[first].target, rtf, !before);
+        if (path != NULL) {
+            size_t kept = 0; // nodes shared with the next target stay on the path
+            if (last < count) {
+                unsigned char const *next;
+                size_t next_length = packed_length(rules[last].target, &next);
+                while (kept < length && kept < next_length && get_digit(digits, kept) == get_digit(next, kept))
+                    kept++;
+            }
+            rtfPrune(pf, path, digits, length, kept);
+            path_length = kept;
+        }
+    }
+    free(path);
+    for (size_t i = 0; i < count; i++) { // after the walk, which still compares the targets
+        internRelease(&pf->store->numbers, rules[i].source);
+        internRelease(&pf->store->numbers, rules[i].target);
+    }
+}
+
+/** @brief Zapamiętuje zmianę struktury RedsToFrom.
+ * Gdy zabraknie pamięci, wprowadza zebrane dotąd zmiany, a jeśli i to nie
+ * wystarczy, wprowadza zmianę od razu.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in, out] removal - wskaźnik na stan zbierania zmian.
+ * @param[in] target - internowany numer "do", którego odwołanie przejmuje
+ *                     funkcja.
+ * @param[in] number - wskaźnik na numer "od".
+ * @param[in] length - długość numeru "od".
+ * @param[in] added - czy przekierowanie jest dodawane, a nie usuwane.
+*/
+static void removal_add(PhoneForward *pf, Removal *removal, char *target, char const *number, size_t length, bool added) {
+    char *source = internGet(&pf->store->numbers, number, length);
+    if (removal->count == removal->max) {
+        size_t max = removal->max > 0 ? 2*removal->max : BASIC_ARRAY_LENGTH;
+        RuleChange *rules = realloc(removal->rules, max*sizeof(RuleChange));
+        if (rules != NULL) {
+            removal->rules = rules;
+            removal->max = max;
+        }
+        else {
+            rtfApplyRules(pf, removal->rules, removal->count, false);
+            removal->count = 0;
+        }
+    }
+    if (source != NULL && removal->count == removal->max) {
+        RuleChange rule = {target, source, 0, added};
+        rtfApplyRules(pf, &rule, 1, false);
+        return;
+    }
+    if (source == NULL) {
+        if (!added)
+            removeFromRTF(pf, target, number);
+        internRelease(&pf->store->numbers, target);
+        return;
+    }
+    removal->rules[removal->count] = (RuleChange){target, source, removal->count, added};
+    removal->count++;
+}
+
+/** @brief Oblicza długość najdłuższego numeru poddrzewa RedsFromTo.
+ * @param[in] rft - wskaźnik na korzeń poddrzewa.
+ * @return Suma długości etykiet na najdłuższej ścieżce od @p rft
+ *         do liścia, wliczając etykietę @p rft.
+*/
+static size_t rftDepth(RedsFromTo const *rft) {
+    size_t depth = 0;
+    for (int i = 0; i < COUNT_OF_NUMBERS; i++) {
+        RedsFromTo const *child = childSetGet(&rft->children, i);
+        if (child != NULL) {
+            size_t child_depth = rftDepth(child);
+            if (child_depth > depth)
+                depth = child_depth;
+        }
+    }
+    return rft->label_length + depth;
+}
+
+/** @brief Zbiera przekierowania z poddrzewa RedsFromTo i zwalnia jego węzły.
+ * Bufor numeru w @p removal zawiera numer odpowiadający ojcu węzła
+ * @p rft, funkcja dopisuje do niego etykiety kolejnych węzłów, więc musi
+ * pomieścić najdłuższy numer poddrzewa (zob. @ref rftDepth). Odwiedzani
+ * są tylko istniejący synowie.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] rft - wskaźnik na korzeń odłączonego poddrzewa.
+ * @param[in] length - długość numeru ojca.
+ * @param[in, out] removal - wskaźnik na stan usuwania.
+*/
+static void rftCollect(PhoneForward *pf, RedsFromTo *rft, size_t length, Removal *removal) {
+    for (int i = 0; i < rft->label_length; i++)
+        removal->number[length++] = get_digit(rft->label, i) + '0';
+    removal->number[length] = '\0';
+    void *children[COUNT_OF_NUMBERS];
+    int count = childSetCount(&rft->children);
+    memcpy(children, count <= TINY_CHILDREN ? rft->children.children.tiny : rft->children.children.array, count*sizeof(void *));
+    char *redirection = rft->redirection;
+    nodeDiscard(pf, &pf->store->rft_arena, rft, &rft->children); // a shared node first passes on its redirection and children
+    if (redirection != NULL)
+        removal_add(pf, removal, redirection, removal->number, length, false);
+    for (int i = 0; i < count; i++)
+        rftCollect(pf, children[i], length, removal);
+}
+
+/** @brief Porządkuje ścieżkę po usunięciu poddrzewa.
+ * Idąc od najgłębszego węzła ścieżki @p path, usuwa węzły bez przekierowania
+ * i bez synów oraz scala węzeł bez przekierowania z jego jedynym synem,
+ * jeśli połączona etykieta mieści się w węźle.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] path - tablica węzłów od korzenia do ojca usuniętego poddrzewa.
+ * @param[in] depth - liczba węzłów w @p path.
+*/
+static void rftPrune(PhoneForward *pf, RedsFromTo **path, int depth) {
+    while (depth > 1) { // root is never removed
+        RedsFromTo *rft = path[depth-1];
+        RedsFromTo *parent = path[depth-2];
+        int index = get_digit(rft->label, 0);
+        int count = childSetCount(&rft->children);
+        if (rft->redirection != NULL)
+            return;
+        if (count == 0) {
+            childSetPut(pf->store->child_arenas, &parent->children, index, NULL);
+            nodeDiscard(pf, &pf->store->rft_arena, rft, &rft->children);
+            depth--;
+        }
+        else {
+            RedsFromTo *child = rft->children.children.tiny[0];
+            if (count == 1 && rft->label_length + child->label_length <= LABEL_LENGTH) {
+                child = rftWritable(pf, child);
+                unsigned char label[LABEL_LENGTH/2];
+                memcpy(label, rft->label, sizeof(label));
+                for (int i = 0; i < child->label_length; i++)
+                    set_digit(label, rft->label_length + i, get_digit(child->label, i));
+                memcpy(child->label, label, sizeof(label));
+                child->label_length += rft->label_length;
+                childSetPut(pf->store->child_arenas, &parent->children, index, child);
+                nodeDiscard(pf, &pf->store->rft_arena, rft, &rft->children);
+            }
+            return;
+        }
+    }
+}
+
+/** @brief Usuwa z RedsFromTo przekierowania numerów o danym prefiksie.
+ * Odłącza poddrzewo numerów o prefiksie @p num, a jego przekierowania
+ * dopisuje do zmian struktury RedsToFrom w @p removal. Gdy zabraknie
+ * pamięci, niczego nie usuwa.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] num - wskaźnik na prefiks będący numerem.
+ * @param[in, out] removal - wskaźnik na stan zbierania zmian.
+*/
+static void rftRemovePrefix(PhoneForward *pf, char const *num, Removal *removal) {
+    int length = strlen(num);
+    int index = 0;
+    int i = 0;
+    int depth = 0;
+    RedsFromTo *rft = pf->reds_from_to;
+    RedsFromTo **path = malloc((length+1)*sizeof(RedsFromTo*));
+    if (path == NULL)
+        return;
+    while (i < length) { // last edge may end past the end of num
+        index = CHAR_TO_NUMBER(num[i]);
+        RedsFromTo *child = childSetGet(&rft->children, index);
+        int expected = 0;
+        if (child != NULL)
+            expected = child->label_length < length - i ? child->label_length : length - i;
+        if (child == NULL || common_label_length(child, &num[i], length - i) < expected) {
+            free(path);
+            return;
+        }
+        path[depth++] = rft;
+        rft = child;
+        i += child->label_length;
+    }
+    size_t number_length = i - rft->label_length + rftDepth(rft) + 1;
+    if (removal->number_max < number_length) {
+        char *number = realloc(removal->number, 2*number_length);
+        if (number == NULL) {
+            free(path);
+            return;
+        }
+        removal->number = number;
+        removal->number_max = 2*number_length;
+    }
+    for (int j = 0; j < depth; j++) { // readers keep seeing the old path
+        RedsFromTo *copy = rftWritable(pf, path[j]);
+        if (copy == NULL) { // the copies made so far replace the nodes they copy
+            free(path);
+            return;
+        }
+        path[j] = copy;
+        if (j == 0)
+            pf->reds_from_to = copy;
+        else
+            childSetPut(pf->store->child_arenas, &path[j-1]->children, get_digit(copy->label, 0), copy);
+    }
+    childSetPut(pf->store->child_arenas, &path[depth-1]->children, index, NULL);
+    memcpy(removal->number, num, length);
+    rftCollect(pf, rft, i - rft->label_length, removal);
+    rftPrune(pf, path, depth);
+    free(path);
+}
+
+void phfwdRemove(PhoneForward *pf, char const *num) {
+    if (pf != NULL && is_string_a_number(num)) {
+        frozenThaw(pf);
+        Removal removal = {NULL, 0, 0, NULL, 0};
+        writerBegin(pf);
+        rftRemovePrefix(pf, num, &removal);
+        rtfApplyRules(pf, removal.rules, removal.count, false);
+        writerEnd(pf);
+        free(removal.rules);
+        free(removal.number);
+    }
+}
+
+bool phfwdBegin(PhoneForward *pf) {
+    if (pf == NULL || pf->transaction)
+        return false;
+    pf->transaction = true;
+    return true;
+}
+
+/** @brief Dopisuje operację do transakcji.
+ * Kopiuje numery do jednego bloku pamięci.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] num1 - wskaźnik na numer "od" albo usuwany prefiks.
+ * @param[in] num2 - wskaźnik na numer "do" albo NULL.
+ * @return @p true, jeśli operacja została zapamiętana, @p false, jeśli
+ *         zabrakło pamięci.
+*/
+static bool stagedAdd(PhoneForward *pf, char const *num1, char const *num2) {
+    if (pf->staged_count == pf->staged_max) {
+        size_t max = pf->staged_max > 0 ? 2*pf->staged_max : BASIC_ARRAY_LENGTH;
+        StagedOperation *staged = realloc(pf->staged, max*sizeof(StagedOperation));
+        if (staged == NULL)
+            return false;
+        pf->staged = staged;
+        pf->staged_max = max;
+    }
+    size_t length1 = strlen(num1) + 1;
+    size_t length2 = num2 != NULL ? strlen(num2) + 1 : 0;
+    char *block = malloc(length1 + length2);
+    if (block == NULL)
+        return false;
+    memcpy(block, num1, length1);
+    if (num2 != NULL)
+        memcpy(block + length1, num2, length2);
+    pf->staged[pf->staged_count++] = (StagedOperation){block, num2 != NULL ? block + length1 : NULL};
+    return true;
+}
+
+bool phfwdStageAdd(PhoneForward *pf, char const *num1, char const *num2) {
+    if (pf == NULL || !pf->transaction || !is_string_a_number(num1) || !is_string_a_number(num2) || strcmp(num1, num2) == 0)
+        return false;
+    return stagedAdd(pf, num1, num2);
+}
+
+bool phfwdStageRemove(PhoneForward *pf, char const *num) {
+    if (pf == NULL || !pf->transaction || !is_string_a_number(num))
+        return false;
+    return stagedAdd(pf, num, NULL);
+}
+
+/** @brief Dodaje przekierowanie do RedsFromTo.
+ * Zmiany struktury RedsToFrom, czyli usunięcie zastępowanego
+ * przekierowania i dodanie nowego, dopisuje do @p removal.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] from - wskaźnik na numer "od".
+ * @param[in] to - wskaźnik na numer "do".
+ * @param[in] length1 - długość numeru @p from.
+ * @param[in] length2 - długość numeru @p to.
+ * @param[in, out] removal - wskaźnik na stan zbierania zmian.
+ * @return Wartość @p false, jeśli nie udało się zaalokować pamięci; wtedy
+ *         przekierowanie nie zostało dodane.
+*/
+static bool rftAddCollect(PhoneForward *pf, char const *from, char const *to, size_t length1, size_t length2, Removal *removal) {
+    char *replaced = NULL;
+    if (addToRFT(pf, from, to, length1, length2, &replaced) == NULL)
+        return false;
+    if (replaced != NULL)
+        removal_add(pf, removal, replaced, from, length1, false);
+    char *target = internGet(&pf->store->numbers, to, length2);
+    if (target != NULL)
+        removal_add(pf, removal, target, from, length1, true);
+    return true;
+}
+
+bool phfwdCommit(PhoneForward *pf) {
+    if (pf == NULL || !pf->transaction)
+        return false;
+    if (pf->staged_count > 0) {
+        frozenThaw(pf);
+        Removal removal = {NULL, 0, 0, NULL, 0};
+        writerBegin(pf); // readers see either none or all of the operations
+        for (size_t i = 0; i < pf->staged_count; i++) {
+            StagedOperation *operation = &pf->staged[i];
+            if (operation->num2 == NULL) {
+                rftRemovePrefix(pf, operation->num1, &removal);
+                continue;
+            }
+            rftAddCollect(pf, operation->num1, operation->num2, strlen(operation->num1), strlen(operation->num2), &removal);
+        }
+        rtfApplyRules(pf, removal.rules, removal.count, false);
+        writerEnd(pf);
+        free(removal.rules);
+        free(removal.number);
+    }
+    stagedClear(pf);
+    return true;
+}
+
+void phfwdAbort(PhoneForward *pf) {
+    if (pf != NULL)
+        stagedClear(pf);
+}
+
+/**
+ * Przekierowanie dodawane przez @ref phfwdAddBulk.
+ */
+struct BulkRule {
+    /**
+    * Numer "od".
+    */
+    char const *from;
+    /**
+    * Numer "do".
+    */
+    char const *to;
+    /**
+    * Długość numeru @p from.
+    */
+    size_t length1;
+    /**
+    * Długość numeru @p to.
+    */
+    size_t length2;
+    /**
+    * Pozycja przekierowania w danych wejściowych.
+    */
+    size_t order;
+    /**
+    * Pierwsze cyfry numeru @p from, po cztery bity na cyfrę, jako liczba
+    * porządkująca numery tak jak strcmp (zob. @ref bulk_rule_key).
+    */
+    uint64_t key;
+};
+
+/**
+ * typedef dla struktury BulkRule, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct BulkRule BulkRule;
 
-/** @brief Funkcja alokująca strukturę RedsFromTo.
- * Funkcja alokuje pamięc i zwraca wskaźnik na strukturę
- * RedsFromTo, która musi potem zostać zwolniona funkcją
- * @ref rftDelete.
- * @return Wskaźnik na nowo utworzoną strukturę.
+/** @brief Zwraca klucz dodawanego przekierowania do sortowania pozycyjnego.
+ * @param[in] rule - wskaźnik na przekierowanie.
+ * @return Klucz przekierowania.
 */
-RedsFromTo *rftNew() {
-    RedsFromTo *new = malloc(sizeof(RedsFromTo));
-    if (new == NULL) return NULL;
-    new->redirection = NULL;
-    for (int i = 0; i < COUNT_OF_NUMBERS; i++)
-        new->children[i] = NULL;
-    return new;
+static uint64_t bulk_rule_key(void const *rule) {
+    return ((BulkRule const *)rule)->key;
 }
 
-/** @brief Funkcja alokująca strukturę RedsToFrom.
- * Funkcja alokuje pamięc i zwraca wskaźnik na strukturę
- * RedsToFrom, która musi potem zostać zwolniona funkcją
- * @ref rtfDelete.
- * @return Wskaźnik na nowo utworzoną strukturę.
+/** @brief Porównuje dodawane przekierowania.
+ * Funkcja przekazywana do qsort, porządkuje przekierowania według numeru
+ * "od", a przekierowania o tym samym numerze według pozycji w danych.
+ * @param[in] a - wskaźnik na pierwsze przekierowanie.
+ * @param[in] b - wskaźnik na drugie przekierowanie.
+ * @return Liczba ujemna, zero lub dodatnia, gdy pierwsze przekierowanie jest
+ *         odpowiednio mniejsze, równe lub większe od drugiego.
 */
-RedsToFrom *rtfNew() {
-    RedsToFrom *new = malloc(sizeof(RedsToFrom));
-    if (new == NULL) return NULL;
-    new->redirections = NULL;
-    for (int i = 0; i < COUNT_OF_NUMBERS; i++)
-        new->children[i] = NULL;
-    return new;
-}
-
-PhoneForward *phfwdNew() {
-	PhoneForward *new = malloc(sizeof(PhoneForward));
-	if (new == NULL) return NULL;
-    new->reds_from_to = rftNew();
-    new->reds_to_from = rtfNew();
-    if (new->reds_from_to == NULL || new->reds_to_from == NULL) 
-        return NULL;
-    return new;  
+static int compare_bulk_rules(void const *a, void const *b) {
+    BulkRule const *x = a, *y = b;
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    int result = x->length1 > KEY_DIGITS || y->length1 > KEY_DIGITS ? strcmp(x->from + KEY_DIGITS, y->from + KEY_DIGITS) : 0; // equal keys of short numbers mean equal numbers
+    if (result != 0)
+        return result;
+    return x->order < y->order ? -1 : x->order > y->order;
 }
 
-void phnumDelete(PhoneNumbers const *pnum) {
-    if (pnum != NULL) {
-        for (size_t i = 0; i < pnum->current_length; i++) 
-            free(pnum->array_of_numbers[i]);
-        free(pnum->array_of_numbers);
-        free((void*)pnum);
+/** @brief Buduje poddrzewo RedsFromTo z posortowanych przekierowań.
+ * Węzły powstają od razu z ostatecznymi etykietami, bez dzielenia krawędzi:
+ * wspólny prefiks grupy numerów to wspólny prefiks jej pierwszego
+ * i ostatniego numeru. Zmiany struktury RedsToFrom dopisuje do @p removal.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in, out] rft - wskaźnik na pusty węzeł odpowiadający pierwszym
+ *                       @p depth cyfrom numerów.
+ * @param[in] rules - przekierowania o różnych numerach "od", posortowane.
+ * @param[in] count - liczba przekierowań.
+ * @param[in] depth - długość numeru węzła @p rft.
+ * @param[in, out] removal - wskaźnik na stan zbierania zmian.
+ * @return Wartość @p false, jeśli nie udało się zaalokować pamięci.
+*/
+static bool rftBuild(PhoneForward *pf, RedsFromTo *rft, BulkRule const *rules, size_t count, size_t depth, Removal *removal) {
+    size_t first = 0;
+    if (count > 0 && rules[0].length1 == depth) { // the number of the node itself comes first
+        rft->redirection = internGet(&pf->store->numbers, rules[0].to, rules[0].length2);
+        if (rft->redirection == NULL)
+            return false;
+        internRetain(rft->redirection); // one reference for the node, one for RedsToFrom
+        removal_add(pf, removal, rft->redirection, rules[0].from, depth, true);
+        first = 1;
+    }
+    while (first < count) {
+        size_t last = first + 1;
+        while (last < count && rules[last].from[depth] == rules[first].from[depth])
+            last++;
+        char const *a = rules[first].from, *b = rules[last-1].from;
+        size_t limit = depth + LABEL_LENGTH;
+        if (rules[first].length1 < limit)
+            limit = rules[first].length1;
+        size_t common = depth + 1;
+        while (common < limit && a[common] == b[common])
+            common++;
+        RedsFromTo *child = rftNew(pf);
+        if (child == NULL)
+            return false;
+        child->label_length = common - depth;
+        for (size_t i = depth; i < common; i++)
+            set_digit(child->label, i - depth, CHAR_TO_NUMBER(a[i]));
+        childSetPut(pf->store->child_arenas, &rft->children, CHAR_TO_NUMBER(a[depth]), child);
+        if (!rftBuild(pf, child, &rules[first], last - first, common, removal))
+            return false;
+        first = last;
     }
+    return true;
 }
 
-/** @brief Usuwa strukturę.
- * Usuwa strukturę wskazywaną przez @p rft. Nic nie robi, jeśli wskaźnik ten ma
- * wartość NULL.
- * @param[in] rft – wskaźnik na usuwaną strukturę.
- */
-void rftDelete(RedsFromTo *rft) {
-    if (rft != NULL) {
-        if (rft->redirection != NULL)
-            free(rft->redirection);
-        for (int i = 0; i < COUNT_OF_NUMBERS; i++)
-            rftDelete(rft->children[i]);
-        free(rft);
+bool phfwdAddBulk(PhoneForward *pf, char const * const *num1, char const * const *num2, size_t count) {
+    if (pf == NULL || (count > 0 && (num1 == NULL || num2 == NULL)))
+        return false;
+    for (size_t i = 0; i < count; i++)
+        if (!is_string_a_number(num1[i]) || !is_string_a_number(num2[i]) || strcmp(num1[i], num2[i]) == 0)
+            return false;
+    if (count == 0)
+        return true;
+    BulkRule *rules = malloc(count*sizeof(BulkRule));
+    if (rules == NULL)
+        return false;
+    for (size_t i = 0; i < count; i++) {
+        rules[i] = (BulkRule){num1[i], num2[i], strlen(num1[i]), strlen(num2[i]), i, 0};
+        for (size_t j = 0; j < KEY_DIGITS; j++) // digits are shifted by one, so a shorter number comes first
+            rules[i].key = rules[i].key << 4 | (j < rules[i].length1 ? CHAR_TO_NUMBER(num1[i][j]) + 1 : 0);
+    }
+    if (radix_sort(rules, count, sizeof(BulkRule), bulk_rule_key)) {
+        for (size_t first = 0, last; first < count; first = last) { // only numbers longer than the key are not in order yet
+            bool long_numbers = false;
+            for (last = first; last < count && rules[last].key == rules[first].key; last++)
+                long_numbers |= rules[last].length1 > KEY_DIGITS;
+            if (long_numbers)
+                qsort(&rules[first], last - first, sizeof(BulkRule), compare_bulk_rules);
+        }
     }
+    else qsort(rules, count, sizeof(BulkRule), compare_bulk_rules);
+    size_t unique = 0;
+    for (size_t i = 0; i < count; i++) { // of rules with the same number the last one is kept, as after phfwdAdd one by one
+        if (unique > 0 && strcmp(rules[unique-1].from, rules[i].from) == 0)
+            unique--;
+        rules[unique++] = rules[i];
+    }
+    frozenThaw(pf);
+    internReserve(&pf->store->numbers, unique);
+    Removal removal = {malloc(unique*sizeof(RuleChange)), 0, unique, NULL, 0};
+    if (removal.rules == NULL)
+        removal.max = 0;
+    bool result = true;
+    writerBegin(pf);
+    if (childSetCount(&pf->reds_from_to->children) == 0) { // an empty base is built from scratch
+        arenaReserve(&pf->store->rft_arena, unique);
+        RedsFromTo *root = rftWritable(pf, pf->reds_from_to);
+        if (root != NULL)
+            pf->reds_from_to = root;
+        result = root != NULL && rftBuild(pf, root, rules, unique, 0, &removal);
+    }
+    else {
+        for (size_t i = 0; i < unique; i++)
+            result = rftAddCollect(pf, rules[i].from, rules[i].to, rules[i].length1, rules[i].length2, &removal) && result;
+    }
+    rtfApplyRules(pf, removal.rules, removal.count, true); // rules were collected in order of their numbers
+    writerEnd(pf);
+    free(removal.rules);
+    free(rules);
+    return result;
 }
 
-/** @brief Usuwa strukturę.
- * Usuwa strukturę wskazywaną przez @p rtf. Nic nie robi, jeśli wskaźnik ten ma
- * wartość NULL.
- * @param[in] rtf – wskaźnik na usuwaną strukturę.
+/** @brief Tworzy nowe przekierowanie.
+ * Funkcja bierze spakowany prefix @p to oraz sufix @p end i tworzy nowy
+ * string, łączący oba numery.
+ * @param[in] to - wskaźnik na spakowany numer reprezentujący prefix.
+ * @param[in] end - wskaźnik na napis reprezentujący sufix.
+ * @return Wskaźnik na napis reprezentujący połączone numery.
  */
-void rtfDelete(RedsToFrom *rtf) {
-    if (rtf != NULL) {
-        phnumDelete(rtf->redirections);
-        for (int i = 0; i < COUNT_OF_NUMBERS; i++)
-            rtfDelete(rtf->children[i]);
-        free(rtf);
-    }
+char *create_redirection(char const *to, const char *end) {
+    unsigned char const *digits;
+    size_t j = packed_length(to, &digits);
+    size_t size = strlen(end) + j;
+    char *result = malloc((size + 1) * sizeof(char));
+    unpack_number(to, result);
+    memcpy(&result[j], end, size - j + 1); // copying "end" together with '\0'
+    return result;
 }
 
-void phfwdDelete(PhoneForward *pf) {
-    if (pf != NULL) {
-        rftDelete(pf->reds_from_to);
-        rtfDelete(pf->reds_to_from);
-        free(pf);
+/** @brief Porównuje dwóch kandydatów do wyniku @ref phfwdReverse.
+ * Kandydatem jest spakowany numer z dopisanym sufiksem. Porządek jest taki
+ * sam jak porządek funkcji strcmp na połączonych napisach.
+ * @param[in] a - wskaźnik na pierwszy spakowany numer.
+ * @param[in] a_suffix - wskaźnik na sufiks pierwszego kandydata.
+ * @param[in] b - wskaźnik na drugi spakowany numer.
+ * @param[in] b_suffix - wskaźnik na sufiks drugiego kandydata.
+ * @return Liczba ujemna, zero lub dodatnia, gdy pierwszy kandydat jest
+ *         odpowiednio mniejszy, równy lub większy od drugiego.
+*/
+static int compare_candidates(char const *a, char const *a_suffix, char const *b, char const *b_suffix) {
+    unsigned char const *digits_a, *digits_b;
+    size_t length_a = packed_length(a, &digits_a);
+    size_t length_b = packed_length(b, &digits_b);
+    for (size_t i = 0; ; i++) { // the end of a candidate is -1, below every digit
+        int x = i < length_a ? get_digit(digits_a, i) : a_suffix[i - length_a] != '\0' ? CHAR_TO_NUMBER(a_suffix[i - length_a]) : -1;
+        int y = i < length_b ? get_digit(digits_b, i) : b_suffix[i - length_b] != '\0' ? CHAR_TO_NUMBER(b_suffix[i - length_b]) : -1;
+        if (x != y || x < 0)
+            return x - y;
     }
 }
 
-
-/**
- * Funkcja sprawdzająca czy napis jest numerem.
- * @param[in] num - wskaźnik na napis.
- * @return @p true jeśli napis jest numerem,
-           @p false w przeciwnym razie.
+/** @brief Ustawia pozycję na pierwszym numerze B+ drzewa większym od
+ * podanego.
+ * @param[out] cursor - wskaźnik na pozycję.
+ * @param[in] root - wskaźnik na korzeń drzewa albo NULL.
+ * @param[in] num - wskaźnik na napis reprezentujący numer.
 */
-bool is_string_a_number(const char *num) {
-    if (num == NULL) return false;
-    int length = strlen(num);
-    if (length == 0) return false;
-    for(int i = 0; i < length; i++) 
-        if (!is_number(num[i])) return false;
-    return true;
+static void sourceCursorSeek(SourceCursor *cursor, SourceNode const *root, char const *num) {
+    cursor->depth = -1;
+    for (SourceNode const *node = root; node != NULL; ) {
+        int i = source_position(node, num, compare_packed_string);
+        cursor->depth++;
+        cursor->path[cursor->depth] = node;
+        if (node->height == 0) {
+            if (i < node->count && compare_packed_string(node->keys[i], num) == 0)
+                i++;
+            if (i == node->count) { // the successor is in a later leaf
+                cursor->index[cursor->depth] = i - 1;
+                sourceCursorNext(cursor);
+            }
+            else
+                cursor->index[cursor->depth] = i;
+            return;
+        }
+        cursor->index[cursor->depth] = i;
+        node = node->children[i];
+    }
 }
 
-/** Funkcja wyszukuje indeks w tablicy do wstawienia numeru.
- * Funkcja, za pomocą binary search, wyszukuje indeks w tablicy
- * numerów, na który można wstawić numer, tak, żeby zachować
- * posortowanie tablicy.
- * @param[in] pnum - wskaźnik na strukturę przechowującą
- *                  numery.
- * @param[in] num - wskaźnik na napis, który wstawiamy.
- * @return Indeks w który można wstawić numer.
+/** @brief Wyszukuje numer "od" w zamrożonej postaci.
+ * @param[in] stream - wskaźnik na ciąg kandydatów zamrożonej postaci.
+ * @param[in] num - wskaźnik na napis reprezentujący numer.
+ * @param[in] upper - czy szukamy pierwszego numeru większego od @p num
+ *                    (zamiast nie mniejszego).
+ * @return Indeks znalezionego numeru albo liczba numerów, jeśli go nie ma.
 */
-int find_index_to_insert_into(PhoneNumbers *pnum, char *num) {
-    if (pnum->current_length == 0)
-        return 0;
-    int i = 0;
-    int j = pnum->current_length -1;
-    int m;
+static size_t frozen_source_bound(ReverseStream const *stream, char const *num, bool upper) {
+    size_t i = 0;
+    size_t j = stream->count;
     while (i < j) {
-        m = (i+j+1)/2;
-        if (strcmp(pnum->array_of_numbers[m], num) <= 0)
-            i = m;
+        size_t m = (i+j)/2;
+        int result = compare_packed_string(stream->pool + stream->offsets[m], num);
+        if (result < 0 || (upper && result == 0))
+            i = m+1;
         else
-            j = m -1;
-    }
-    m = strcmp(pnum->array_of_numbers[i], num);
-    if (m == 0)
-        return -1;
-    else if (i == 0 && m > 0)
-        return i;
-    else
-        return i+1;
-}
-
-/** @brief Funkcja przesuwająca tablicę o jeden w prawo.
- * Funkcja przesuwa tablicę zawierającą wskaźniki na napisy
- * o jeden w prawo, aby można było wprowadzić do tej tablicy nowy napis
- * w odpowiednim miejscu.
- * @param[in] array - wskaźnik na tablicę.
- * @param[in] index - indeks od którego tablica ma zostać przesunięta w prawo.
- * @param[in] current_length - bieżąca długość tablicy.
-*/
-static void move_array_of_strings_right(char **array, int index, int current_length) {
-    char *tmp = array[index];
-    for (int i = index+1; i <= current_length; i++) {
-        char *tmp2 = array[i];
-        array[i] = tmp;
-        tmp = tmp2;
-    }
-}
-
-/** @brief Funkcja wstawiająca numer w tablicę numerów.
- * Funkcja wstawia numer @p num w tablicę numerów, tak,
- * żeby zachować posortowanie tablicy.
- * @param[in] pnum - wskaźnik na strukturę przechowującą
- *                  numery.
- * @param[in] num - wskaźnik na napis, który wstawiamy.
-*/
-void insert_into_array_of_numbers(PhoneNumbers *pnum, char *num) {
-    int index = find_index_to_insert_into(pnum, num);
-    if (index >=0) {
-        if (pnum->current_length == pnum->max_length) {
-            pnum->array_of_numbers = realloc(pnum->array_of_numbers, 2*pnum->max_length*sizeof(char*));
-            pnum->max_length *= 2;
-            for (size_t j = pnum->current_length; j < pnum->max_length; j++)
-                pnum->array_of_numbers[j] = NULL;
-        }
-        if ((size_t)index != pnum->current_length)
-            move_array_of_strings_right(pnum->array_of_numbers, index, pnum->current_length);
-        pnum->array_of_numbers[index] = num;
-        pnum->current_length += 1;
-    }
-    else if (num != NULL)
-        free(num);
-}
-
-/** @brief Funkcja wyszukująca indeks numeru w tablicy.
- * Funkcja wyszukuje napis @p num w tablicy numerów, korzystając
- * z binary search. Jeśli numeru nie ma w tablicy, funkcja zwraca -1.
- *  * @param[in] pnum - wskaźnik na strukturę przechowującą
- *                  numery.
- * @param[in] num - wskaźnik na napis, którego szukamy.
- * @return Indeks numeru w tablicy, albo -1 jeśli tego numeru w tablicy nie ma.
-*/
-static int find_index_of_number(PhoneNumbers *pnum, char const *num) {
-    if (pnum->current_length == 0) return -1;
-    int i = 0;
-    int j = pnum->current_length - 1;
-    int m;
-    while (i < j) {
-        m = (i+j+1)/2;
-        if (strcmp(pnum->array_of_numbers[m], num) <= 0) i = m;
-        else j = m - 1;
+            j = m;
     }
-    if (strcmp(pnum->array_of_numbers[i], num) == 0) return i;
-    else return -1;
+    return i;
 }
 
-/** @brief Funkcja przesuwająca tablicę o jeden w lewo.
- * Funkcja przesuwa tablicę zawierającą wskaźniki na napisy
- * o jeden w lewo, aby zachować jedność tablicy po usunięciu jednego elementu
- * ze środka.
- * @param[in] array - wskaźnik na tablicę.
- * @param[in] index - indeks od którego tablica ma zostać przesunięta w lewo.
- * @param[in] current_length - bieżąca długość tablicy.
+/** @brief Zwraca pierwszy nieprzeczytany numer "od" ciągu kandydatów.
+ * @param[in] stream - wskaźnik na ciąg kandydatów.
+ * @return Wskaźnik na spakowany numer albo NULL, gdy numery się skończyły.
 */
-static void move_array_of_strings_left(char **array, int index, int current_length) {
-    for (int i = index; i < current_length -1; i++)
-        array[i] = array[i+1];
+static inline char const *reverseUnread(ReverseStream const *stream) {
+    if (stream->offsets != NULL)
+        return stream->next < stream->count ? stream->pool + stream->offsets[stream->next] : NULL;
+    return sourceCursorGet(&stream->cursor);
 }
 
-/** @brief Funkcja usuwająca przekierowanie z tablicy przekierowań.
- * Funkcja usuwa numer @p num z tablicy numerów.
- * Numer ten reprezentuje przekierowanie "od".
- * @param[in] pnum - wskaźnik na strukturę przechowującą
- *                  numery.
- * @param[in] num - wskaźnik na napis, który usuwamy.
+/** @brief Zwraca numer "od" najmniejszego gotowego kandydata.
+ * @param[in] stream - wskaźnik na ciąg kandydatów.
+ * @return Wskaźnik na spakowany numer albo NULL, gdy ciąg się skończył.
 */
-void delete_redirection(PhoneNumbers *pnum, char const *num) {
-    int index = find_index_of_number(pnum, num);
-    if (index >= 0) {
-        free(pnum->array_of_numbers[index]);
-        pnum->array_of_numbers[index] = NULL;
-        if ((size_t)index < pnum->current_length -1) {
-            move_array_of_strings_left(pnum->array_of_numbers, index, pnum->current_length);
-            pnum->array_of_numbers[pnum->current_length-1] = NULL;
-        }
-        pnum->current_length -= 1;
+static inline char const *reverseHead(ReverseStream const *stream) {
+    return stream->pending_count > 0 ? stream->pending[stream->pending_count-1] : NULL;
+}
 
+/** @brief Odkłada przeczytany numer "od" do zwrócenia.
+ * @param[in, out] stream - wskaźnik na ciąg kandydatów.
+ * @param[in] source - wskaźnik na spakowany numer.
+ * @return @p true, jeśli się udało, @p false, gdy nie udało się
+ *         zaalokować pamięci.
+*/
+static bool reversePend(ReverseStream *stream, char const *source) {
+    if (stream->pending_count == stream->pending_max) {
+        char const **pending = malloc(2*stream->pending_max*sizeof(char const *));
+        if (pending == NULL)
+            return false;
+        memcpy(pending, stream->pending, stream->pending_count*sizeof(char const *));
+        if (stream->pending != stream->inline_pending)
+            free(stream->pending);
+        stream->pending = pending;
+        stream->pending_max *= 2;
     }
+    size_t i = stream->pending_count++;
+    while (i > 0 && compare_candidates(stream->pending[i-1], stream->suffix, source, stream->suffix) < 0) {
+        stream->pending[i] = stream->pending[i-1];
+        i--;
+    }
+    stream->pending[i] = source;
+    return true;
 }
 
-/** @brief Funkcja usuwająca przekierowanie ze struktury RedsToFrom.
- * Funkcja usuwa przekierowanie na numer @p num z numeru @p num2.
- * @param[in] rtf - wskaźnik na strukturę przechowującą przekierowania do-od.
- * @param[in] num - wskaźnik na przekierowanie "do".
- * @parm[in] num2 - wskaźnik na przekierowanie "od".
+/** @brief Czyta numery "od", aż najmniejszy kandydat będzie gotowy.
+ * Numery "od" są posortowane, ale po dopisaniu sufiksu porządek może się
+ * zmienić, gdy jeden numer "od" jest prefiksem innego, np. "1" i "12"
+ * z sufiksem "5" dają "15" > "125". Każdy kandydat jest jednak nie mniejszy
+ * od swojego numeru "od", więc kandydat nie większy od pierwszego
+ * nieprzeczytanego numeru jest mniejszy od wszystkich dalszych kandydatów.
+ * @param[in, out] stream - wskaźnik na ciąg kandydatów.
+ * @return @p true, jeśli się udało, @p false, gdy nie udało się
+ *         zaalokować pamięci.
 */
-void removeFromRTF(RedsToFrom *rtf, char const *num, char const *num2) {
-    int length = strlen(num);
-    int index;
-    for (int i = 0; i < length; i++) {
-        index = CHAR_TO_NUMBER(num[i]);
-        rtf = rtf->children[index];
-    }
-    delete_redirection(rtf->redirections, num2);
-    if (rtf->redirections->current_length == 0) {
-        phnumDelete(rtf->redirections);
-        rtf->redirections = NULL;
+static bool reverseStreamFill(ReverseStream *stream) {
+    char const *unread;
+    while ((unread = reverseUnread(stream)) != NULL
+           && (stream->pending_count == 0 || compare_candidates(reverseHead(stream), stream->suffix, unread, "") > 0)) {
+        if (!reversePend(stream, unread))
+            return false;
+        if (stream->offsets != NULL)
+            stream->next++;
+        else
+            sourceCursorNext(&stream->cursor);
     }
+    return true;
 }
 
-/** @brief Funkcja dodająca przekierowanie do struktury RedsFromTo.
- * Funkcja dodaje przekierowanie z numeru @p from na numer @p to
- * do struktury RedsFromTo.
- * @param[in] rft - wskaźnik na strukturę do której dodajemy przekierowanie.
- * @param[in] from - wskaźnik na napis reprezentujący numer z którego jest
- *                   przekierowanie.
- * @param[in] to - wskaźnik na napis reprezentujący numer na który jest
-                   przekierowanie.
- * @param[in] length1 - długość numeru @p from.
- * @param[in] length2 - długość numeru @p to.
+/** @brief Ustawia ciąg kandydatów na pierwszym kandydacie większym od
+ * podanego numeru.
+ * Oprócz numerów "od" większych od @p after mogą to być tylko prefiksy
+ * @p after, których wyszukuje się pojedynczo.
+ * @param[in, out] stream - wskaźnik na ciąg kandydatów.
+ * @param[in, out] after - wskaźnik na napis reprezentujący numer albo NULL,
+ *                         jeśli ciąg ma się zaczynać od pierwszego
+ *                         kandydata; napis jest chwilowo modyfikowany.
+ * @return @p true, jeśli się udało, @p false, gdy nie udało się
+ *         zaalokować pamięci.
 */
-void addToRFT(RedsFromTo *rft, RedsToFrom *rtf, char const *from, char const *to, int length1, int length2) {
-// length1 is length of num1 and length2 is length of num2
-    int index;
-    for (int i = 0; i < length1; i++) {
-        index = CHAR_TO_NUMBER(from[i]);
-        if (rft->children[index] == NULL)
-            rft->children[index] = rftNew();
-        rft = rft->children[index];
+static bool reverseStreamStart(ReverseStream *stream, char *after) {
+    stream->pending = stream->inline_pending;
+    stream->pending_count = 0;
+    stream->pending_max = REVERSE_PENDING;
+    if (after == NULL) {
+        stream->next = 0;
+        if (stream->offsets == NULL)
+            sourceCursorFirst(&stream->cursor, stream->root);
+        return reverseStreamFill(stream);
     }
-    if (rft->redirection != NULL) {
-        removeFromRTF(rtf, rft->redirection, from);
-        free(rft->redirection);
+    size_t length = strlen(after);
+    for (size_t i = 0; i <= length; i++) {
+        if (strcmp(stream->suffix, &after[i]) <= 0)
+            continue; // the prefix of length i would give a candidate not greater than after
+        char digit = after[i];
+        after[i] = '\0';
+        char const *source;
+        if (stream->offsets != NULL) {
+            size_t index = frozen_source_bound(stream, after, false);
+            source = index < stream->count && compare_packed_string(stream->pool + stream->offsets[index], after) == 0
+                     ? stream->pool + stream->offsets[index] : NULL;
+        }
+        else
+            source = sourcesFind(stream->root, after, compare_packed_string);
+        after[i] = digit;
+        if (source != NULL && !reversePend(stream, source))
+            return false;
     }
-    rft->redirection = malloc(sizeof(char) * (length2+1));
-    strcpy(rft->redirection, to);
+    if (stream->offsets != NULL)
+        stream->next = frozen_source_bound(stream, after, true);
+    else
+        sourceCursorSeek(&stream->cursor, stream->root, after);
+    return reverseStreamFill(stream);
+}
+
+/** @brief Zwalnia pamięć ciągu kandydatów.
+ * @param[in, out] stream - wskaźnik na ciąg kandydatów.
+*/
+static void reverseStreamEnd(ReverseStream *stream) {
+    if (stream->pending != stream->inline_pending)
+        free(stream->pending);
 }
 
+/** @brief Porównuje bieżących kandydatów dwóch ciągów.
+ * @param[in] a - wskaźnik na pierwszy ciąg.
+ * @param[in] b - wskaźnik na drugi ciąg.
+ * @return Wynik @ref compare_candidates dla bieżących kandydatów.
+*/
+static inline int reverseStreamCompare(ReverseStream const *a, ReverseStream const *b) {
+    return compare_candidates(reverseHead(a), a->suffix, reverseHead(b), b->suffix);
+}
 
-/** @brief Funkcja dodająca przekierowanie do struktury RedsToFrom.
- * Funkcja dodaje przekierowanie z numeru @p from na numer @p to
- * do struktury RedsToFrom.
- * @param[in] rtf - wskaźnik na strukturę do której dodajemy przekierowanie.
- * @param[in] from - wskaźnik na napis reprezentujący numer z którego jest
- *                   przekierowanie.
- * @param[in] to - wskaźnik na napis reprezentujący numer na który jest
-                   przekierowanie.
- * @param[in] length1 - długość numeru @p from.
- * @param[in] length2 - długość numeru @p to.
+/** @brief Przywraca własność kopca od podanego miejsca w dół.
+ * @param[in, out] heap - kopiec ciągów, z najmniejszym kandydatem na szczycie.
+ * @param[in] count - liczba ciągów w kopcu.
+ * @param[in] i - indeks ciągu, który mógł przestać spełniać własność kopca.
 */
-void addToRTF(RedsToFrom *rtf, char const *from, char const *to, int length1, int length2) {
-    int index;
-    for (int i = 0; i < length2; i++) {
-        index = CHAR_TO_NUMBER(to[i]);
-        if (rtf->children[index] == NULL)
-            rtf->children[index] = rtfNew();
-        rtf = rtf->children[index];
+static void reverse_sift_down(ReverseStream **heap, size_t count, size_t i) {
+    for (;;) {
+        size_t smallest = i;
+        for (size_t child = 2*i + 1; child <= 2*i + 2 && child < count; child++)
+            if (reverseStreamCompare(heap[child], heap[smallest]) < 0)
+                smallest = child;
+        if (smallest == i)
+            return;
+        ReverseStream *tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
     }
-    if (rtf->redirections == NULL)
-        rtf->redirections = declare_phone_numbers();
-    char *number = malloc((length1+1)*sizeof(char));
-    strcpy(number, from);
-    insert_into_array_of_numbers(rtf->redirections, number);
 }
 
-bool phfwdAdd(PhoneForward *pf, char const *num1, char const *num2) {
-    if (strcmp(num1, num2) == 0 || !is_string_a_number(num1) || !is_string_a_number(num2) || pf == NULL) 
-        return false;
-    int length1 = strlen(num1);
-    int length2 = strlen(num2);
-    addToRFT(pf->reds_from_to, pf->reds_to_from, num1, num2, length1, length2);
-    addToRTF(pf->reds_to_from, num1, num2, length1, length2);   
+/** @brief Dopisuje numer na koniec ciągu numerów.
+ * @param[in, out] pnum - wskaźnik na ciąg numerów.
+ * @param[in] num - wskaźnik na dopisywany napis.
+ * @return @p true, jeśli się udało, @p false, gdy nie udało się
+ *         zaalokować pamięci.
+*/
+static bool phnumAppend(PhoneNumbers *pnum, char *num) {
+    if (pnum->current_length == pnum->max_length) {
+        char **array = realloc(pnum->array_of_numbers, 2*pnum->max_length*sizeof(char*));
+        if (array == NULL)
+            return false;
+        pnum->array_of_numbers = array;
+        pnum->max_length *= 2;
+    }
+    pnum->array_of_numbers[pnum->current_length++] = num;
     return true;
 }
 
-
-/** @brief Funkcja usuwająca przekierowania ze struktury RedsFromTo.
- * Funkcja usuwa wszystkie przekierowania o prefiksie @p num ze struktury RedsFromTo.
- * Funkcja dodatkowo uaktualnia napis @p num, tak aby rekurencyjne wywołania funkcji
- * usuwały numery z poprawnym prefiksem.
- * @param[in] rft - wskaźnik na strukturę przechowującą przekierowania od-do.
- * @param[in] rtf - wskaźnik na strukturę przechowującą przekierowania do-od.
- * @param[in] current_index - aktualna długość @p num.
- * @param[in] max_index - maksymalna możliwa długość @p num.
- * @param[in] num - wskaźnik na prefiks.
- * @return Wskaźnik na uaktualniony napis @p num.
+/** @brief Scala ciągi kandydatów i przekazuje wynik funkcji @p visit.
+ * Kopiec o @p count ciągach daje kandydatów w porządku rosnącym.
+ * Powtórzenia są pomijane, a każdy numer jest składany w tym samym
+ * buforze.
+ * @param[in, out] streams - tablica rozpoczętych ciągów kandydatów.
+ * @param[in] count - liczba ciągów.
+ * @param[in] limit - największa liczba numerów, zero oznacza brak limitu.
+ * @param[in] visit - funkcja wywoływana dla kolejnych numerów.
+ * @param[in] data - wskaźnik przekazywany funkcji @p visit.
+ * @return @p true, jeśli się udało, @p false, gdy nie udało się
+ *         zaalokować pamięci.
 */
-char *removeFromRFT(RedsFromTo *rft, RedsToFrom *rtf, int current_index, int max_index, char *num) {
-    if (rft != NULL) {
-        if (current_index == max_index-2) {
-            num = realloc(num, (2*max_index+1));
-            max_index *= 2;
-        }
-        if (rft->redirection != NULL) {
-            removeFromRTF(rtf, rft->redirection, num);
-            free(rft->redirection);
-            rft->redirection = NULL;
-        }
-        for (int i = 0; i < COUNT_OF_NUMBERS; i++) {
-		    num[current_index] = i + '0';
-            num[current_index+1] = '\0';
-            num = removeFromRFT(rft->children[i], rtf, current_index+1, max_index, num);
+static bool reverse_merge(ReverseStream *streams, size_t count, size_t limit, bool (*visit)(char const *, void *), void *data) {
+    ReverseStream **heap = malloc(count * sizeof(ReverseStream *));
+    if (heap == NULL)
+        return false;
+    size_t heap_count = 0;
+    for (size_t i = 0; i < count; i++)
+        if (reverseHead(&streams[i]) != NULL)
+            heap[heap_count++] = &streams[i];
+    for (size_t i = heap_count; i-- > 0; )
+        reverse_sift_down(heap, heap_count, i);
+    char *buffer = NULL;
+    size_t capacity = 0;
+    size_t visited = 0;
+    bool result = true;
+    char const *last = NULL, *last_suffix = NULL;
+    while (result && heap_count > 0 && (limit == 0 || visited < limit)) {
+        ReverseStream *stream = heap[0];
+        char const *source = reverseHead(stream);
+        if (last == NULL || compare_candidates(last, last_suffix, source, stream->suffix) != 0) {
+            unsigned char const *digits;
+            size_t length = packed_length(source, &digits);
+            size_t size = length + strlen(stream->suffix) + 1;
+            if (size > capacity) {
+                char *larger = realloc(buffer, 2*size);
+                if (larger == NULL) {
+                    result = false;
+                    break;
+                }
+                buffer = larger;
+                capacity = 2*size;
+            }
+            unpack_number(source, buffer);
+            memcpy(&buffer[length], stream->suffix, size - length);
+            visited++;
+            if (!visit(buffer, data))
+                break;
+            last = source;
+            last_suffix = stream->suffix;
         }
+        stream->pending_count--;
+        result = reverseStreamFill(stream);
+        if (reverseHead(stream) == NULL)
+            heap[0] = heap[--heap_count];
+        reverse_sift_down(heap, heap_count, 0);
     }
-    return num;
+    free(buffer);
+    free(heap);
+    return result;
 }
-    
-  
-void phfwdRemove(PhoneForward *pf, char const *num) {
-    if (pf != NULL && is_string_a_number(num)) {
-        int length = strlen(num);
-        int index;
-        RedsFromTo *rft = pf->reds_from_to;
-        RedsToFrom *rtf = pf->reds_to_from;
-        for (int i = 0; i < length; i++) {
-            index = CHAR_TO_NUMBER(num[i]);
-            if (rft->children[index] != NULL)
-            	rft = rft->children[index];
-            else
-                return;
-        }
-	char *number = malloc(sizeof(char)*(2*length+1));
-	strcpy(number, num);
-    number = removeFromRFT(rft, rtf, length, 2*length +2, number);
-    free(number);
+
+/** @brief Zbiera ciągi kandydatów z zamrożonej postaci.
+ * @param[in] image - wskaźnik na zamrożoną postać.
+ * @param[in] num - wskaźnik na napis reprezentujący poprawny numer.
+ * @param[out] streams - tablica na co najmniej strlen(@p num) ciągów.
+ * @return Liczba zebranych ciągów.
+*/
+static size_t frozenReverseStreams(Frozen const *image, char const *num, ReverseStream *streams) {
+    FrozenRtf const *nodes = frozenRtf(image);
+    size_t count = 0;
+    uint32_t index = 0;
+    for (size_t i = 0; num[i] != '\0'; i++) {
+        index = frozenChild(nodes[index].first_child, nodes[index].bitmap, CHAR_TO_NUMBER(num[i]));
+        if (index == NO_OFFSET)
+            break;
+        if (nodes[index].source_count > 0)
+            streams[count++] = (ReverseStream){.offsets = frozenSources(image) + nodes[index].first_source, .pool = frozenPool(image),
+                                               .count = nodes[index].source_count, .suffix = &num[i+1]};
     }
+    return count;
 }
-    
-/** @brief Tworzy nowe przekierowanie.
- * Funkcja bierze prefix @p to oraz sufix @p end i tworzy nowy string,
- * łączący oba numery.
- * @param[in] to - wskaźnik na napis reprezentujący prefix.
- * @param[in] end - wskaźnik na napis reprezentujący sufix.
- * @return Wskaźnik na napis reprezentujący połączone numery.
- */
-char *create_redirection(char *to, const char *end) {
-    int i = 0;
-    int j = strlen(to);
-    int size = strlen(end) + j;
-    char *result = malloc((size + 1) * sizeof(char));
-    while (i < j) {
-        result[i] = to[i];
-        i++;
+
+/** @brief Zbiera ciągi kandydatów ze struktury RedsToFrom.
+ * @param[in] rtf - wskaźnik na korzeń struktury RedsToFrom.
+ * @param[in] num - wskaźnik na napis reprezentujący poprawny numer.
+ * @param[out] streams - tablica na co najmniej strlen(@p num) ciągów.
+ * @return Liczba zebranych ciągów.
+*/
+static size_t rtfReverseStreams(RedsToFrom *rtf, char const *num, ReverseStream *streams) {
+    size_t count = 0;
+    for (size_t i = 0; rtf != NULL && num[i] != '\0'; i++) {
+        rtf = childSetGet(&rtf->children, CHAR_TO_NUMBER(num[i]));
+        if (rtf != NULL && rtf->redirections != NULL)
+            streams[count++] = (ReverseStream){.root = rtf->redirections, .suffix = &num[i+1]};
     }
-    while (i < size) {
-        result[i] = end[i-j]; // i-j cause we need to start array "end" from 0
-        i++;
+    return count;
+}
+
+/** @brief Rozpoczyna wyszukiwanie przekierowania numeru.
+ * Ustawia stan na korzeniu i zleca pobranie do pamięci podręcznej
+ * węzła, do którego prowadzi pierwsza krawędź.
+ * @param[in] root - wskaźnik na korzeń struktury RedsFromTo.
+ * @param[out] lookup - wskaźnik na inicjalizowany stan.
+ * @param[in] num - wskaźnik na napis reprezentujący poprawny numer.
+*/
+static void lookupStart(RedsFromTo *root, Lookup *lookup, char const *num) {
+    lookup->num = num;
+    lookup->length = strlen(num);
+    lookup->position = 0;
+    lookup->end_of_redirection = 0;
+    lookup->candidate = NULL;
+    lookup->next = childSetGet(&root->children, CHAR_TO_NUMBER(num[0]));
+    PREFETCH(lookup->next);
+}
+
+/** @brief Przechodzi jedną krawędź trie.
+ * Sprawdza etykietę węzła @p lookup->next, zapamiętuje jego przekierowanie
+ * i wyznacza kolejny węzeł, zlecając pobranie go do pamięci podręcznej.
+ * @param[in, out] lookup - wskaźnik na stan wyszukiwania.
+ * @return @p true, jeśli wyszukiwanie trwa dalej, @p false w przeciwnym razie.
+*/
+static bool lookupStep(Lookup *lookup) {
+    RedsFromTo *rft = lookup->next;
+    int remaining = lookup->length - lookup->position;
+    lookup->next = NULL;
+    if (rft == NULL || common_label_length(rft, &lookup->num[lookup->position], remaining) < rft->label_length)
+        return false;
+    lookup->position += rft->label_length;
+    if (rft->redirection != NULL) {
+        lookup->end_of_redirection = lookup->position;
+        lookup->candidate = rft->redirection;
     }
-    result[i] = '\0';
-    return result;
+    if (lookup->position == lookup->length)
+        return false;
+    lookup->next = childSetGet(&rft->children, CHAR_TO_NUMBER(lookup->num[lookup->position]));
+    PREFETCH(lookup->next);
+    return lookup->next != NULL;
 }
 
-PhoneNumbers const * phfwdGet(PhoneForward *pf, char const *num) {
-    RedsFromTo *rft = pf->reds_from_to;
-    int length = strlen(num);
-    int index;
-    int i = 0;
-    int end_of_redirection = 0;
+/** @brief Tworzy wynik zakończonego wyszukiwania.
+ * @param[in] lookup - wskaźnik na stan zakończonego wyszukiwania.
+ * @return Wskaźnik na strukturę zawierającą przekierowany numer.
+*/
+static PhoneNumbers *lookupFinish(Lookup const *lookup) {
     PhoneNumbers *pnum = declare_phone_numbers();
-    if (!is_string_a_number(num))
-        return pnum;
-    bool max_redirection = false;
-	char *candidate = NULL;
-    while (!max_redirection && i < length) {
-        index = CHAR_TO_NUMBER(num[i]);
-        if (rft->children[index] == NULL)
-            max_redirection = true;
-        else {
-            rft = rft->children[index];
-            if (rft->redirection != NULL) {
-                end_of_redirection = i;
-                candidate = rft->redirection;
-            }
-        }
-        i++;
-    }
-    if (candidate != NULL) 
-        pnum->array_of_numbers[0] = create_redirection(candidate, &num[end_of_redirection+1]);
+    if (lookup->candidate != NULL) 
+        pnum->array_of_numbers[0] = create_redirection(lookup->candidate, &lookup->num[lookup->end_of_redirection]);
     else {
-        pnum->array_of_numbers[0] = malloc((length+1)*sizeof(char));
-        strcpy(pnum->array_of_numbers[0], num);
+        pnum->array_of_numbers[0] = malloc((lookup->length+1)*sizeof(char));
+        strcpy(pnum->array_of_numbers[0], lookup->num);
     }
     pnum->current_length += 1;
     return pnum;
 }
 
+/** @brief Wyszukuje przekierowanie numeru.
+ * Korzysta z zamrożonej postaci, jeśli istnieje. Wywołujący musi być
+ * zarejestrowany jako czytelnik (zob. @ref readerEnter).
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[out] lookup - wskaźnik na stan wyszukiwania.
+ * @param[in] num - wskaźnik na napis reprezentujący poprawny numer.
+*/
+static void lookupComplete(PhoneForward *pf, Lookup *lookup, char const *num) {
+    Frozen *image = atomic_load_explicit(&pf->frozen, memory_order_acquire);
+    if (image != NULL)
+        frozenLookup(image, lookup, num);
+    else {
+        lookupStart(atomic_load_explicit(&pf->rft_published, memory_order_acquire), lookup, num);
+        while (lookupStep(lookup))
+            ;
+    }
+}
+
+PhoneNumbers const * phfwdGet(PhoneForward *pf, char const *num) {
+    if (!is_string_a_number(num))
+        return declare_phone_numbers();
+    Lookup lookup;
+    ReaderSlot *slot = readerEnter(pf);
+    lookupComplete(pf, &lookup, num);
+    PhoneNumbers *pnum = lookupFinish(&lookup);
+    readerExit(slot);
+    return pnum;
+}
 
+size_t phfwdGetInto(PhoneForward *pf, char const *num, char *buffer, size_t size, size_t *prefix_length) {
+    size_t length = 0;
+    size_t matched = 0;
+    if (pf != NULL && is_string_a_number(num)) {
+        Lookup lookup;
+        ReaderSlot *slot = readerEnter(pf);
+        lookupComplete(pf, &lookup, num);
+        size_t suffix = lookup.length - lookup.end_of_redirection;
+        length = suffix;
+        if (lookup.candidate != NULL) {
+            unsigned char const *digits;
+            matched = lookup.end_of_redirection;
+            length += packed_length(lookup.candidate, &digits);
+        }
+        if (length < size) { // copying the suffix together with '\0'
+            size_t start = lookup.candidate != NULL ? unpack_number(lookup.candidate, buffer) : 0;
+            memcpy(&buffer[start], &num[lookup.end_of_redirection], suffix + 1);
+        }
+        else if (size > 0)
+            buffer[0] = '\0';
+        readerExit(slot);
+    }
+    else if (size > 0)
+        buffer[0] = '\0';
+    if (prefix_length != NULL)
+        *prefix_length = matched;
+    return length;
+}
 
+void phfwdGetBatch(PhoneForward *pf, char const * const *nums, size_t n, PhoneNumbers const **out) {
+    if (pf == NULL || nums == NULL || out == NULL)
+        return;
+    Lookup lookups[BATCH_WIDTH];
+    size_t indexes[BATCH_WIDTH];
+    size_t next = 0;
+    int active = 0;
+    ReaderSlot *slot = readerEnter(pf);
+    RedsFromTo *root = atomic_load_explicit(&pf->rft_published, memory_order_acquire);
+    Frozen *image = atomic_load_explicit(&pf->frozen, memory_order_acquire);
+    for (; image != NULL && next < n; next++) { // the frozen layout needs no interleaving
+        if (!is_string_a_number(nums[next]))
+            out[next] = declare_phone_numbers();
+        else {
+            frozenLookup(image, &lookups[0], nums[next]);
+            out[next] = lookupFinish(&lookups[0]);
+        }
+    }
+    // every slot walks its own number, finished slots are refilled from the queue
+    while (next < n || active > 0) {
+        while (active < BATCH_WIDTH && next < n) {
+            if (!is_string_a_number(nums[next]))
+                out[next] = declare_phone_numbers();
+            else {
+                lookupStart(root, &lookups[active], nums[next]);
+                indexes[active++] = next;
+            }
+            next++;
+        }
+        for (int i = 0; i < active; ) {
+            if (lookupStep(&lookups[i]))
+                i++;
+            else {
+                out[indexes[i]] = lookupFinish(&lookups[i]);
+                active--;
+                lookups[i] = lookups[active];
+                indexes[i] = indexes[active];
+            }
+        }
+    }
+    readerExit(slot);
+}
 
 char const * phnumGet(PhoneNumbers const *pnum, size_t idx) {   
         if (idx >= pnum->current_length)
@@ -537,28 +5197,73 @@ char const * phnumGet(PhoneNumbers const *pnum, size_t idx) {
         
 
     
+bool phfwdReverseVisit(PhoneForward *pf, char const *num, char const *after, size_t limit,
+                       bool (*visit)(char const *number, void *data), void *data) {
+    if (pf == NULL || visit == NULL || (after != NULL && !is_string_a_number(after)))
+        return false;
+    if (!is_string_a_number(num))
+        return true;
+    static char const empty[1] = {0}; // packed number of length 0, so that num itself is a candidate
+    static uint32_t const empty_offset[1] = {0};
+    size_t length = strlen(num);
+    ReverseStream *streams = malloc((length + 1) * sizeof(ReverseStream));
+    char *start = after != NULL ? malloc(strlen(after) + 1) : NULL;
+    if (streams == NULL || (after != NULL && start == NULL)) {
+        free(streams);
+        free(start);
+        return false;
+    }
+    if (after != NULL)
+        strcpy(start, after);
+    streams[0] = (ReverseStream){.offsets = empty_offset, .pool = empty, .count = 1, .suffix = num};
+    ReaderSlot *slot = readerEnter(pf);
+    Frozen *image = atomic_load_explicit(&pf->frozen, memory_order_acquire);
+    size_t count = 1;
+    if (image != NULL)
+        count += frozenReverseStreams(image, num, &streams[1]);
+    else
+        count += rtfReverseStreams(atomic_load_explicit(&pf->rtf_published, memory_order_acquire), num, &streams[1]);
+    bool result = true;
+    size_t started = 0;
+    while (result && started < count)
+        result = reverseStreamStart(&streams[started++], start);
+    if (result)
+        result = reverse_merge(streams, count, limit, visit, data);
+    readerExit(slot);
+    for (size_t i = 0; i < started; i++)
+        reverseStreamEnd(&streams[i]);
+    free(start);
+    free(streams);
+    return result;
+}
+
+/** @brief Dopisuje kopię numeru do wyniku @ref phfwdReverse.
+ * Funkcja przekazywana do @ref phfwdReverseVisit.
+ * @param[in] number - wskaźnik na napis reprezentujący numer.
+ * @param[in, out] data - wskaźnik na wskaźnik na wynik; gdy nie uda się
+ *                        zaalokować pamięci, wynik jest zwalniany, a wskaźnik
+ *                        ustawiany na NULL.
+ * @return @p true, jeśli się udało, @p false w przeciwnym razie.
+*/
+static bool reverse_append(char const *number, void *data) {
+    PhoneNumbers **pnum = data;
+    size_t size = strlen(number) + 1;
+    char *copy = malloc(size);
+    if (copy != NULL && phnumAppend(*pnum, memcpy(copy, number, size)))
+        return true;
+    free(copy);
+    phnumDelete(*pnum);
+    *pnum = NULL;
+    return false;
+}
+
 PhoneNumbers const * phfwdReverse(PhoneForward *pf, char const *num) {
     PhoneNumbers *pnum = declare_phone_numbers();
     if (!is_string_a_number(num))
         return pnum;
-    RedsToFrom *rtf = pf->reds_to_from;
-    size_t length = strlen(num);
-    size_t i = 0;
-    int index;
-    char *number = malloc((length+1)*sizeof(char)); // used to insert "num" to pnum, need to copy here, because we do not copy in insert_into...
-    strcpy(number, num);
-    insert_into_array_of_numbers(pnum, number);
-    while (rtf != NULL && i < length) {
-        index = CHAR_TO_NUMBER(num[i]);
-        rtf = rtf->children[index];
-        if (rtf != NULL && rtf->redirections != NULL) {
-                size_t j = 0;
-                while (j < rtf->redirections->current_length) {
-                    insert_into_array_of_numbers(pnum, create_redirection(rtf->redirections->array_of_numbers[j], &num[i+1]));
-					j++;
-                }
-        }
-        i++;
+    if (!phfwdReverseVisit(pf, num, NULL, 0, reverse_append, &pnum)) {
+        phnumDelete(pnum);
+        return NULL;
     }
     return pnum;
 }
@@ -622,7 +5327,7 @@ size_t how_many_possible_numbers(bool *array) {
  * @param[in] a - wykładnik potęgi.
  * @return Wynik potęgowania.
 */
-size_t quick_exp(int n, int a) {
+size_t quick_exp(size_t n, size_t a) {
     if (a == 0)
         return 1;
     else {
@@ -674,7 +5379,7 @@ size_t calculate_possible_numbers_rec(RedsToFrom *rtf, size_t level, size_t len,
             result += quick_exp(number_of_poss_numbers, len-level);
         else if (level < len) {
             for (size_t i = 0; i < number_of_poss_numbers; i++) 
-                result += calculate_possible_numbers_rec(rtf->children[legal_numbers[i]], level+1, len, legal_numbers, number_of_poss_numbers);
+                result += calculate_possible_numbers_rec(childSetGet(&rtf->children, legal_numbers[i]), level+1, len, legal_numbers, number_of_poss_numbers);
         }
         return result;
     }
@@ -682,6 +5387,58 @@ size_t calculate_possible_numbers_rec(RedsToFrom *rtf, size_t level, size_t len,
         return 0;
 }
 
+/** @brief Oblicza ilość możliwych numerów w zamrożonej postaci.
+ * Działa jak @ref calculate_possible_numbers_rec dla węzła zamrożonej
+ * struktury RedsToFrom.
+ * @param[in] image - wskaźnik na zamrożoną postać.
+ * @param[in] index - indeks węzła albo NO_OFFSET.
+ * @param[in] level - aktualna głębokość rekurencji.
+ * @param[in] len - dopuszczalna długość numeru.
+ * @param[in] legal_numbers - tablica możliwych liczb.
+ * @param[in] number_of_poss_numbers - długość tablicy @p legal_numbers.
+ * @return Ilość możliwych numerów.
+*/
+static size_t calculate_frozen_numbers_rec(Frozen const *image, uint32_t index, size_t level, size_t len, int *legal_numbers, size_t number_of_poss_numbers) {
+    if (index == NO_OFFSET)
+        return 0;
+    FrozenRtf const *node = &frozenRtf(image)[index];
+    size_t result = 0;
+    if (node->source_count > 0 && level <= len)
+        result += quick_exp(number_of_poss_numbers, len-level);
+    else if (level < len) {
+        for (size_t i = 0; i < number_of_poss_numbers; i++)
+            result += calculate_frozen_numbers_rec(image, frozenChild(node->first_child, node->bitmap, legal_numbers[i]), level+1, len, legal_numbers, number_of_poss_numbers);
+    }
+    return result;
+}
+
+/** @brief Oblicza ilość możliwych numerów z indeksu najkrótszych numerów "do".
+ * Numer długości @p len jest nietrywialny, gdy ma prefiks będący najkrótszym
+ * numerem "do", więc każdy taki numer "do" długości d o cyfrach ze zbioru
+ * @p set daje s^(len-d) numerów. Sumę dla każdego podzbioru cyfr liczy
+ * schematem Hornera. Wynik jest dokładny modulo 2^(liczba bitów size_t).
+ * @param[in] index - wskaźnik na indeks.
+ * @param[in] set - zbiór dopuszczalnych cyfr.
+ * @param[in] s - liczba dopuszczalnych cyfr.
+ * @param[in] len - dopuszczalna długość numeru.
+ * @return Ilość możliwych numerów.
+*/
+static size_t targetsCount(TargetIndex const *index, unsigned set, size_t s, size_t len) {
+    size_t result = 0;
+    for (unsigned mask = set; mask != 0; mask = (mask - 1) & set) {
+        TargetPage const *page = index->pages[mask / TARGET_PAGE_LENGTH];
+        TargetDepths const *depths = page != NULL ? page->masks[mask % TARGET_PAGE_LENGTH] : NULL;
+        if (depths == NULL)
+            continue;
+        size_t last = depths->length - 1 < len ? depths->length - 1 : len;
+        size_t sum = 0;
+        for (size_t depth = 1; depth <= last; depth++)
+            sum = sum*s + depths->counts[depth];
+        result += sum*quick_exp(s, len - last);
+    }
+    return result;
+}
+
 size_t phfwdNonTrivialCount(struct PhoneForward *pf, char const *set, size_t len) {
     if (pf == NULL || set == NULL || len == 0)
         return 0;
@@ -689,12 +5446,26 @@ size_t phfwdNonTrivialCount(struct PhoneForward *pf, char const *set, size_t len
     if (length == 0 || !contains_number(set, length))
         return 0;
     size_t result = 0;
-    RedsToFrom *rtf = pf->reds_to_from;
+    ReaderSlot *slot = readerEnter(pf);
+    RedsToFrom *rtf = atomic_load_explicit(&pf->rtf_published, memory_order_acquire);
+    Frozen *image = atomic_load_explicit(&pf->frozen, memory_order_acquire);
+    TargetIndex *targets = atomic_load_explicit(&pf->targets_published, memory_order_acquire);
     bool *array_of_containing = create_array_of_containing(set, length);
     size_t number_of_possible_numbers = how_many_possible_numbers(array_of_containing);
     int *array_of_numbers = array_of_possible_numbers(array_of_containing, number_of_possible_numbers);
-    for (size_t j = 0; j < number_of_possible_numbers; j++) 
-        result += calculate_possible_numbers_rec(rtf->children[array_of_numbers[j]], 1, len, array_of_numbers, number_of_possible_numbers);
+    if (targets != NULL) {
+        unsigned digits = 0;
+        for (size_t j = 0; j < number_of_possible_numbers; j++)
+            digits |= 1u << array_of_numbers[j];
+        result = targetsCount(targets, digits, number_of_possible_numbers, len);
+    }
+    else for (size_t j = 0; j < number_of_possible_numbers; j++) {
+        if (image != NULL)
+            result += calculate_frozen_numbers_rec(image, frozenChild(frozenRtf(image)->first_child, frozenRtf(image)->bitmap, array_of_numbers[j]), 1, len, array_of_numbers, number_of_possible_numbers);
+        else
+            result += calculate_possible_numbers_rec(childSetGet(&rtf->children, array_of_numbers[j]), 1, len, array_of_numbers, number_of_possible_numbers);
+    }
+    readerExit(slot);
     free(array_of_numbers);
     free(array_of_containing);
     return result;
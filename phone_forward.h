@@ -12,6 +12,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <stdio.h>
 
 /**
  * Struktura przechowująca przekierowania numerów telefonów. 
@@ -34,6 +35,97 @@ struct PhoneNumbers;
 typedef struct PhoneNumbers PhoneNumbers;
 
 
+/**
+ * Liczba przedziałów histogramów głębokości węzłów w @ref PhoneForwardStats.
+ */
+#define PHFWD_STATS_DEPTHS 32
+
+/**
+ * Liczba najdłuższych list przekierowań na jeden numer w @ref PhoneForwardStats.
+ */
+#define PHFWD_STATS_LARGEST 5
+
+/**
+ * Statystyki pamięci i kształtu struktury przechowującej przekierowania
+ * (zob. @ref phfwdStats). Węzły "od" tworzą drzewo przekierowań
+ * z numerów, a węzły "do" drzewo numerów, na które są przekierowania.
+ */
+struct PhoneForwardStats {
+    /**
+    * Liczba przekierowań.
+    */
+    size_t rules;
+    /**
+    * Liczba różnych numerów występujących w przekierowaniach.
+    */
+    size_t numbers;
+    /**
+    * Liczba węzłów "od".
+    */
+    size_t forward_nodes;
+    /**
+    * Liczba węzłów "do".
+    */
+    size_t reverse_nodes;
+    /**
+    * Bajty zajmowane przez węzły "od" wraz z tablicami synów.
+    */
+    size_t forward_bytes;
+    /**
+    * Bajty zajmowane przez węzły "do" wraz z tablicami synów.
+    */
+    size_t reverse_bytes;
+    /**
+    * Bajty zajmowane przez listy numerów przekierowanych na ten sam numer.
+    */
+    size_t list_bytes;
+    /**
+    * Bajty zajmowane przez numery wraz z tablicą do ich wyszukiwania.
+    */
+    size_t number_bytes;
+    /**
+    * Bajty zaalokowane na węzły, ale przez żadne nie zajęte
+    * (zob. @ref phfwdCompact).
+    */
+    size_t free_bytes;
+    /**
+    * Liczba węzłów "od" na kolejnych głębokościach, ostatni przedział
+    * obejmuje też węzły głębsze. Korzeń ma głębokość zero.
+    */
+    size_t forward_depths[PHFWD_STATS_DEPTHS];
+    /**
+    * Liczba węzłów "do" na kolejnych głębokościach, jak @p forward_depths.
+    */
+    size_t reverse_depths[PHFWD_STATS_DEPTHS];
+    /**
+    * Średnia liczba synów węzła "od", który ma synów.
+    */
+    double forward_fanout;
+    /**
+    * Średnia liczba synów węzła "do", który ma synów.
+    */
+    double reverse_fanout;
+    /**
+    * Długości najdłuższych list przekierowań na jeden numer, nierosnąco,
+    * zero dla brakujących list.
+    */
+    size_t largest_counts[PHFWD_STATS_LARGEST];
+    /**
+    * Numery, na które przekierowują listy z @p largest_counts, albo NULL.
+    * Zwalnia je @ref phfwdStatsClear.
+    */
+    char *largest_numbers[PHFWD_STATS_LARGEST];
+    /**
+    * Czy przekierowania są zamrożone (zob. @ref phfwdFreeze).
+    */
+    bool frozen;
+};
+
+/**
+ * typedef dla struktury PhoneForwardStats, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct PhoneForwardStats PhoneForwardStats;
+
 /** @brief Tworzy nową strukturę.
  * Tworzy nową strukturę niezawierającą żadnych przekierowań.
  * @return Wskaźnik na utworzoną strukturę lub NULL, gdy nie udało się
@@ -48,6 +140,154 @@ PhoneForward * phfwdNew(void);
  */
 void phfwdDelete(PhoneForward *pf);  
 
+/** @brief Tworzy kopię struktury.
+ * Kopia i oryginał współdzielą wszystkie węzły i numery, a są od siebie
+ * niezależne: operacja zapisu w jednej strukturze kopiuje tylko węzły na
+ * ścieżkach, które zmienia. Dodatkowa pamięć jest więc proporcjonalna do
+ * różnic między strukturami, a samo kopiowanie nie zależy od liczby
+ * przekierowań. Zamrożona struktura (zob. @ref phfwdFreeze) jest najpierw
+ * rozmrażana. Dopóki struktura ma kopie, nie można jej zamrozić, zagęścić
+ * (zob. @ref phfwdCompact) ani włączyć w niej trybu współbieżnych
+ * czytelników (zob. @ref phfwdEnableConcurrency). Operacja zapisu
+ * w jednej ze struktur współdzielących węzły nie może przebiegać
+ * równocześnie z żadną operacją na pozostałych.
+ * @param[in,out] pf – wskaźnik na kopiowaną strukturę.
+ * @return Wskaźnik na kopię lub NULL, gdy @p pf ma wartość NULL, włączono
+ *         w niej tryb współbieżnych czytelników, ma za dużo kopii lub nie
+ *         udało się zaalokować pamięci. Kopię usuwa się funkcją
+ *         @ref phfwdDelete.
+ */
+PhoneForward *phfwdClone(PhoneForward *pf);
+
+/** @brief Włącza tryb współbieżnych czytelników.
+ * Po włączeniu trybu wiele wątków może jednocześnie, bez blokad, wywoływać
+ * funkcje @ref phfwdGet, @ref phfwdGetInto, @ref phfwdGetBatch,
+ * @ref phfwdReverse i @ref phfwdNonTrivialCount, podczas gdy jeden wątek
+ * wywołuje @ref phfwdAdd i @ref phfwdRemove. Czytelnik widzi stan sprzed
+ * albo po każdej operacji zapisu. Operacje zapisu kopiują zmieniane węzły,
+ * a stare węzły i numery są zwalniane dopiero, gdy nie czyta ich już żaden
+ * czytelnik. Funkcję trzeba wywołać, zanim inne wątki zaczną korzystać ze
+ * struktury. Trybu nie można wyłączyć.
+ * @param[in,out] pf – wskaźnik na strukturę przechowującą przekierowania
+ *                     numerów.
+ * @return Wartość @p true, jeśli tryb jest włączony.
+ *         Wartość @p false, jeśli @p pf ma wartość NULL, współdzieli węzły
+ *         z kopiami (zob. @ref phfwdClone) lub nie udało się zaalokować
+ *         pamięci.
+ */
+bool phfwdEnableConcurrency(PhoneForward *pf);
+
+/** @brief Zamraża przekierowania.
+ * Przepisuje przekierowania do jednego, zwartego bloku pamięci tylko do
+ * odczytu, w którym węzły są ułożone wszerz i odwołują się do siebie przez
+ * indeksy, a następnie zwalnia struktury wskaźnikowe. Funkcje
+ * @ref phfwdGet, @ref phfwdGetInto, @ref phfwdGetBatch, @ref phfwdReverse
+ * i @ref phfwdNonTrivialCount dają te same wyniki co przed zamrożeniem.
+ * Pierwsze wywołanie @ref phfwdAdd lub @ref phfwdRemove odtwarza struktury
+ * wskaźnikowe i usuwa zamrożoną postać.
+ * @param[in,out] pf – wskaźnik na strukturę przechowującą przekierowania
+ *                     numerów.
+ * @return Wartość @p true, jeśli przekierowania są zamrożone.
+ *         Wartość @p false, jeśli @p pf ma wartość NULL, włączono tryb
+ *         współbieżnych czytelników (zob. @ref phfwdEnableConcurrency),
+ *         struktura współdzieli węzły z kopiami (zob. @ref phfwdClone),
+ *         jest za duża lub nie udało się zaalokować pamięci.
+ */
+bool phfwdFreeze(PhoneForward *pf);
+
+/** @brief Zagęszcza przekierowania.
+ * Przepisuje struktury wskaźnikowe do nowych, ciągłych bloków pamięci,
+ * w których węzły kolejnych poziomów leżą blisko siebie, i zwalnia stare
+ * bloki razem z pozostałymi w nich wolnymi węzłami. Przebudowuje też
+ * z pełnych węzłów listy numerów przekierowanych na ten sam numer oraz
+ * zmniejsza tablicę numerów. Po wywołaniu zajmowana pamięć odpowiada
+ * liczbie przekierowań. Zamrożonych przekierowań (zob. @ref phfwdFreeze)
+ * funkcja nie zmienia.
+ * @param[in,out] pf – wskaźnik na strukturę przechowującą przekierowania
+ *                     numerów.
+ * @return Wartość @p true, jeśli przekierowania są zagęszczone.
+ *         Wartość @p false, jeśli @p pf ma wartość NULL, włączono tryb
+ *         współbieżnych czytelników (zob. @ref phfwdEnableConcurrency),
+ *         struktura współdzieli węzły z kopiami (zob. @ref phfwdClone) lub
+ *         nie udało się zaalokować pamięci. Wtedy struktura pozostaje
+ *         niezmieniona.
+ */
+bool phfwdCompact(PhoneForward *pf);
+
+/** @brief Zbiera statystyki przekierowań.
+ * Wypełnia @p stats liczbą przekierowań, węzłów i numerów, pamięcią
+ * zajmowaną przez poszczególne części struktury, histogramami głębokości
+ * węzłów, średnią liczbą synów oraz najdłuższymi listami przekierowań na
+ * jeden numer. Przegląda całą strukturę. W trybie współbieżnych
+ * czytelników funkcję wywołuje wątek zapisujący. Struktura współdzieląca
+ * pamięć z kopiami (zob. @ref phfwdClone) podaje liczbę i pamięć numerów
+ * całej wspólnej pamięci, a do wolnych bajtów wlicza węzły kopii.
+ * @param[in] pf     – wskaźnik na strukturę przechowującą przekierowania
+ *                     numerów;
+ * @param[out] stats – wskaźnik na statystyki, które trzeba potem zwolnić
+ *                     funkcją @ref phfwdStatsClear.
+ * @return Wartość @p true, jeśli statystyki zostały zebrane.
+ *         Wartość @p false, jeśli któryś ze wskaźników ma wartość NULL
+ *         lub nie udało się zaalokować pamięci.
+ */
+bool phfwdStats(PhoneForward *pf, PhoneForwardStats *stats);
+
+/** @brief Zbiera łączne statystyki wielu struktur.
+ * Działa jak @ref phfwdStats dla wszystkich struktur naraz, ale węzły,
+ * listy i numery współdzielone przez kopie (zob. @ref phfwdClone) liczy
+ * raz. Pamięć w statystykach jest więc pamięcią faktycznie zajmowaną przez
+ * wszystkie struktury. Liczba przekierowań jest sumą przekierowań
+ * wszystkich struktur, a pole @p frozen mówi, czy któraś struktura jest
+ * zamrożona.
+ * @param[in] pfs    – tablica @p count wskaźników na struktury
+ *                     przechowujące przekierowania numerów;
+ * @param[in] count  – liczba struktur;
+ * @param[out] stats – wskaźnik na statystyki, które trzeba potem zwolnić
+ *                     funkcją @ref phfwdStatsClear.
+ * @return Wartość @p true, jeśli statystyki zostały zebrane.
+ *         Wartość @p false, jeśli któryś ze wskaźników ma wartość NULL
+ *         lub nie udało się zaalokować pamięci.
+ */
+bool phfwdStatsTotal(PhoneForward * const *pfs, size_t count, PhoneForwardStats *stats);
+
+/** @brief Zwalnia pamięć statystyk.
+ * Zwalnia numery najdłuższych list zebrane przez @ref phfwdStats. Nic nie
+ * robi, jeśli @p stats ma wartość NULL.
+ * @param[in,out] stats – wskaźnik na statystyki.
+ */
+void phfwdStatsClear(PhoneForwardStats *stats);
+
+/** @brief Zapisuje bazę przekierowań.
+ * Zapisuje w pliku @p file, od bieżącej pozycji, binarny obraz bazy:
+ * nagłówek z wersją formatu i sumą kontrolną, a za nim zamrożoną postać
+ * przekierowań (zob. @ref phfwdFreeze). Sama baza nie jest zamrażana.
+ * Obraz można odczytać tylko na maszynie o tej samej kolejności bajtów
+ * i rozmiarze typu size_t. W trybie współbieżnych czytelników funkcję
+ * wywołuje wątek zapisujący.
+ * @param[in] pf   – wskaźnik na strukturę przechowującą przekierowania
+ *                   numerów;
+ * @param[in] file – wskaźnik na plik otwarty do zapisu.
+ * @return Wartość @p true, jeśli zapis się powiódł.
+ *         Wartość @p false, jeśli któryś ze wskaźników ma wartość NULL, nie
+ *         udało się zaalokować pamięci lub wystąpił błąd zapisu.
+ */
+bool phfwdSave(PhoneForward *pf, FILE *file);
+
+/** @brief Wczytuje bazę przekierowań.
+ * Odwzorowuje w pamięci obraz zapisany funkcją @ref phfwdSave, zaczynający
+ * się w pliku @p path na pozycji @p offset, i sprawdza jego sumę kontrolną.
+ * Przekierowania nie są wczytywane pojedynczo: baza jest zamrożona
+ * i odpowiada na zapytania bezpośrednio z odwzorowanego pliku. Pierwsza
+ * operacja zapisu rozmraża bazę. Odwzorowanie jest usuwane w
+ * @ref phfwdDelete.
+ * @param[in] path   – wskaźnik na napis reprezentujący ścieżkę do pliku;
+ * @param[in] offset – pozycja obrazu w pliku, wielokrotność 8.
+ * @return Wskaźnik na utworzoną strukturę lub NULL, gdy nie udało się
+ *         otworzyć pliku, obraz jest uszkodzony, ma nieobsługiwany format
+ *         lub nie udało się zaalokować pamięci.
+ */
+PhoneForward *phfwdLoad(char const *path, size_t offset);
+
 /** @brief Dodaje przekierowanie.
  * Dodaje przekierowanie wszystkich numerów mających prefiks @p num1, na numery,
  * w których ten prefiks zamieniono odpowiednio na prefiks @p num2. Każdy numer
@@ -65,6 +305,29 @@ void phfwdDelete(PhoneForward *pf);
  */
 bool phfwdAdd(PhoneForward *pf, char const *num1, char const *num2);
 
+/** @brief Dodaje wiele przekierowań naraz.
+ * Działa tak jak wywołanie @ref phfwdAdd dla kolejnych par numerów
+ * @p num1[i], @p num2[i], ale przekierowania są najpierw sortowane,
+ * a przekierowania odwrotne każdego numeru powstają w jednym kroku, już
+ * uporządkowane. Do struktury bez przekierowań drzewo przekierowań jest
+ * budowane od liści, bez dzielenia krawędzi. W trybie współbieżnych
+ * czytelników (zob. @ref phfwdEnableConcurrency) czytelnik widzi stan
+ * sprzed albo po dodaniu wszystkich przekierowań.
+ * @param[in,out] pf – wskaźnik na strukturę przechowującą przekierowania
+ *                     numerów;
+ * @param[in] num1 – tablica @p count wskaźników na prefiksy numerów
+ *                   przekierowywanych;
+ * @param[in] num2 – tablica @p count wskaźników na prefiksy numerów, na które
+ *                   są wykonywane przekierowania;
+ * @param[in] count – liczba przekierowań.
+ * @return Wartość @p true, jeśli przekierowania zostały dodane.
+ *         Wartość @p false, jeśli @p pf ma wartość NULL, któraś para nie
+ *         spełnia warunków @ref phfwdAdd (wtedy nic nie jest dodawane) lub
+ *         nie udało się zaalokować pamięci (wtedy część przekierowań mogła
+ *         zostać dodana).
+ */
+bool phfwdAddBulk(PhoneForward *pf, char const * const *num1, char const * const *num2, size_t count);
+
 /** @brief Usuwa przekierowania. 
  * Usuwa wszystkie przekierowania, w których parametr @p num jest prefiksem
  * parametru @p num1 użytego przy dodawaniu. Jeśli nie ma takich przekierowań
@@ -75,6 +338,69 @@ bool phfwdAdd(PhoneForward *pf, char const *num1, char const *num2);
  */
 void phfwdRemove(PhoneForward *pf, char const *num);
 
+/** @brief Rozpoczyna transakcję.
+ * Kolejne operacje dodane funkcjami @ref phfwdStageAdd
+ * i @ref phfwdStageRemove są tylko zapamiętywane, a wprowadza je razem
+ * funkcja @ref phfwdCommit. Funkcje @ref phfwdAdd i @ref phfwdRemove
+ * działają w czasie transakcji jak zwykle.
+ * @param[in,out] pf – wskaźnik na strukturę przechowującą przekierowania
+ *                     numerów.
+ * @return Wartość @p true, jeśli transakcja się rozpoczęła.
+ *         Wartość @p false, jeśli @p pf ma wartość NULL lub transakcja już
+ *         trwa.
+ */
+bool phfwdBegin(PhoneForward *pf);
+
+/** @brief Dopisuje dodanie przekierowania do transakcji.
+ * Przy zatwierdzeniu działa jak @ref phfwdAdd.
+ * @param[in,out] pf – wskaźnik na strukturę przechowującą przekierowania
+ *                     numerów;
+ * @param[in] num1 – wskaźnik na napis reprezentujący prefiks numerów
+ *                   przekierowywanych;
+ * @param[in] num2 – wskaźnik na napis reprezentujący prefiks numerów, na które
+ *                   jest wykonywane przekierowanie.
+ * @return Wartość @p true, jeśli operacja została zapamiętana.
+ *         Wartość @p false, jeśli nie trwa transakcja, podany napis nie
+ *         reprezentuje numeru, oba podane numery są identyczne lub nie udało
+ *         się zaalokować pamięci.
+ */
+bool phfwdStageAdd(PhoneForward *pf, char const *num1, char const *num2);
+
+/** @brief Dopisuje usunięcie przekierowań do transakcji.
+ * Przy zatwierdzeniu działa jak @ref phfwdRemove.
+ * @param[in,out] pf – wskaźnik na strukturę przechowującą przekierowania
+ *                     numerów;
+ * @param[in] num – wskaźnik na napis reprezentujący prefiks numerów.
+ * @return Wartość @p true, jeśli operacja została zapamiętana.
+ *         Wartość @p false, jeśli nie trwa transakcja, napis nie reprezentuje
+ *         numeru lub nie udało się zaalokować pamięci.
+ */
+bool phfwdStageRemove(PhoneForward *pf, char const *num);
+
+/** @brief Zatwierdza transakcję.
+ * Wprowadza zapamiętane operacje tak, jakby zostały wykonane kolejno, ale
+ * w jednym przejściu: zmiany tego samego przekierowania znoszą się,
+ * a przekierowania odwrotne są zmieniane raz dla każdego numeru "do".
+ * W trybie współbieżnych czytelników (zob. @ref phfwdEnableConcurrency)
+ * czytelnik widzi stan sprzed transakcji albo po wszystkich jej operacjach.
+ * Kończy transakcję.
+ * @param[in,out] pf – wskaźnik na strukturę przechowującą przekierowania
+ *                     numerów.
+ * @return Wartość @p true, jeśli transakcja została zatwierdzona.
+ *         Wartość @p false, jeśli @p pf ma wartość NULL lub nie trwa
+ *         transakcja.
+ */
+bool phfwdCommit(PhoneForward *pf);
+
+/** @brief Porzuca transakcję.
+ * Zapomina zapamiętane operacje, nie zmieniając przekierowań, i kończy
+ * transakcję. Jeśli @p pf ma wartość NULL lub nie trwa transakcja, nic nie
+ * robi.
+ * @param[in,out] pf – wskaźnik na strukturę przechowującą przekierowania
+ *                     numerów.
+ */
+void phfwdAbort(PhoneForward *pf);
+
 /** @brief Wyznacza przekierowanie numeru.
  * Wyznacza przekierowanie podanego numeru. Szuka najdłuższego pasującego
  * prefiksu. Wynikiem jest co najwyżej jeden numer. Jeśli dany numer nie został
@@ -86,7 +412,41 @@ void phfwdRemove(PhoneForward *pf, char const *num);
  * @return Wskaźnik na strukturę przechowującą ciąg numerów lub NULL, gdy nie
  *         udało się zaalokować pamięci.
  */
-PhoneNumbers const * phfwdGet(PhoneForward *pf, char const *num); 
+PhoneNumbers const * phfwdGet(PhoneForward *pf, char const *num);
+
+/** @brief Wyznacza przekierowania wielu numerów.
+ * Dla każdego @p i od 0 do @p n - 1 zapisuje w @p out[i] ten sam wynik,
+ * który zwróciłoby wywołanie @ref phfwdGet(@p pf, @p nums[i]). Wyszukiwania
+ * kilku numerów przeplatają się, dzięki czemu oczekiwania na pamięć się
+ * nakładają. Każdą zwróconą strukturę trzeba zwolnić za pomocą funkcji
+ * @ref phnumDelete. Nic nie robi, jeśli któryś ze wskaźników @p pf, @p nums
+ * lub @p out ma wartość NULL.
+ * @param[in] pf   – wskaźnik na strukturę przechowującą przekierowania numerów;
+ * @param[in] nums – tablica @p n wskaźników na napisy reprezentujące numery;
+ * @param[in] n    – liczba numerów;
+ * @param[out] out – tablica na @p n wskaźników na wyniki.
+ */
+void phfwdGetBatch(PhoneForward *pf, char const * const *nums, size_t n, PhoneNumbers const **out);
+
+/** @brief Wyznacza przekierowanie numeru bez alokowania pamięci.
+ * Wyznacza ten sam numer co funkcja @ref phfwdGet i zapisuje go wraz
+ * z kończącym znakiem '\0' w buforze @p buffer, jeśli bufor ma co najmniej
+ * wynik + 1 bajtów. W przeciwnym razie, podobnie jak dla napisu niebędącego
+ * numerem lub wskaźnika @p pf o wartości NULL, zapisuje pusty napis
+ * (o ile @p size jest dodatnie).
+ * @param[in] pf             – wskaźnik na strukturę przechowującą przekierowania
+ *                             numerów;
+ * @param[in] num            – wskaźnik na napis reprezentujący numer;
+ * @param[out] buffer        – wskaźnik na bufor na wynik;
+ * @param[in] size           – rozmiar bufora w bajtach;
+ * @param[out] prefix_length – wskaźnik, pod który zostanie zapisana długość
+ *                             przekierowanego prefiksu numeru @p num (zero, gdy
+ *                             numer nie jest przekierowany), może mieć wartość
+ *                             NULL.
+ * @return Długość wyznaczonego numeru bez znaku '\0' albo zero, jeśli
+ *         @p num nie reprezentuje numeru.
+ */
+size_t phfwdGetInto(PhoneForward *pf, char const *num, char *buffer, size_t size, size_t *prefix_length);
 
 /** @brief Wyznacza przekierowania na dany numer.
  * Wyznacza wszystkie przekierowania na podany numer. Wynikowy ciąg zawiera też
@@ -101,6 +461,33 @@ PhoneNumbers const * phfwdGet(PhoneForward *pf, char const *num);
  */
 PhoneNumbers const * phfwdReverse(PhoneForward *pf, char const *num);
 
+/** @brief Przegląda przekierowania na dany numer.
+ * Wywołuje funkcję @p visit dla kolejnych numerów z wyniku
+ * @ref phfwdReverse(@p pf, @p num), w porządku leksykograficznym, bez
+ * alokowania całego wyniku. Numer jest przekazywany w buforze, który jest
+ * używany ponownie: jest ważny tylko do powrotu z @p visit. Zużycie pamięci
+ * zależy od długości numerów, a nie od liczby przekierowań. Funkcja
+ * @p visit nie może zmieniać @p pf. Kolejną stronę wyniku otrzymuje się,
+ * podając jako @p after ostatni odwiedzony numer.
+ * @param[in] pf    – wskaźnik na strukturę przechowującą przekierowania
+ *                    numerów;
+ * @param[in] num   – wskaźnik na napis reprezentujący numer;
+ * @param[in] after – wskaźnik na napis reprezentujący numer, od którego
+ *                    wszystkie odwiedzane numery są większe, albo NULL;
+ * @param[in] limit – największa liczba odwiedzanych numerów, zero oznacza
+ *                    brak limitu;
+ * @param[in] visit – funkcja wywoływana dla kolejnych numerów, zwraca
+ *                    @p false, aby zakończyć przeglądanie;
+ * @param[in] data  – wskaźnik przekazywany funkcji @p visit.
+ * @return Wartość @p true, jeśli przeglądanie się zakończyło (także wtedy,
+ *         gdy @p num nie reprezentuje numeru i nic nie odwiedzono).
+ *         Wartość @p false, jeśli @p pf lub @p visit ma wartość NULL,
+ *         @p after nie reprezentuje numeru lub nie udało się zaalokować
+ *         pamięci.
+ */
+bool phfwdReverseVisit(PhoneForward *pf, char const *num, char const *after, size_t limit,
+                       bool (*visit)(char const *number, void *data), void *data);
+
 /** @brief Usuwa strukturę.
  * Usuwa strukturę wskazywaną przez @p pnum. Nic nie robi, jeśli wskaźnik ten ma
  * wartość NULL.
@@ -123,6 +510,8 @@ char const * phnumGet(PhoneNumbers const *pnum, size_t idx);
  * zwraca inny numer niż on sam. Dodatkowo numery muszą mieć długość dokładnie @p len oraz
  * składać się tylko z cyfer w napisie @p set. Jeśli wskaźnik pf ma wartość NULL, set ma wartość NULL,
  * set jest pusty, set nie zawiera żadnej cyfry lub parametr len jest równy zeru, wynikiem jest zero.
+ * Gdy liczba numerów nie mieści się w typie size_t, wynik jest dokładny modulo 2^(liczba bitów size_t).
+ * Czas działania zależy od liczby cyfr w @p set i od długości numerów "do", a nie od liczby przekierowań.
  * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania telefonu;
  * @param[in] set - wskaźnik na napis zawierający dopuszczalne cyfry.
  * @param[in] len - długość, jaką musi mieć numer wliczany do wyniku.
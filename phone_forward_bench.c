@@ -0,0 +1,154 @@
+/** @file
+ * Porównanie czasu wyznaczania przekierowań funkcjami phfwdGet
+ * i phfwdGetBatch. Zapytania są przedłużeniami numerów przekierowań,
+ * a pomiary obu funkcji są powtarzane na przemian; podawany jest
+ * najkrótszy czas każdej z nich.
+ *
+ * Użycie: phone_forward_bench [przekierowania] [zapytania] [rozmiar porcji]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "phone_forward.h"
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define RULE_LENGTH 12
+#define QUERY_LENGTH 14
+#define ROUNDS 5
+
+/**
+ * Stan generatora liczb pseudolosowych, stały, aby pomiary były powtarzalne.
+*/
+static uint64_t state = 88172645463325252ull;
+
+/** @brief Losuje liczbę generatorem xorshift.
+ * @return Wylosowana liczba.
+*/
+static uint64_t next_random(void) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+/** @brief Losuje numer.
+ * @param[out] number - bufor na @p length + 1 znaków.
+ * @param[in] length - długość numeru.
+*/
+static void random_number(char *number, size_t length) {
+    for (size_t i = 0; i < length; i++)
+        number[i] = '0' + next_random() % 10;
+    number[length] = '\0';
+}
+
+/** @brief Zwraca bieżący czas w sekundach.
+ * @return Czas zegara monotonicznego.
+*/
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/** @brief Wyznacza przekierowania wszystkich zapytań.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] nums - tablica zapytań.
+ * @param[in] queries - liczba zapytań.
+ * @param[in] batch - rozmiar porcji albo zero dla pojedynczych wywołań
+ *                    phfwdGet.
+ * @param[out] out - tablica na wyniki.
+ * @return Czas wyznaczania w sekundach.
+*/
+static double measure(PhoneForward *pf, char const **nums, size_t queries, size_t batch, PhoneNumbers const **out) {
+    double start = now();
+    if (batch == 0)
+        for (size_t i = 0; i < queries; i++)
+            out[i] = phfwdGet(pf, nums[i]);
+    else
+        for (size_t i = 0; i < queries; i += batch)
+            phfwdGetBatch(pf, nums + i, queries - i < batch ? queries - i : batch, out + i);
+    return now() - start;
+}
+
+/** @brief Porównuje dwa ciągi numerów.
+ * @param[in] a - wskaźnik na pierwszy ciąg.
+ * @param[in] b - wskaźnik na drugi ciąg.
+ * @return Wartość @p true, jeśli ciągi są równe.
+*/
+static bool same_numbers(PhoneNumbers const *a, PhoneNumbers const *b) {
+    for (size_t i = 0;; i++) {
+        char const *x = phnumGet(a, i), *y = phnumGet(b, i);
+        if (x == NULL || y == NULL)
+            return x == y;
+        if (strcmp(x, y) != 0)
+            return false;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    size_t rules = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    size_t queries = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+    size_t batch = argc > 3 ? strtoul(argv[3], NULL, 10) : 256;
+    if (batch == 0) {
+        fprintf(stderr, "Usage: %s [rules] [queries] [batch]\n", argv[0]);
+        return 1;
+    }
+    PhoneForward *pf = phfwdNew();
+    char *sources = malloc((rules > 0 ? rules : 1) * (RULE_LENGTH + 1));
+    char *numbers = malloc(queries * (QUERY_LENGTH + 1));
+    char const **nums = malloc(queries * sizeof(char *));
+    PhoneNumbers const **single = malloc(queries * sizeof(PhoneNumbers *));
+    PhoneNumbers const **batched = malloc(queries * sizeof(PhoneNumbers *));
+    if (pf == NULL || sources == NULL || numbers == NULL || nums == NULL || single == NULL || batched == NULL) {
+        fprintf(stderr, "Błąd alokowania pamięci\n");
+        return 1;
+    }
+    for (size_t i = 0; i < rules; i++) {
+        char *from = sources + i * (RULE_LENGTH + 1), to[RULE_LENGTH + 1];
+        random_number(from, RULE_LENGTH);
+        random_number(to, RULE_LENGTH);
+        phfwdAdd(pf, from, to);
+    }
+    for (size_t i = 0; i < queries; i++) { // a query extends the number of a random rule, so every query is redirected
+        char *query = numbers + i * (QUERY_LENGTH + 1);
+        if (rules > 0) {
+            memcpy(query, sources + next_random() % rules * (RULE_LENGTH + 1), RULE_LENGTH);
+            random_number(query + RULE_LENGTH, QUERY_LENGTH - RULE_LENGTH);
+        }
+        else
+            random_number(query, QUERY_LENGTH);
+        nums[i] = query;
+    }
+
+    double get_time = 0, batch_time = 0;
+    bool result = true;
+    for (int round = 0; round < ROUNDS; round++) { // the order alternates, so neither function always runs on a warm cache
+        double time[2];
+        for (int j = 0; j < 2; j++) {
+            bool batching = (round + j) % 2 == 1;
+            time[batching] = measure(pf, nums, queries, batching ? batch : 0, batching ? batched : single);
+        }
+        if (round == 0 || time[0] < get_time)
+            get_time = time[0];
+        if (round == 0 || time[1] < batch_time)
+            batch_time = time[1];
+        for (size_t i = 0; i < queries; i++) {
+            result = result && same_numbers(single[i], batched[i]);
+            phnumDelete(single[i]);
+            phnumDelete(batched[i]);
+        }
+    }
+    printf("rules=%zu queries=%zu batch=%zu rounds=%d\n", rules, queries, batch, ROUNDS);
+    printf("phfwdGet      %.3f s\n", get_time);
+    printf("phfwdGetBatch %.3f s (%.2fx)\n", batch_time, batch_time > 0 ? get_time / batch_time : 0);
+    if (!result)
+        fprintf(stderr, "ERROR results differ\n");
+    free(batched);
+    free(single);
+    free(nums);
+    free(numbers);
+    free(sources);
+    phfwdDelete(pf);
+    return result ? 0 : 1;
+}
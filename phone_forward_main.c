@@ -1,8 +1,47 @@
+#define _POSIX_C_SOURCE 200809L
 #include "phone_forward_parser.h"
 #include "phone_forward.h"
+#include <unistd.h>
 
-int main() {
-    ArrayOfBases *AOB = initialize_array_of_bases();
+int main(int argc, char *argv[]) {
+    const char *snapshot = NULL, *journal = NULL;
+    for (int i = 1; i < argc; i++) { // options: -s snapshot file, -j journal file, -f output flush policy, -t query threads
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            snapshot = argv[++i];
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            journal = argv[++i];
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc && (strcmp(argv[i + 1], "line") == 0 || strcmp(argv[i + 1], "block") == 0))
+            set_output_policy(strcmp(argv[++i], "line") == 0 ? OUTPUT_LINE : OUTPUT_BLOCK);
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            set_query_workers(atoi(argv[++i]) - 1);
+        else {
+            fprintf(stderr, "Usage: %s [-s snapshot -j journal] [-j journal] [-f line|block] [-t threads]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (snapshot != NULL && journal == NULL) { // the snapshot is only ever written from the journal
+        fprintf(stderr, "Usage: %s [-s snapshot -j journal] [-j journal] [-f line|block] [-t threads]\n", argv[0]);
+        return 1;
+    }
+    ArrayOfBases *AOB;
+    if (snapshot != NULL && access(snapshot, F_OK) == 0) {
+        AOB = load_bases(snapshot);
+        if (AOB == NULL) {
+            fprintf(stderr, "ERROR SNAPSHOT\n");
+            return 1;
+        }
+    }
+    else AOB = initialize_array_of_bases();
+    if (journal != NULL && !open_journal(AOB, journal)) {
+        fprintf(stderr, "ERROR JOURNAL\n");
+        clear(AOB);
+        return 1;
+    }
+    if (snapshot != NULL && journal != NULL && !compact_journal(AOB, snapshot, NULL)) { // folding the replayed journal into a fresh snapshot
+        fprintf(stderr, "ERROR SNAPSHOT\n");
+        clear(AOB);
+        return 1;
+    }
     handle_input(AOB, NULL);
     clear(AOB);
     return 0;
@@ -1,8 +1,235 @@
+#define _POSIX_C_SOURCE 200809L
 #include "phone_forward_parser.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 #define BASIC_LENGTH_OF_ARRAY 100
+#define BASIC_BUCKET_COUNT 128
 #define BASIC_LENGTH_OF_NUMBER 8
 #define BASIC_LENGTH_OF_WORD 10
+#define BASES_MAGIC "PHFWDBS2"
+#define BASES_ALIGNMENT 8
+#define JOURNAL_MAGIC "PHFWDJN2"
+#define JOURNAL_HEADER_LENGTH (sizeof(JOURNAL_MAGIC) - 1 + sizeof(uint64_t))
+#define JOURNAL_BUFFER_LENGTH 65536
+#define JOURNAL_SYNC_RECORDS 256
+#define JOURNAL_SYNC_MILLISECONDS 50
+#define LEXER_BLOCK_LENGTH (1 << 20)
+#define NO_PIN SIZE_MAX
+#define SIGN_TYPE 0x0f
+#define SIGN_DIGIT 0x10
+#define SIGN_ALPHA 0x20
+#define SIGN_WHITE 0x40
+#define SIGN_PATH 0x80
+#define OUTPUT_BUFFER_LENGTH (1 << 16)
+#define QUERY_BATCH_LENGTH 4096
+#define QUERY_CHUNK 32
+
+/**
+ * Struktura przechowująca otwarty dziennik zmian.
+*/
+typedef struct Journal {
+    /**
+    * Plik dziennika.
+    */
+    FILE *file;
+    /**
+    * Losowy identyfikator zapisany w nagłówku, zmieniany przy każdym
+    * opróżnieniu dziennika.
+    */
+    uint64_t id;
+    /**
+    * Liczba rekordów zapisanych od ostatniego wywołania fsync.
+    */
+    int pending;
+    /**
+    * Czas ostatniego wywołania fsync.
+    */
+    struct timespec last_sync;
+} Journal;
+
+/**
+ * Struktura przechowująca bufor standardowego wejścia. Tokeny zwracane
+ * przez parser są wskaźnikami do tego bufora.
+*/
+typedef struct Lexer {
+    /**
+    * Wczytany fragment wejścia, zakończony miejscem na znak '\0'.
+    */
+    char *buffer;
+    /**
+    * Rozmiar bufora bez miejsca na znak '\0'.
+    */
+    size_t capacity;
+    /**
+    * Pozycja następnego znaku do wczytania.
+    */
+    size_t position;
+    /**
+    * Koniec wczytanego fragmentu.
+    */
+    size_t end;
+    /**
+    * Początek wczytywanego właśnie tokenu albo NO_PIN.
+    */
+    size_t pin;
+    /**
+    * Czy bufor zawiera gotowe tokeny bieżącego polecenia.
+    */
+    bool holding;
+    /**
+    * Poprzednie bufory, na które wskazują tokeny bieżącego polecenia.
+    */
+    char **retired;
+    /**
+    * Liczba poprzednich buforów.
+    */
+    size_t retired_count;
+    /**
+    * Czy osiągnięto koniec wejścia.
+    */
+    bool eof;
+    /**
+    * Dziennik zmian utrwalany przed czekaniem na wejście albo NULL.
+    */
+    Journal *journal;
+    /**
+    * Rodzaj każdego znaku (SIGN_TYPE) oraz jego klasy (SIGN_DIGIT, SIGN_ALPHA, SIGN_WHITE, SIGN_PATH).
+    */
+    unsigned char signs[256];
+} Lexer;
+
+/**
+ * Bufor standardowego wejścia.
+*/
+static Lexer lexer;
+
+/**
+ * Struktura przechowująca bufor standardowego wyjścia.
+*/
+typedef struct Output {
+    /**
+    * Wyniki czekające na wypisanie.
+    */
+    char buffer[OUTPUT_BUFFER_LENGTH];
+    /**
+    * Liczba bajtów w buforze.
+    */
+    size_t length;
+    /**
+    * Kiedy bufor jest opróżniany, zob. @ref Output_policy.
+    */
+    int policy;
+} Output;
+
+/**
+ * Bufor standardowego wyjścia.
+*/
+static Output output;
+
+/**
+ * Struktura przechowująca zapytanie '?' czekające na wykonanie.
+*/
+typedef struct Query {
+    /**
+    * Baza, której dotyczy zapytanie.
+    */
+    PhoneForward *base;
+    /**
+    * Pozycja numeru w tablicy napisów partii.
+    */
+    size_t number;
+    /**
+    * Liczba bajtów wczytanych do chwili zapytania, używana w komunikacie o błędzie.
+    */
+    size_t byte_number;
+    /**
+    * Czy jest to zapytanie o przekierowania na numer.
+    */
+    bool reverse;
+    /**
+    * Wynik zapytania.
+    */
+    PhoneNumbers const *result;
+} Query;
+
+/**
+ * Struktura przechowująca partię zapytań wykonywanych równolegle
+ * oraz wątki, które je wykonują.
+*/
+typedef struct Batch {
+    /**
+    * Zapytania w kolejności wczytania.
+    */
+    Query *queries;
+    /**
+    * Liczba zapytań.
+    */
+    size_t count;
+    /**
+    * Numery zapytań zakończone znakami '\0'.
+    */
+    char *text;
+    /**
+    * Długość tablicy napisów.
+    */
+    size_t text_length;
+    /**
+    * Rozmiar tablicy napisów.
+    */
+    size_t text_capacity;
+    /**
+    * Indeks pierwszego zapytania, którego nie wziął jeszcze żaden wątek.
+    */
+    atomic_size_t next;
+    /**
+    * Struktura ArrayOfBases, używana do zwolnienia pamięci w przypadku błędu.
+    */
+    ArrayOfBases *AOB;
+    /**
+    * Liczba wątków pomocniczych.
+    */
+    int worker_count;
+    /**
+    * Wątki pomocnicze.
+    */
+    pthread_t *workers;
+    /**
+    * Muteks chroniący pola round, active i stop.
+    */
+    pthread_mutex_t mutex;
+    /**
+    * Sygnalizuje wątkom początek nowej partii.
+    */
+    pthread_cond_t start;
+    /**
+    * Sygnalizuje koniec pracy ostatniego wątku.
+    */
+    pthread_cond_t done;
+    /**
+    * Numer bieżącej partii.
+    */
+    unsigned round;
+    /**
+    * Liczba wątków pracujących nad bieżącą partią.
+    */
+    int active;
+    /**
+    * Czy wątki mają się zakończyć.
+    */
+    bool stop;
+} Batch;
+
+/**
+ * Partia zapytań.
+*/
+static Batch batch = {.worker_count = -1, .mutex = PTHREAD_MUTEX_INITIALIZER, .start = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER};
+
+static void run_queries(void);
 
 /** @struct PfBase phone_forward_parser.h
  * Implementacja struktury przechowującej bazę przekierowań.
@@ -16,6 +243,18 @@ struct PfBase {
     * Wskaźnik na strukturę PhoneForward.
     */
 	PhoneForward *base;
+    /**
+    * Skrót nazwy bazy.
+    */
+    uint32_t hash;
+    /**
+    * Indeks bazy w tablicy baz.
+    */
+    int index;
+    /**
+    * Następna baza w tym samym kubełku tablicy haszującej.
+    */
+    PfBase *next;
 };
 
 /** @struct ArrayOfBases phone_forward_parser.h
@@ -31,119 +270,328 @@ struct ArrayOfBases {
     */
 	int max_length;
     /**
-    * Wskaźnik na tablicę wskaźników do struktury PfBase.
+    * Wskaźnik na tablicę wskaźników do struktury PfBase, w dowolnej kolejności.
     */
 	PfBase **Array;
+    /**
+    * Kubełki tablicy haszującej, każdy to lista baz połączona polem next.
+    */
+    PfBase **buckets;
+    /**
+    * Liczba kubełków, potęga dwójki.
+    */
+    size_t bucket_count;
+    /**
+    * Wskaźnik na dziennik zmian albo NULL, jeśli dziennik nie jest prowadzony.
+    */
+    Journal *journal;
+    /**
+    * Identyfikator dziennika, którego początek zawiera wczytana migawka,
+    * albo 0.
+    */
+    uint64_t covered_journal;
+    /**
+    * Długość początku dziennika @p covered_journal zawartego w migawce.
+    */
+    uint64_t covered_length;
 };
 
+/**
+ * Funkcja zapisuje zbuforowane rekordy dziennika i wywołuje fsync.
+ * @param[in, out] journal - wskaźnik na dziennik.
+*/
+static void journal_sync(Journal *journal) {
+    if (fflush(journal->file) != 0 || fsync(fileno(journal->file)) != 0)
+        fprintf(stderr, "ERROR JOURNAL\n");
+    journal->pending = 0;
+    clock_gettime(CLOCK_MONOTONIC, &journal->last_sync);
+}
+
 void clear(ArrayOfBases *AOB) {
+    if (AOB->journal != NULL) { // records accepted so far have to survive the exit, also after an error
+        journal_sync(AOB->journal);
+        fclose(AOB->journal->file);
+        free(AOB->journal);
+    }
     for (int i = 0; i < AOB->current_length; i++) {
         phfwdDelete(AOB->Array[i]->base);
         free(AOB->Array[i]->name);
         free(AOB->Array[i]);
     }
     free(AOB->Array);
+    free(AOB->buckets);
     free(AOB);
 }
 
-void handle_error(int byte_number, ArrayOfBases *AOB, char *error_info) {
-    fprintf(stderr, "%s %d\n", error_info, byte_number);
+/**
+ * Funkcja wypisuje na standardowe wyjście wszystkie podane fragmenty,
+ * ponawiając zapis po częściowym zapisie.
+ * @param[in, out] vector - tablica fragmentów.
+ * @param[in] count - liczba fragmentów.
+*/
+static void write_all(struct iovec *vector, int count) {
+    while (count > 0) {
+        ssize_t written = writev(STDOUT_FILENO, vector, count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        for (; count > 0 && (size_t)written >= vector->iov_len; vector++, count--)
+            written -= vector->iov_len;
+        if (count > 0) {
+            vector->iov_base = (char *)vector->iov_base + written;
+            vector->iov_len -= written;
+        }
+    }
+}
+
+/**
+ * Funkcja wypisuje zawartość bufora standardowego wyjścia.
+*/
+static void flush_output(void) {
+    struct iovec vector = {output.buffer, output.length};
+    write_all(&vector, 1);
+    output.length = 0;
+}
+
+/**
+ * Funkcja dopisuje do bufora standardowego wyjścia napis i znak nowej linii.
+ * @param[in] string - wskaźnik na napis.
+ * @param[in] length - długość napisu.
+*/
+static void print_line(const char *string, size_t length) {
+    if (length + 1 > OUTPUT_BUFFER_LENGTH - output.length) {
+        if (length + 1 > OUTPUT_BUFFER_LENGTH / 2) { // a long line is written straight from where it is stored
+            struct iovec vector[3] = {{output.buffer, output.length}, {(char *)string, length}, {"\n", 1}};
+            write_all(vector, 3);
+            output.length = 0;
+            return;
+        }
+        flush_output();
+    }
+    memcpy(output.buffer + output.length, string, length);
+    output.buffer[output.length + length] = '\n';
+    output.length += length + 1;
+}
+
+void set_output_policy(int policy) {
+    output.policy = policy;
+}
+
+void handle_error(size_t byte_number, ArrayOfBases *AOB, char *error_info) {
+    run_queries();
+    flush_output();
+    fprintf(stderr, "%s %zu\n", error_info, byte_number);
     clear(AOB);
     exit(1);
 }
 
-void print_numbers(PhoneNumbers const *pnum, int byte_numbers, ArrayOfBases *AOB, char *number) {
+void print_numbers(PhoneNumbers const *pnum, size_t byte_numbers, ArrayOfBases *AOB) {
     size_t idx = 0;
     const char *num;
     while ((num = phnumGet(pnum, idx++)) != NULL)
-        printf("%s\n", num);
+        print_line(num, strlen(num));
     phnumDelete(pnum);
-    if (idx == 1) {
-        free(number);
+    if (idx == 1)
         handle_error(byte_numbers, AOB, "ERROR ?");
+    if (output.policy == OUTPUT_LINE)
+        flush_output();
+}
+
+/**
+ * Funkcja dopisuje do strumienia histogram głębokości węzłów w postaci
+ * par głębokość:liczba węzłów, pomijając puste przedziały.
+ * @param[in, out] stream - strumień.
+ * @param[in] name - nazwa histogramu.
+ * @param[in] depths - histogram (zob. @ref PhoneForwardStats).
+*/
+static void print_depths(FILE *stream, const char *name, size_t const *depths) {
+    fprintf(stream, " %s=", name);
+    const char *separator = "";
+    for (int i = 0; i < PHFWD_STATS_DEPTHS; i++)
+        if (depths[i] > 0) {
+            fprintf(stream, "%s%d%s:%zu", separator, i, i == PHFWD_STATS_DEPTHS - 1 ? "+" : "", depths[i]);
+            separator = ",";
+        }
+}
+
+/**
+ * Funkcja wypisuje statystyki każdej bazy w osobnym wierszu, zaczynającym
+ * się od STATS i identyfikatora bazy (bieżąca baza jest oznaczona słowem
+ * current), a na końcu wiersz STATS * z łącznymi statystykami wszystkich
+ * baz, w których pamięć współdzielona przez kopie baz jest liczona raz
+ * (zob. @ref phfwdStatsTotal).
+ * @param[in] AOB - wskaźnik na strukturę ArrayOfBases.
+ * @param[in] current_base - wskaźnik na bieżącą bazę albo NULL.
+ * @param[in] byte_number - liczba wczytanych dotąd bajtów.
+*/
+static void print_stats(ArrayOfBases *AOB, PfBase *current_base, size_t byte_number) {
+    PhoneForwardStats stats, total = {0};
+    char *line;
+    size_t length;
+    PfBase **bases = sorted_bases(AOB);
+    if (bases == NULL)
+        handle_error(byte_number, AOB, "MEMORY ERROR");
+    for (int i = 0; i < AOB->current_length; i++) {
+        FILE *stream = open_memstream(&line, &length);
+        if (stream == NULL || !phfwdStats(bases[i]->base, &stats)) {
+            if (stream != NULL) {
+                fclose(stream);
+                free(line);
+            }
+            free(bases);
+            handle_error(byte_number, AOB, "MEMORY ERROR");
+        }
+        fprintf(stream, "STATS %s%s rules=%zu numbers=%zu forward_nodes=%zu reverse_nodes=%zu forward_bytes=%zu reverse_bytes=%zu list_bytes=%zu number_bytes=%zu free_bytes=%zu forward_fanout=%.2f reverse_fanout=%.2f",
+                bases[i]->name, bases[i] == current_base ? " current" : "", stats.rules, stats.numbers, stats.forward_nodes, stats.reverse_nodes,
+                stats.forward_bytes, stats.reverse_bytes, stats.list_bytes, stats.number_bytes, stats.free_bytes, stats.forward_fanout, stats.reverse_fanout);
+        print_depths(stream, "forward_depths", stats.forward_depths);
+        print_depths(stream, "reverse_depths", stats.reverse_depths);
+        fprintf(stream, " largest=");
+        for (int j = 0; j < PHFWD_STATS_LARGEST && stats.largest_numbers[j] != NULL; j++)
+            fprintf(stream, "%s%s:%zu", j > 0 ? "," : "", stats.largest_numbers[j], stats.largest_counts[j]);
+        fclose(stream);
+        print_line(line, length);
+        free(line);
+        phfwdStatsClear(&stats);
     }
+    PhoneForward **pfs = malloc((AOB->current_length + 1) * sizeof(PhoneForward *));
+    for (int i = 0; pfs != NULL && i < AOB->current_length; i++)
+        pfs[i] = bases[i]->base;
+    bool result = pfs != NULL && phfwdStatsTotal(pfs, AOB->current_length, &total);
+    free(pfs);
+    free(bases);
+    if (!result)
+        handle_error(byte_number, AOB, "MEMORY ERROR");
+    phfwdStatsClear(&total);
+    char buffer[512];
+    print_line(buffer, snprintf(buffer, sizeof(buffer), "STATS * bases=%d rules=%zu numbers=%zu forward_nodes=%zu reverse_nodes=%zu forward_bytes=%zu reverse_bytes=%zu list_bytes=%zu number_bytes=%zu free_bytes=%zu",
+               AOB->current_length, total.rules, total.numbers, total.forward_nodes, total.reverse_nodes,
+               total.forward_bytes, total.reverse_bytes, total.list_bytes, total.number_bytes, total.free_bytes));
+    if (output.policy == OUTPUT_LINE)
+        flush_output();
+}
+
+/**
+ * Funkcja oblicza skrót FNV-1a nazwy bazy.
+ * @param[in] name - wskaźnik na nazwę.
+ * @return Skrót nazwy.
+*/
+static uint32_t base_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (; *name != '\0'; name++)
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    return hash;
 }
 
 PfBase *create_base(const char *name) {
     PfBase *new = malloc(sizeof(PfBase));
     if (new == NULL) return NULL;
     new->name = malloc((strlen(name) +1 ) * sizeof(char));
-    new->name = strcpy(new->name, name);
     new->base = phfwdNew();
+    if (new->name == NULL || new->base == NULL) {
+        free(new->name);
+        phfwdDelete(new->base);
+        free(new);
+        return NULL;
+    }
+    new->name = strcpy(new->name, name);
+    new->hash = base_hash(name);
+    new->index = -1;
+    new->next = NULL;
     return new;
 }
 
-void move_array_right(PfBase *Array[], int index, int current_length) {
-    PfBase *tmp = Array[index];
-    for (int i = index + 1; i <= current_length; i++) {
-        PfBase *tmp2 = Array[i];
-        Array[i] = tmp;
-        tmp = tmp2;
-    }
-}
- 
-void move_array_left(PfBase *Array[], int index, int current_length) {
-    for (int i = index; i < current_length-1; i++) {
-        Array[i] = Array[i+1];
+/**
+ * Funkcja podwaja liczbę kubełków tablicy haszującej, korzystając
+ * z zapamiętanych skrótów nazw. Gdy zabraknie pamięci, zostawia
+ * dotychczasowe kubełki.
+ * @param[in, out] AOB - wskaźnik na strukturę przechowującą tablicę baz.
+*/
+static void grow_buckets(ArrayOfBases *AOB) {
+    size_t bucket_count = 2*AOB->bucket_count;
+    PfBase **buckets = calloc(bucket_count, sizeof(PfBase *));
+    if (buckets == NULL) return;
+    for (int i = 0; i < AOB->current_length; i++) {
+        PfBase *base = AOB->Array[i];
+        base->next = buckets[base->hash & (bucket_count - 1)];
+        buckets[base->hash & (bucket_count - 1)] = base;
     }
+    free(AOB->buckets);
+    AOB->buckets = buckets;
+    AOB->bucket_count = bucket_count;
 }
 
-PfBase * insert_base(ArrayOfBases *AOB, int i, const char *base_name) { // inserting base with a given name into a given index of array of bases
+PfBase *insert_base(ArrayOfBases *AOB, const char *base_name) { // the caller checks with find_base that the name is free
     if (AOB->current_length == AOB->max_length) {
         PfBase ** tmp = AOB->Array;
-        AOB->Array = realloc(AOB->Array, 2*AOB->max_length*sizeof(PfBase));
+        AOB->Array = realloc(AOB->Array, 2*AOB->max_length*sizeof(PfBase *));
         if (AOB->Array == NULL) {
             free(tmp);
         	fprintf(stderr, "Błąd alokowania pamięci");
             exit(1);
         }
         AOB->max_length *= 2;
-        for (int j = AOB->current_length; j < AOB->max_length; j++)
-            AOB->Array[j] = NULL;
-    }
-    if (i != AOB->current_length) { // if index is something in the middle, then we need to move array, we dont need to do that if its the last element
-         move_array_right(AOB->Array, i, AOB->current_length);
     }
-    AOB->Array[i] = create_base(base_name);
-    if (AOB->Array[i] == NULL) return NULL;
-    AOB->current_length += 1;
-    return AOB->Array[i];
+    PfBase *new = create_base(base_name);
+    if (new == NULL) return NULL;
+    new->index = AOB->current_length;
+    AOB->Array[AOB->current_length++] = new;
+    new->next = AOB->buckets[new->hash & (AOB->bucket_count - 1)];
+    AOB->buckets[new->hash & (AOB->bucket_count - 1)] = new;
+    if ((size_t)AOB->current_length > AOB->bucket_count) // keeping at most one base per bucket on average
+        grow_buckets(AOB);
+    return new;
 }
 
-PfBase *find_base(ArrayOfBases *AOB, int *index, char *base_name) { // looking for a base using binary search
-    if (AOB->current_length == 0) {
-        *index = 0;
-        return NULL;
-    }
-    int i = 0;
-    int j = AOB->current_length - 1;
-    int m;
-    while (i < j) {
-        m = (i+j+1)/2;
-        if (strcmp(AOB->Array[m]->name, base_name) <= 0) i = m;
-        else j = m - 1;
-    }
-    m = strcmp(AOB->Array[i]->name, base_name); // using m so I dont need to declare another variable. We need this m in order not to calculate strcmp twice. 
-    if (m == 0) return AOB->Array[i];
-    else {
-        if (i == 0 && m > 0) *index = i;
-        else *index = i+1;
+PfBase *clone_base(ArrayOfBases *AOB, const char *base_name, PfBase *parent) { // the caller checks with find_base that the name is free
+    PhoneForward *base = phfwdClone(parent->base);
+    PfBase *new = base != NULL ? insert_base(AOB, base_name) : NULL;
+    if (new == NULL) {
+        phfwdDelete(base);
         return NULL;
     }
+    phfwdDelete(new->base); // replacing the empty base created by insert_base
+    new->base = base;
+    return new;
 }
 
-int find_index_of_base(ArrayOfBases *AOB, char *base_name) { // performing binary search on sorted array of bases in order to find correct index
-    if (AOB->current_length == 0) return -1;
-    int i = 0;
-    int j = AOB->current_length - 1;
-    int m;
-    while (i < j) {
-        m = (i+j+1)/2;
-        if (strcmp(AOB->Array[m]->name, base_name) <= 0) i = m;
-        else j = m - 1;
-    }
-    if (strcmp(AOB->Array[i]->name, base_name) == 0) return i;
-    else return -1;
+/**
+ * Funkcja znajduje w tablicy haszującej miejsce wskaźnika na bazę
+ * o podanej nazwie.
+ * @param[in] AOB - wskaźnik na strukturę przechowującą tablicę baz.
+ * @param[in] base_name - nazwa bazy, której szukamy.
+ * @return Wskaźnik na pole wskazujące na bazę albo na pole NULL
+ *         kończące listę, jeśli nie ma bazy o podanej nazwie.
+*/
+static PfBase **find_link(ArrayOfBases *AOB, const char *base_name) {
+    uint32_t hash = base_hash(base_name);
+    PfBase **link = &AOB->buckets[hash & (AOB->bucket_count - 1)];
+    while (*link != NULL && ((*link)->hash != hash || strcmp((*link)->name, base_name) != 0))
+        link = &(*link)->next;
+    return link;
+}
+
+PfBase *find_base(ArrayOfBases *AOB, const char *base_name) {
+    return *find_link(AOB, base_name);
+}
+
+/**
+ * Funkcja porównuje bazy według nazw, do użycia w qsort.
+ * @param[in] a - wskaźnik na wskaźnik na pierwszą bazę.
+ * @param[in] b - wskaźnik na wskaźnik na drugą bazę.
+ * @return Wynik strcmp dla nazw baz.
+*/
+static int compare_bases(const void *a, const void *b) {
+    return strcmp((*(PfBase * const *)a)->name, (*(PfBase * const *)b)->name);
+}
+
+PfBase **sorted_bases(ArrayOfBases *AOB) {
+    PfBase **result = malloc((AOB->current_length + 1)*sizeof(PfBase *));
+    if (result == NULL) return NULL;
+    memcpy(result, AOB->Array, AOB->current_length*sizeof(PfBase *));
+    qsort(result, AOB->current_length, sizeof(PfBase *), compare_bases);
+    return result;
 }
 
 ArrayOfBases *initialize_array_of_bases() {
@@ -151,103 +599,836 @@ ArrayOfBases *initialize_array_of_bases() {
     if (AOB == NULL) return NULL;
     AOB->max_length = BASIC_LENGTH_OF_ARRAY;
     AOB->current_length = 0;
-    AOB->Array = malloc(BASIC_LENGTH_OF_ARRAY*sizeof(PfBase));
-    for (int i = 0; i < BASIC_LENGTH_OF_ARRAY; i++) {
-        AOB->Array[i] = NULL;
+    AOB->Array = malloc(BASIC_LENGTH_OF_ARRAY*sizeof(PfBase *));
+    AOB->bucket_count = BASIC_BUCKET_COUNT;
+    AOB->buckets = calloc(BASIC_BUCKET_COUNT, sizeof(PfBase *));
+    AOB->journal = NULL;
+    AOB->covered_journal = AOB->covered_length = 0;
+    if (AOB->Array == NULL || AOB->buckets == NULL) {
+        free(AOB->Array);
+        free(AOB->buckets);
+        free(AOB);
+        return NULL;
     }
     return AOB;
 }
 
 int delete_base(ArrayOfBases *AOB, char *base_name) { 
-    int index = find_index_of_base(AOB, base_name);
-    if (index < 0 || index >= AOB->current_length) return ERROR; // case when index was out of bounds
-	phfwdDelete(AOB->Array[index]->base);
-    free(AOB->Array[index]->name);
-    free(AOB->Array[index]);
-    AOB->Array[index] = NULL;
-    if (index < AOB->current_length - 1) { // we need to move array if we are deleting something from the middle. If its last element then there is no such need
-        move_array_left(AOB->Array, index, AOB->current_length);
-        AOB->Array[AOB->current_length-1] = NULL;
-    }
-    AOB->current_length -= 1;
+    PfBase **link = find_link(AOB, base_name);
+    PfBase *base = *link;
+    if (base == NULL) return ERROR;
+    *link = base->next;
+    AOB->Array[base->index] = AOB->Array[AOB->current_length - 1]; // the last base takes the freed place
+    AOB->Array[base->index]->index = base->index;
+    AOB->Array[--AOB->current_length] = NULL;
+	phfwdDelete(base->base);
+    free(base->name);
+    free(base);
     return SUCCESS;
 }
+
+/**
+ * Funkcja dopisuje do pliku zera, tak aby pozycja w pliku była
+ * wielokrotnością BASES_ALIGNMENT.
+ * @param[in] file - wskaźnik na plik.
+ * @return @p true jeśli zapis się udał, @p false w przeciwnym razie.
+*/
+static bool pad_file(FILE *file) {
+    long position = ftell(file);
+    if (position < 0) return false;
+    while (position++ % BASES_ALIGNMENT != 0)
+        if (fputc(0, file) == EOF) return false;
+    return true;
+}
+
+bool save_bases(ArrayOfBases *AOB, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) return false;
+    uint64_t count = AOB->current_length, covered[2] = {0, 0};
+    PfBase **bases = sorted_bases(AOB); // the file lists the bases by name
+    bool result = bases != NULL;
+    if (AOB->journal != NULL) { // the snapshot holds the records written so far, which replaying has to skip
+        long length = fflush(AOB->journal->file) == 0 ? ftell(AOB->journal->file) : -1;
+        covered[0] = AOB->journal->id;
+        covered[1] = length;
+        result = result && length >= 0;
+    }
+    result = result && fwrite(BASES_MAGIC, strlen(BASES_MAGIC), 1, file) == 1 && fwrite(&count, sizeof(count), 1, file) == 1
+             && fwrite(covered, sizeof(covered), 1, file) == 1;
+    for (int i = 0; i < AOB->current_length && result; i++) {
+        uint64_t length = strlen(bases[i]->name);
+        result = fwrite(&length, sizeof(length), 1, file) == 1 && fwrite(bases[i]->name, length, 1, file) == 1 && pad_file(file);
+        long start = ftell(file) + sizeof(length); // snapshot length is filled in after the snapshot is written
+        result = result && fwrite(&length, sizeof(length), 1, file) == 1 && phfwdSave(bases[i]->base, file);
+        long end = ftell(file);
+        length = end - start;
+        result = result && fseek(file, start - sizeof(length), SEEK_SET) == 0 && fwrite(&length, sizeof(length), 1, file) == 1
+                 && fseek(file, end, SEEK_SET) == 0 && pad_file(file);
+    }
+    free(bases);
+    result = result && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0) result = false;
+    return result;
+}
+
+ArrayOfBases *load_bases(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    ArrayOfBases *AOB = initialize_array_of_bases();
+    char magic[sizeof(BASES_MAGIC)] = {0};
+    uint64_t count = 0;
+    bool result = AOB != NULL && fread(magic, strlen(BASES_MAGIC), 1, file) == 1 && strcmp(magic, BASES_MAGIC) == 0
+                  && fread(&count, sizeof(count), 1, file) == 1 && fread(&AOB->covered_journal, sizeof(uint64_t), 1, file) == 1
+                  && fread(&AOB->covered_length, sizeof(uint64_t), 1, file) == 1;
+    for (uint64_t i = 0; i < count && result; i++) {
+        uint64_t length;
+        char *name = NULL;
+        result = fread(&length, sizeof(length), 1, file) == 1 && length > 0 && (name = calloc(length + 1, 1)) != NULL
+                 && fread(name, length, 1, file) == 1 && strlen(name) == length
+                 && fseek(file, (BASES_ALIGNMENT - length % BASES_ALIGNMENT) % BASES_ALIGNMENT, SEEK_CUR) == 0
+                 && fread(&length, sizeof(length), 1, file) == 1;
+        PhoneForward *base = result ? phfwdLoad(path, ftell(file)) : NULL;
+        PfBase *inserted;
+        if (base != NULL && find_base(AOB, name) == NULL && (inserted = insert_base(AOB, name)) != NULL) {
+            phfwdDelete(inserted->base); // replacing the empty base created by insert_base
+            inserted->base = base;
+            result = fseek(file, (length + BASES_ALIGNMENT - 1) / BASES_ALIGNMENT * BASES_ALIGNMENT, SEEK_CUR) == 0;
+        }
+        else {
+            phfwdDelete(base);
+            result = false;
+        }
+        free(name);
+    }
+    fclose(file);
+    if (!result && AOB != NULL) {
+        clear(AOB);
+        return NULL;
+    }
+    return AOB;
+}
+
+/**
+ * Funkcja aktualizuje skrót FNV-1a o podane bajty.
+ * @param[in] hash - dotychczasowa wartość skrótu.
+ * @param[in] bytes - wskaźnik na bajty.
+ * @param[in] length - liczba bajtów.
+ * @return Nowa wartość skrótu.
+*/
+static uint32_t journal_hash(uint32_t hash, const void *bytes, size_t length) {
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ ((const unsigned char *)bytes)[i]) * 16777619u;
+    return hash;
+}
+
+/**
+ * Funkcja zwraca liczbę napisów zapisywanych w rekordzie danego typu.
+ * @param[in] type - typ rekordu.
+ * @return Liczba napisów albo 0, jeśli typ jest niepoprawny.
+*/
+static int journal_strings(int type) {
+    if (type == JOURNAL_ADD || type == JOURNAL_CLONE) return 2;
+    else if (type == JOURNAL_NEW || type == JOURNAL_DEL_BASE || type == JOURNAL_DEL_NUMBER) return 1;
+    else return 0;
+}
+
+/**
+ * Funkcja dopisuje rekord do bufora dziennika, nie utrwalając go.
+ * @param[in, out] journal - wskaźnik na dziennik.
+ * @param[in] type - typ rekordu.
+ * @param[in] first - pierwszy napis rekordu.
+ * @param[in] second - drugi napis rekordu albo NULL.
+*/
+static void journal_write(Journal *journal, int type, const char *first, const char *second) {
+    // record: type, then every string as a varint length and its bytes, then a checksum of all of it
+    unsigned char byte = type;
+    uint32_t hash = journal_hash(2166136261u, &byte, 1);
+    bool result = fputc(byte, journal->file) != EOF;
+    const char *strings[] = {first, second};
+    for (int i = 0; i < journal_strings(type); i++) {
+        unsigned char varint[10];
+        size_t length = strlen(strings[i]), count = 0;
+        do {
+            varint[count++] = (length & 0x7f) | (length >= 0x80 ? 0x80 : 0);
+            length >>= 7;
+        } while (length > 0);
+        hash = journal_hash(journal_hash(hash, varint, count), strings[i], strlen(strings[i]));
+        result = result && fwrite(varint, count, 1, journal->file) == 1 && fwrite(strings[i], strlen(strings[i]), 1, journal->file) == 1;
+    }
+    unsigned char checksum[4] = {hash, hash >> 8, hash >> 16, hash >> 24};
+    result = result && fwrite(checksum, sizeof(checksum), 1, journal->file) == 1;
+    if (!result)
+        fprintf(stderr, "ERROR JOURNAL\n");
+}
+
+void journal_append(ArrayOfBases *AOB, int type, const char *first, const char *second) {
+    Journal *journal = AOB->journal;
+    if (journal == NULL) return;
+    journal_write(journal, type, first, second);
+    // group commit: fsync once per batch of records instead of once per command
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long elapsed = (now.tv_sec - journal->last_sync.tv_sec) * 1000 + (now.tv_nsec - journal->last_sync.tv_nsec) / 1000000;
+    if (++journal->pending >= JOURNAL_SYNC_RECORDS || elapsed >= JOURNAL_SYNC_MILLISECONDS)
+        journal_sync(journal);
+}
+
+/**
+ * Funkcja dodaje do bazy przekierowania z pliku jednym wywołaniem
+ * @ref phfwdAddBulk. Plik zawiera przekierowania postaci numer > numer
+ * rozdzielone białymi znakami. Dodane przekierowania trafiają do dziennika
+ * jako rekordy JOURNAL_ADD utrwalane jednym wywołaniem fsync.
+ * @param[in, out] AOB - wskaźnik na strukturę przechowującą tablicę baz.
+ * @param[in, out] base - wskaźnik na bazę, do której trafiają przekierowania.
+ * @param[in] path - ścieżka do pliku.
+ * @return @p true jeśli dodano przekierowania, @p false jeśli nie udało się
+ *         wczytać pliku, ma on niepoprawną postać, któreś przekierowanie
+ *         jest niepoprawne lub zabrakło pamięci.
+*/
+static bool load_rules(ArrayOfBases *AOB, PfBase *base, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return false;
+    char *text = NULL;
+    long length = -1;
+    bool result = fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) >= 0 && fseek(file, 0, SEEK_SET) == 0
+                  && (text = malloc(length + 1)) != NULL && (length == 0 || fread(text, length, 1, file) == 1);
+    fclose(file);
+    const char **from = NULL, **to = NULL;
+    size_t count = 0, max = 0;
+    long i = 0;
+    while (result) {
+        while (i < length && (lexer.signs[(unsigned char)text[i]] & SIGN_WHITE))
+            i++;
+        if (i >= length) break; // the last number may end the file, then i is past its '\0'
+        if (count == max) {
+            max = max > 0 ? 2 * max : BASIC_LENGTH_OF_ARRAY;
+            const char **new_from = realloc(from, max * sizeof(char *));
+            if (new_from != NULL) from = new_from;
+            const char **new_to = realloc(to, max * sizeof(char *));
+            if (new_to != NULL) to = new_to;
+            result = new_from != NULL && new_to != NULL;
+            if (!result) break;
+        }
+        long start = i;
+        while (i < length && is_number(text[i]))
+            i++;
+        long end = i;
+        while (i < length && (lexer.signs[(unsigned char)text[i]] & SIGN_WHITE))
+            i++;
+        result = end > start && i < length && text[i] == '>';
+        if (!result) break;
+        text[end] = '\0'; // only after the check, '>' may follow the number directly
+        from[count] = text + start;
+        for (i++; i < length && (lexer.signs[(unsigned char)text[i]] & SIGN_WHITE); i++);
+        start = i;
+        while (i < length && is_number(text[i]))
+            i++;
+        result = i > start && (i == length || (lexer.signs[(unsigned char)text[i]] & SIGN_WHITE));
+        text[i++] = '\0';
+        to[count++] = text + start;
+    }
+    result = result && phfwdAddBulk(base->base, from, to, count);
+    if (result && AOB->journal != NULL) { // replaying the records one by one gives the same base
+        for (size_t j = 0; j < count; j++)
+            journal_write(AOB->journal, JOURNAL_ADD, from[j], to[j]);
+        journal_sync(AOB->journal);
+    }
+    free(from);
+    free(to);
+    free(text);
+    return result;
+}
+
+/**
+ * Funkcja wczytuje jeden rekord dziennika.
+ * @param[in] file - wskaźnik na plik dziennika.
+ * @param[in] remaining - liczba bajtów pozostałych w pliku.
+ * @param[out] type - typ rekordu.
+ * @param[out] strings - tablica na wczytane napisy, zaalokowane przez funkcję.
+ * @return @p true jeśli wczytano cały poprawny rekord, @p false jeśli
+ *         plik się skończył lub rekord jest urwany albo uszkodzony.
+*/
+static bool journal_read(FILE *file, long remaining, int *type, char *strings[2]) {
+    int sign = fgetc(file);
+    *type = sign;
+    if (sign == EOF || journal_strings(sign) == 0) return false;
+    unsigned char byte = sign;
+    uint32_t hash = journal_hash(2166136261u, &byte, 1);
+    bool result = true;
+    for (int i = 0; i < journal_strings(*type) && result; i++) {
+        uint64_t length = 0;
+        int shift = 0;
+        do {
+            sign = fgetc(file);
+            byte = sign;
+            hash = journal_hash(hash, &byte, 1);
+            length |= (uint64_t)(byte & 0x7f) << shift;
+            shift += 7;
+        } while (sign != EOF && (byte & 0x80) && shift < 64);
+        result = sign != EOF && !(byte & 0x80) && length > 0 && length < (uint64_t)remaining
+                 && (strings[i] = calloc(length + 1, 1)) != NULL && fread(strings[i], length, 1, file) == 1
+                 && strlen(strings[i]) == length;
+        if (result)
+            hash = journal_hash(hash, strings[i], length);
+    }
+    unsigned char checksum[4];
+    return result && fread(checksum, sizeof(checksum), 1, file) == 1
+           && (checksum[0] | checksum[1] << 8 | checksum[2] << 16 | (uint32_t)checksum[3] << 24) == hash;
+}
+
+/**
+ * Funkcja wykonuje rekord dziennika bezpośrednio na bazach, tak jak
+ * zrobiłaby to funkcja @ref handle_input.
+ * @param[in, out] AOB - wskaźnik na strukturę przechowującą tablicę baz.
+ * @param[in, out] current_base - wskaźnik na aktualną bazę.
+ * @param[in] type - typ rekordu.
+ * @param[in] strings - napisy zapisane w rekordzie.
+*/
+static void journal_apply(ArrayOfBases *AOB, PfBase **current_base, int type, char *strings[2]) {
+    PfBase *tmp;
+    switch (type) {
+        case JOURNAL_NEW:
+            tmp = find_base(AOB, strings[0]);
+            if (tmp == NULL)
+                tmp = insert_base(AOB, strings[0]);
+            if (tmp != NULL)
+                *current_base = tmp;
+            break;
+
+        case JOURNAL_CLONE: // the copy exists already when the journal is replayed over a snapshot that holds it
+            tmp = find_base(AOB, strings[0]);
+            if (tmp == NULL && (tmp = find_base(AOB, strings[1])) != NULL)
+                tmp = clone_base(AOB, strings[0], tmp);
+            if (tmp != NULL)
+                *current_base = tmp;
+            break;
+
+        case JOURNAL_DEL_BASE:
+            if (*current_base != NULL && strcmp((*current_base)->name, strings[0]) == 0)
+                *current_base = NULL;
+            delete_base(AOB, strings[0]);
+            break;
+
+        case JOURNAL_ADD:
+            if (*current_base != NULL)
+                phfwdAdd((*current_base)->base, strings[0], strings[1]);
+            break;
+
+        case JOURNAL_DEL_NUMBER:
+            if (*current_base != NULL)
+                phfwdRemove((*current_base)->base, strings[0]);
+            break;
+    }
+}
+
+/**
+ * Funkcja nadaje dziennikowi nowy identyfikator i zapisuje jego nagłówek.
+ * Identyfikator pochodzi z zegara i numeru procesu, więc dziennik
+ * utworzony na nowo nie przyjmuje identyfikatora dziennika z migawki.
+ * @param[in, out] journal - wskaźnik na dziennik.
+ * @return @p true jeśli zapis się udał, @p false w przeciwnym razie.
+*/
+static bool journal_start(Journal *journal) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t id = (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+    id ^= (uint64_t)getpid() << 40;
+    journal->id = id == journal->id || id == 0 ? id + 1 : id; // two compactions within a tick still differ
+    return fseek(journal->file, 0, SEEK_SET) == 0 && fwrite(JOURNAL_MAGIC, strlen(JOURNAL_MAGIC), 1, journal->file) == 1
+           && fwrite(&journal->id, sizeof(journal->id), 1, journal->file) == 1;
+}
+
+bool open_journal(ArrayOfBases *AOB, const char *path) {
+    bool created = false;
+    FILE *file = fopen(path, "r+b");
+    if (file == NULL && errno == ENOENT) {
+        file = fopen(path, "w+b");
+        created = true;
+    }
+    if (file == NULL) return false;
+    Journal *journal = malloc(sizeof(Journal));
+    if (journal == NULL || setvbuf(file, NULL, _IOFBF, JOURNAL_BUFFER_LENGTH) != 0) {
+        free(journal);
+        fclose(file);
+        return false;
+    }
+    char magic[sizeof(JOURNAL_MAGIC)] = {0};
+    long valid = JOURNAL_HEADER_LENGTH;
+    journal->file = file;
+    journal->id = 0;
+    bool result = !created && fseek(file, 0, SEEK_END) == 0 && ftell(file) > 0;
+    if (result) { // an existing journal is replayed up to its last complete record
+        long size = ftell(file);
+        result = fseek(file, 0, SEEK_SET) == 0 && fread(magic, strlen(JOURNAL_MAGIC), 1, file) == 1 && strcmp(magic, JOURNAL_MAGIC) == 0
+                 && fread(&journal->id, sizeof(journal->id), 1, file) == 1;
+        // records already held by the snapshot are left out: replaying a clone over them would copy a later parent
+        if (result && journal->id == AOB->covered_journal && AOB->covered_length >= (uint64_t)valid && AOB->covered_length <= (uint64_t)size) {
+            valid = AOB->covered_length;
+            result = fseek(file, valid, SEEK_SET) == 0;
+        }
+        PfBase *current_base = NULL;
+        int type;
+        char *strings[2] = {NULL, NULL};
+        while (result && journal_read(file, size - valid, &type, strings)) {
+            journal_apply(AOB, &current_base, type, strings);
+            valid = ftell(file);
+            free(strings[0]);
+            free(strings[1]);
+            strings[0] = strings[1] = NULL;
+        }
+        free(strings[0]);
+        free(strings[1]);
+        // a torn tail left by a crash is cut off, so that new records follow the last complete one
+        result = result && ftruncate(fileno(file), valid) == 0 && fseek(file, valid, SEEK_SET) == 0;
+    }
+    else { // a new or empty journal only gets the header
+        result = journal_start(journal);
+    }
+    if (!result) {
+        free(journal);
+        fclose(file);
+        return false;
+    }
+    AOB->journal = journal;
+    journal_sync(journal);
+    return true;
+}
+
+bool compact_journal(ArrayOfBases *AOB, const char *path, PfBase *current_base) {
+    char *temporary = malloc(strlen(path) + sizeof(".tmp"));
+    if (temporary == NULL) return false;
+    sprintf(temporary, "%s.tmp", path);
+    // the snapshot replaces the old one only once it is complete; mapped bases keep using the old file
+    bool result = save_bases(AOB, temporary) && rename(temporary, path) == 0;
+    free(temporary);
+    Journal *journal = AOB->journal;
+    if (!result || journal == NULL) return result;
+    // after a crash before the truncation the snapshot skips the records it holds; the new id is written
+    // only after the truncation, so the records of the old journal are never replayed under it
+    result = fflush(journal->file) == 0 && ftruncate(fileno(journal->file), JOURNAL_HEADER_LENGTH) == 0
+             && fsync(fileno(journal->file)) == 0 && journal_start(journal) && fseek(journal->file, 0, SEEK_END) == 0;
+    if (current_base != NULL)
+        journal_append(AOB, JOURNAL_NEW, current_base->name, NULL);
+    journal_sync(journal);
+    return result;
+}
+
+/**
+ * Funkcja wypełnia tablicę rodzajów znaków i alokuje bufor wejścia.
+*/
+static void initialize_lexer(void) {
+    for (int i = 0; i < 256; i++)
+        lexer.signs[i] = ERROR;
+    for (int i = '0'; i <= ';'; i++)
+        lexer.signs[i] = NUMBER | SIGN_DIGIT;
+    for (int i = 'a'; i <= 'z'; i++)
+        lexer.signs[i] = lexer.signs[i - 'a' + 'A'] = ERROR | SIGN_ALPHA;
+    lexer.signs['D'] = DEL_OPERATOR | SIGN_ALPHA;
+    lexer.signs['N'] = NEW_OPERATOR | SIGN_ALPHA;
+    lexer.signs['S'] = STATS_OPERATOR | SIGN_ALPHA;
+    lexer.signs['L'] = LOAD_OPERATOR | SIGN_ALPHA;
+    for (const char *white = " \t\n\v\f\r"; *white != '\0'; white++)
+        lexer.signs[(unsigned char)*white] = WHITE_SIGN | SIGN_WHITE;
+    lexer.signs['$'] = COMMENT;
+    lexer.signs['?'] = Q_MARK;
+    lexer.signs['>'] = LARGER_CHARACTER;
+    lexer.signs['@'] = AT;
+    for (int i = 1; i < 256; i++) // a file name ends at a white sign or a comment
+        if (!(lexer.signs[i] & SIGN_WHITE) && i != '$')
+            lexer.signs[i] |= SIGN_PATH;
+    lexer.capacity = LEXER_BLOCK_LENGTH;
+    lexer.buffer = malloc(lexer.capacity + 1);
+    if (lexer.buffer == NULL) {
+        fprintf(stderr, "Błąd alokowania pamięci");
+        exit(1);
+    }
+    lexer.position = lexer.end = 0;
+    lexer.pin = NO_PIN;
+}
+
+/**
+ * Funkcja zwalnia bufory, na które wskazywały tokeny poprzedniego polecenia.
+*/
+static void release_tokens(void) {
+    for (size_t i = 0; i < lexer.retired_count; i++)
+        free(lexer.retired[i]);
+    free(lexer.retired);
+    lexer.retired = NULL;
+    lexer.retired_count = 0;
+    lexer.holding = false;
+}
+
+/**
+ * Funkcja wczytuje kolejny blok standardowego wejścia. Zachowuje
+ * wczytywany właśnie token, a bufor z gotowymi tokenami bieżącego
+ * polecenia odkłada zamiast go nadpisywać.
+ * @return @p true jeśli wczytano jakieś znaki, @p false na końcu wejścia.
+*/
+static bool lexer_fill(void) {
+    if (lexer.eof) return false;
+    size_t keep = lexer.pin < lexer.position ? lexer.pin : lexer.position;
+    size_t length = lexer.end - keep;
+    size_t capacity = lexer.capacity;
+    while (capacity - length < LEXER_BLOCK_LENGTH / 2) // only a very long token makes the buffer grow
+        capacity *= 2;
+    if (lexer.holding || capacity != lexer.capacity) {
+        char *buffer = malloc(capacity + 1);
+        char **retired = lexer.holding ? realloc(lexer.retired, (lexer.retired_count + 1) * sizeof(char *)) : lexer.retired;
+        if (buffer == NULL || (lexer.holding && retired == NULL)) {
+            fprintf(stderr, "Błąd alokowania pamięci");
+            exit(1);
+        }
+        memcpy(buffer, lexer.buffer + keep, length);
+        if (lexer.holding) {
+            lexer.retired = retired;
+            lexer.retired[lexer.retired_count++] = lexer.buffer;
+        }
+        else free(lexer.buffer);
+        lexer.buffer = buffer;
+        lexer.capacity = capacity;
+        lexer.holding = false;
+    }
+    else memmove(lexer.buffer, lexer.buffer + keep, length);
+    lexer.position -= keep;
+    lexer.end = length;
+    if (lexer.pin != NO_PIN)
+        lexer.pin -= keep;
+    run_queries(); // results are written out before waiting for more input, so interactive use sees them at once
+    flush_output();
+    if (lexer.journal != NULL && lexer.journal->pending > 0) // records of a burst must not wait for later input
+        journal_sync(lexer.journal);
+    ssize_t count;
+    do {
+        count = read(STDIN_FILENO, lexer.buffer + lexer.end, lexer.capacity - lexer.end);
+    } while (count < 0 && errno == EINTR);
+    if (count <= 0) {
+        lexer.eof = true;
+        return false;
+    }
+    lexer.end += count;
+    return true;
+}
+
+/**
+ * Funkcja wczytuje jeden znak, tak jak getchar.
+ * @return Wczytany znak albo EOF.
+*/
+static int read_sign(void) {
+    if (lexer.position == lexer.end && !lexer_fill()) return EOF;
+    return (unsigned char)lexer.buffer[lexer.position++];
+}
+
+/**
+ * Funkcja pomija w buforze ciąg znaków z zakresu '0'-';', czyli cyfr,
+ * po osiem bajtów naraz.
+ * @param[in] position - pozycja w buforze.
+ * @return Pozycja pierwszego słowa zawierającego inny znak.
+*/
+static size_t skip_digits(size_t position) {
+    uint64_t word;
+    while (position + sizeof(word) <= lexer.end) {
+        memcpy(&word, lexer.buffer + position, sizeof(word));
+        word ^= 0x3030303030303030u; // digits become 0-11, every byte above 11 or 127 sets its top bit below
+        if ((((word & 0x7f7f7f7f7f7f7f7fu) + 0x7474747474747474u) | word) & 0x8080808080808080u) break;
+        position += sizeof(word);
+    }
+    return position;
+}
+
+/**
+ * Funkcja wczytuje token złożony ze znaków należących do klas @p classes.
+ * Znak następujący po tokenie zostaje wczytany i zastąpiony w buforze
+ * znakiem '\0'.
+ * @param[in] start - pozycja pierwszego znaku tokenu w buforze.
+ * @param[in] classes - klasy znaków tokenu.
+ * @param[out] length - długość tokenu.
+ * @param[out] following_sign - rodzaj znaku wczytanego bezpośrednio po tokenie.
+ * @return Wskaźnik na token w buforze, ważny do wywołania @ref release_tokens.
+*/
+static char *read_token(size_t start, unsigned char classes, size_t *length, int *following_sign) {
+    lexer.pin = start;
+    do {
+        if (classes == SIGN_DIGIT)
+            lexer.position = skip_digits(lexer.position);
+        while (lexer.position < lexer.end && (lexer.signs[(unsigned char)lexer.buffer[lexer.position]] & classes))
+            lexer.position++;
+    } while (lexer.position == lexer.end && lexer_fill());
+    char *token = lexer.buffer + lexer.pin;
+    *length = lexer.position - lexer.pin;
+    lexer.pin = NO_PIN;
+    lexer.holding = true;
+    *following_sign = recognize_input(read_sign());
+    token[*length] = '\0';
+    return token;
+}
+
+/**
+ * Funkcja wczytuje ciąg białych znaków i pierwszy znak po nim.
+ * @param[out] byte_number - wskaźnik na liczbę bajtów.
+ * @return Pierwszy znak, który nie jest biały, albo EOF.
+*/
+static int skip_white_signs(size_t *byte_number) {
+    do {
+        size_t start = lexer.position;
+        while (lexer.position < lexer.end && (lexer.signs[(unsigned char)lexer.buffer[lexer.position]] & SIGN_WHITE))
+            lexer.position++;
+        *byte_number += lexer.position - start;
+    } while (lexer.position == lexer.end && lexer_fill());
+    *byte_number += 1;
+    return read_sign();
+}
+
+/**
+ * Funkcja pomija treść komentarza aż do najbliższego znaku '$',
+ * nie wczytując go.
+ * @param[out] byte_number - wskaźnik na liczbę bajtów.
+*/
+static void skip_comment_text(size_t *byte_number) {
+    do {
+        char *dollar = memchr(lexer.buffer + lexer.position, '$', lexer.end - lexer.position);
+        size_t stop = dollar != NULL ? (size_t)(dollar - lexer.buffer) : lexer.end;
+        *byte_number += stop - lexer.position;
+        lexer.position = stop;
+    } while (lexer.position == lexer.end && lexer_fill());
+}
+
+void set_query_workers(int count) {
+    batch.worker_count = count;
+}
+
+/**
+ * Funkcja wykonuje zapytania partii, biorąc je po QUERY_CHUNK naraz.
+ * Kolejne zapytania '?' do tej samej bazy są wykonywane jednym
+ * wywołaniem @ref phfwdGetBatch.
+*/
+static void work_queries(void) {
+    char const *numbers[QUERY_CHUNK];
+    PhoneNumbers const *results[QUERY_CHUNK];
+    size_t first;
+    while ((first = atomic_fetch_add(&batch.next, QUERY_CHUNK)) < batch.count) {
+        size_t last = first + QUERY_CHUNK < batch.count ? first + QUERY_CHUNK : batch.count;
+        for (size_t i = first; i < last; ) {
+            Query *query = &batch.queries[i];
+            if (query->reverse) {
+                query->result = phfwdReverse(query->base, batch.text + query->number);
+                i++;
+                continue;
+            }
+            size_t run = 0;
+            for (; i + run < last && !query[run].reverse && query[run].base == query->base; run++)
+                numbers[run] = batch.text + query[run].number;
+            phfwdGetBatch(query->base, numbers, run, results);
+            for (size_t j = 0; j < run; j++)
+                query[j].result = results[j];
+            i += run;
+        }
+    }
+}
+
+/**
+ * Funkcja wątku pomocniczego, wykonująca kolejne partie zapytań.
+ * @param[in] argument - nieużywany.
+ * @return NULL.
+*/
+static void *query_worker(void *argument) {
+    (void)argument;
+    unsigned round = 0;
+    pthread_mutex_lock(&batch.mutex);
+    for (;;) {
+        while (batch.round == round && !batch.stop)
+            pthread_cond_wait(&batch.start, &batch.mutex);
+        if (batch.stop) break;
+        round = batch.round;
+        pthread_mutex_unlock(&batch.mutex);
+        work_queries();
+        pthread_mutex_lock(&batch.mutex);
+        if (--batch.active == 0)
+            pthread_cond_signal(&batch.done);
+    }
+    pthread_mutex_unlock(&batch.mutex);
+    return NULL;
+}
+
+/**
+ * Funkcja przygotowuje partię zapytań i uruchamia wątki pomocnicze.
+ * @param[in] AOB - wskaźnik na strukturę ArrayOfBases.
+*/
+static void start_queries(ArrayOfBases *AOB) {
+    batch.AOB = AOB;
+    batch.queries = malloc(QUERY_BATCH_LENGTH * sizeof(Query));
+    if (batch.queries == NULL) {
+        fprintf(stderr, "Błąd alokowania pamięci");
+        exit(1);
+    }
+    if (batch.worker_count < 0) { // by default every online processor takes part, the reading thread included
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        batch.worker_count = processors > 1 ? processors - 1 : 0;
+    }
+    batch.workers = malloc(batch.worker_count * sizeof(pthread_t));
+    int started = 0;
+    while (batch.workers != NULL && started < batch.worker_count && pthread_create(&batch.workers[started], NULL, query_worker, NULL) == 0)
+        started++;
+    batch.worker_count = started;
+}
+
+/**
+ * Funkcja kończy wątki pomocnicze i zwalnia partię zapytań.
+*/
+static void stop_queries(void) {
+    pthread_mutex_lock(&batch.mutex);
+    batch.stop = true;
+    pthread_cond_broadcast(&batch.start);
+    pthread_mutex_unlock(&batch.mutex);
+    for (int i = 0; i < batch.worker_count; i++)
+        pthread_join(batch.workers[i], NULL);
+    free(batch.workers);
+    free(batch.queries);
+    free(batch.text);
+}
+
+/**
+ * Funkcja wypisuje kolejny numer wyniku zapytania o przekierowania na numer.
+ * Przekazywana do @ref phfwdReverseVisit.
+ * @param[in] number - wskaźnik na numer.
+ * @param[in, out] data - wskaźnik na licznik wypisanych numerów.
+ * @return Zawsze @p true.
+*/
+static bool print_reverse(const char *number, void *data) {
+    print_line(number, strlen(number));
+    (*(size_t *)data)++;
+    return true;
+}
+
+/**
+ * Funkcja dodaje zapytanie do partii. Pełna partia jest najpierw wykonywana.
+ * Jeśli nie ma wątków pomocniczych, zapytanie jest wykonywane od razu.
+ * @param[in] base - wskaźnik na bazę, której dotyczy zapytanie.
+ * @param[in] number - wskaźnik na numer.
+ * @param[in] byte_number - liczba wczytanych dotąd bajtów.
+ * @param[in] reverse - czy jest to zapytanie o przekierowania na numer.
+*/
+static void queue_query(PhoneForward *base, const char *number, size_t byte_number, bool reverse) {
+    if (batch.worker_count == 0 && reverse) { // reverse results are streamed into the output buffer
+        size_t printed = 0;
+        if (!phfwdReverseVisit(base, number, NULL, 0, print_reverse, &printed) || printed == 0)
+            handle_error(byte_number, batch.AOB, "ERROR ?");
+        if (output.policy == OUTPUT_LINE)
+            flush_output();
+        return;
+    }
+    if (batch.worker_count == 0) { // with no helpers the query is answered at once, without copying
+        print_numbers(phfwdGet(base, number), byte_number, batch.AOB);
+        return;
+    }
+    if (batch.count == QUERY_BATCH_LENGTH)
+        run_queries();
+    size_t length = strlen(number) + 1;
+    if (batch.text_length + length > batch.text_capacity) {
+        size_t capacity = batch.text_capacity > 0 ? batch.text_capacity : OUTPUT_BUFFER_LENGTH;
+        while (capacity < batch.text_length + length)
+            capacity *= 2;
+        char *text = realloc(batch.text, capacity);
+        if (text == NULL) {
+            fprintf(stderr, "Błąd alokowania pamięci");
+            exit(1);
+        }
+        batch.text = text;
+        batch.text_capacity = capacity;
+    }
+    memcpy(batch.text + batch.text_length, number, length);
+    batch.queries[batch.count++] = (Query){base, batch.text_length, byte_number, reverse, NULL};
+    batch.text_length += length;
+}
+
+/**
+ * Funkcja wykonuje wszystkie zapytania partii, równolegle, jeśli jest ich
+ * dość dużo, a następnie wypisuje ich wyniki w kolejności wczytania.
+ * Musi zostać wywołana przed każdą zmianą baz i przed każdym innym
+ * wypisaniem, w tym komunikatu o błędzie.
+*/
+static void run_queries(void) {
+    size_t count = batch.count;
+    if (count == 0) return;
+    atomic_store(&batch.next, 0);
+    if (batch.worker_count > 0 && count > QUERY_CHUNK) {
+        pthread_mutex_lock(&batch.mutex);
+        batch.round++;
+        batch.active = batch.worker_count;
+        pthread_cond_broadcast(&batch.start);
+        pthread_mutex_unlock(&batch.mutex);
+        work_queries();
+        pthread_mutex_lock(&batch.mutex);
+        while (batch.active > 0)
+            pthread_cond_wait(&batch.done, &batch.mutex);
+        pthread_mutex_unlock(&batch.mutex);
+    }
+    else work_queries();
+    batch.count = batch.text_length = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (phnumGet(batch.queries[i].result, 0) == NULL) { // later results are dropped, as if the program stopped at this query
+            for (size_t j = i; j < count; j++)
+                phnumDelete(batch.queries[j].result);
+            handle_error(batch.queries[i].byte_number, batch.AOB, "ERROR ?");
+        }
+        print_numbers(batch.queries[i].result, batch.queries[i].byte_number, batch.AOB);
+    }
+}
         
 bool is_number(char x) {
      return ((x >= '0' && x <= '9') || x == ':' || x == ';');
 }
 
 int recognize_input(char sign) { // Checking if a 'sign' matches some enums
-    if (isspace(sign)) return WHITE_SIGN;
-    else if (is_number(sign)) return NUMBER;
-    else if (sign == '$') return COMMENT;
-    else if (sign == '?') return Q_MARK;
-    else if (sign == '>') return LARGER_CHARACTER;
-    else if (sign == 'D') return DEL_OPERATOR;
-    else if (sign == 'N') return NEW_OPERATOR;
-    else if (sign == '@') return AT;
-    else return ERROR;
+    return lexer.signs[(unsigned char)sign] & SIGN_TYPE;
 }
 
 void error_eof(ArrayOfBases *AOB) {
+    run_queries();
+    flush_output();
     fprintf(stderr, "ERROR EOF\n");
     clear(AOB);
     exit(1);
 }
 
-char *read_whole_number(int *byte_number, char sign, int *following_sign) { // reading a number after we saw its first digit, which is 'sign' 
-    int current_length = 0;
-    int max_length = BASIC_LENGTH_OF_NUMBER;
-    char *number = malloc((max_length+1)*sizeof(char));
-    while (is_number(sign) && !feof(stdin)) { // reading all the digits
-        if (current_length == max_length - 1) {
-            max_length *= 2;
-            number = realloc(number, (max_length + 1)*sizeof(char));
-        }
-        number[current_length] = sign;
-        current_length++;
-        sign = getchar();
-    }
-	*following_sign = recognize_input(sign); // checking what is the following sign after number so handle_input() knows how to behave next.
-    number[current_length] = '\0';
-    *byte_number += (current_length);
+char *read_whole_number(size_t *byte_number, int *following_sign) { // reading a number after we read its first digit
+    size_t current_length;
+    char *number = read_token(lexer.position - 1, SIGN_DIGIT, &current_length, following_sign);
+    *byte_number += current_length;
     return number;
 }
     
-char *find_number(int *byte_numbers, ArrayOfBases *AOB, int *following_sign, char *number) { // looking for a number without knowing its first character
+char *find_number(size_t *byte_numbers, ArrayOfBases *AOB, int *following_sign) { // looking for a number without knowing its first character
     char sign;
     do {
-        sign = getchar();
+        sign = read_sign();
         *byte_numbers += 1;
         *following_sign = recognize_input(sign);
         if (*following_sign == COMMENT)
             handle_comment(AOB, byte_numbers);
-    } while ((*following_sign == WHITE_SIGN || *following_sign == COMMENT) && !feof(stdin)); // deleting all comments all white signs in that loop
-    if (feof(stdin)) {
-	free(number);
+    } while ((*following_sign == WHITE_SIGN || *following_sign == COMMENT) && !lexer.eof); // deleting all comments all white signs in that loop
+    if (lexer.eof) {
         error_eof(AOB);
 	    return NULL;
     }
     else if (!is_number(sign)) { // if a first found character other than white sign is not a digit, then its an error.
                                 // It means that we can only use this function in specific context.
-	free(number);
         handle_error(*byte_numbers, AOB, "ERROR");
         return NULL;
     }
-    else return read_whole_number(byte_numbers, sign, following_sign); // returning a number with 'sign' as its first digit
+    else return read_whole_number(byte_numbers, following_sign); // returning a number with 'sign' as its first digit
 }
         
 bool is_operator(char sign) {
     return (sign == '>' || sign == '?');
 }
 
-int search_for_operator(ArrayOfBases *AOB, int *byte_number, char *number) { // looking for '?' or '>' sign
+int search_for_operator(ArrayOfBases *AOB, size_t *byte_number) { // looking for '?' or '>' sign
     char sign;
     do {
-        sign = getchar();
+        sign = read_sign();
         *byte_number += 1;
-    } while (isspace(sign) && !feof(stdin)); // deleting all white signs
-    if (feof(stdin)) {
+    } while (recognize_input(sign) == WHITE_SIGN && !lexer.eof); // deleting all white signs
+    if (lexer.eof) {
         error_eof(AOB);
         return -1;
     }
@@ -258,7 +1439,6 @@ int search_for_operator(ArrayOfBases *AOB, int *byte_number, char *number) { //
     else if (sign == '$')
         return COMMENT;
     else {
-        free(number);
         handle_error(*byte_number, AOB, "ERROR");
         return -1;
     }
@@ -269,29 +1449,30 @@ bool is_comment(int enum_type) { // just checking if enum types are the one for
 }
 
 
-void handle_comment(ArrayOfBases *AOB, int *byte_number) {
+void handle_comment(ArrayOfBases *AOB, size_t *byte_number) {
     char sign;
     int type_of_comment = COMMENT;
-    while(!feof(stdin) && is_comment(type_of_comment)) {
+    while(!lexer.eof && is_comment(type_of_comment)) {
         *byte_number += 1;
         switch(type_of_comment) {
             case COMMENT: // case when we just started a potential comment with '$' sign
-                sign = getchar();
+                sign = read_sign();
                 if (sign == '$')
                     type_of_comment = COMMENT_ON;
                 else handle_error(*byte_number, AOB, "ERROR"); // thats what happens if there is no following '$' sign after the first one
                 break;
 
             case COMMENT_ON: // processing comment
-                sign = getchar();
-                if (feof(stdin))
+                skip_comment_text(byte_number);
+                sign = read_sign();
+                if (lexer.eof)
                     error_eof(AOB);
                 if (sign == '$') // putting on alert if we see '$' sign
                     type_of_comment = COMMENT_ALMOST_DONE;
                 break;
 
             case COMMENT_ALMOST_DONE:
-                sign = getchar();
+                sign = read_sign();
                 if (sign == '$') { // thats a time to stop comment
                     type_of_comment = -1;
                 }
@@ -299,78 +1480,49 @@ void handle_comment(ArrayOfBases *AOB, int *byte_number) {
                 break;
         }
     }
-    if (feof(stdin) && (type_of_comment == COMMENT_ALMOST_DONE || type_of_comment == COMMENT_ON)) // case when input finished without finishing comment
+    if (lexer.eof && (type_of_comment == COMMENT_ALMOST_DONE || type_of_comment == COMMENT_ON)) // case when input finished without finishing comment
         error_eof(AOB);
     
 }
 
 bool correct_ID(char sign) {
-    return isalpha(sign) || is_number(sign);
+    return lexer.signs[(unsigned char)sign] & (SIGN_ALPHA | SIGN_DIGIT);
 }
 
-char *get_string(ArrayOfBases *AOB, int *byte_numbers, int *type_of_input, size_t operator) {
-    int current_length = 0;
-    int max_length = BASIC_LENGTH_OF_WORD;
+char *get_string(ArrayOfBases *AOB, size_t *byte_numbers, int *type_of_input, size_t operator) {
     char sign;
     do {
-        sign = getchar();
+        sign = read_sign();
         *byte_numbers += 1;
         *type_of_input = recognize_input(sign);
         if (*type_of_input == COMMENT)
             handle_comment(AOB, byte_numbers);
-    } while ((*type_of_input == WHITE_SIGN || *type_of_input == COMMENT) && !feof(stdin)); // deleting all comments all white signs in that loop
-    if (feof(stdin))
+    } while ((*type_of_input == WHITE_SIGN || *type_of_input == COMMENT) && !lexer.eof); // deleting all comments all white signs in that loop
+    if (lexer.eof)
         error_eof(AOB); 
     if (is_number(sign)) { 
         if (operator == DEL_OPERATOR)
-            return read_whole_number(byte_numbers, sign, type_of_input);
+            return read_whole_number(byte_numbers, type_of_input);
         else if (operator == NEW_OPERATOR)
             handle_error(*byte_numbers, AOB, "ERROR");
     }
-    char *word = malloc((BASIC_LENGTH_OF_WORD+1)*sizeof(char));
-    while (correct_ID(sign) && !feof(stdin)) { // reading whole ID
-        if (current_length == max_length) {
-            max_length *= 2;
-            word = realloc(word, (max_length + 2)*sizeof(char));
-        }
-        word[current_length++] = sign;
-        sign = getchar();
-    }
-    *byte_numbers += current_length;
-    *type_of_input = recognize_input(sign);
-    if (current_length == 0) { // thats case when there was no ID at all
-        free(word);
+    if (!correct_ID(sign)) { // thats case when there was no ID at all
+        *type_of_input = recognize_input(sign);
         return NULL;
     }
-    else {
-        word[current_length] = '\0';
-        return word;
-    }
+    size_t current_length;
+    char *word = read_token(lexer.position - 1, SIGN_ALPHA | SIGN_DIGIT, &current_length, type_of_input); // reading whole ID
+    *byte_numbers += current_length;
+    return word;
 }
 
       
-char *read_rest_of_operator(ArrayOfBases *AOB, int *byte_numbers, int *type_of_input) {
-    int current_length = 0;
-    int max_length = BASIC_LENGTH_OF_WORD;
-    char sign;
-    char *word = malloc((BASIC_LENGTH_OF_WORD+1)*sizeof(char));
-    sign = getchar();
-    *byte_numbers += 1;
-    while (isalpha(sign) && !feof(stdin)) {
-        if (current_length == max_length) {
-            max_length *= 2;
-            word = realloc(word, (max_length + 1)*sizeof(char));
-        }
-        word[current_length++] = sign;
-        sign = getchar();
-        *byte_numbers += 1;
-    }
-    if (feof(stdin)) {
-        free(word);
+char *read_rest_of_operator(ArrayOfBases *AOB, size_t *byte_numbers, int *type_of_input) {
+    size_t current_length;
+    char *word = read_token(lexer.position, SIGN_ALPHA, &current_length, type_of_input);
+    *byte_numbers += current_length + 1;
+    if (lexer.eof)
         error_eof(AOB);
-    }
-    word[current_length] = '\0';
-    *type_of_input = recognize_input(sign);
     return word;
 }
     
@@ -380,9 +1532,9 @@ int max(int a, int b) {
 }
 
 size_t count_digits(char *set) {
-    int length = strlen(set);
-    int counter = 0;
-    for (int i = 0; i < length; i++) 
+    size_t length = strlen(set);
+    size_t counter = 0;
+    for (size_t i = 0; i < length; i++) 
         if (is_number(set[i]))
             counter++;
     return counter;
@@ -394,35 +1546,38 @@ void handle_input(ArrayOfBases *AOB, PfBase *current_base) {
     tmp = NULL;
     char *number, *number2, *word;
     number = number2 = word = NULL;
-    int type_of_input, byte_number, index, current_byte_number;
-    index = 0;
-    char sign = getchar();
+    int type_of_input;
+    size_t byte_number, current_byte_number;
+    initialize_lexer();
+    lexer.journal = AOB->journal;
+    start_queries(AOB);
+    char sign = read_sign();
     type_of_input = recognize_input(sign);
     byte_number = 1;
-	while(!feof(stdin)) {
+	while(!lexer.eof) {
+        release_tokens(); // tokens of the previous command are no longer used
         switch(type_of_input) {
 
             case WHITE_SIGN:
-                sign = getchar();
+                sign = skip_white_signs(&byte_number);
                 type_of_input = recognize_input(sign);
-                byte_number++;
                 break;
 
             case COMMENT:
                 handle_comment(AOB, &byte_number);
-                sign = getchar();
+                sign = read_sign();
                 byte_number++;
                 type_of_input = recognize_input(sign);
                 break;
 
             case NUMBER:
-                number = read_whole_number(&byte_number, sign, &type_of_input); // reading whole number that just started
+                number = read_whole_number(&byte_number, &type_of_input); // reading whole number that just started
                 while (type_of_input == WHITE_SIGN || type_of_input == COMMENT) { // loop in order to delete all comments and white signs
                     if (type_of_input == WHITE_SIGN)
-                        type_of_input = search_for_operator(AOB, &byte_number, number);
+                        type_of_input = search_for_operator(AOB, &byte_number);
                     else if (type_of_input == COMMENT) {
                         handle_comment(AOB, &byte_number);
-                        sign = getchar();
+                        sign = read_sign();
                         byte_number++;
                         type_of_input = recognize_input(sign);
                     }
@@ -431,56 +1586,47 @@ void handle_input(ArrayOfBases *AOB, PfBase *current_base) {
 
                     case Q_MARK: // case when '?' is after the number
                         if (current_base == NULL) {
-                            free(number);
                             handle_error(byte_number, AOB, "ERROR ?");
                         }
                         else {
-                            print_numbers(phfwdGet(current_base->base, number), byte_number, AOB, number);
-                            sign = getchar();
+                            queue_query(current_base->base, number, byte_number, false);
+                            sign = read_sign();
                             type_of_input = recognize_input(sign);
                             byte_number++;
-                            free(number);
-                            number = NULL;
                         }
                         break;
                     
                     case LARGER_CHARACTER: // case when '>' is after the number
                         if (current_base == NULL) { // if we have no current base then we cant perform the '>' operator
-                            free(number);
                             handle_error(byte_number, AOB, "ERROR >");
                         }
                         else {
                             current_byte_number = byte_number; // used to give correct byte number in case it goes wrong
-                            number2 = find_number(&byte_number, AOB, &type_of_input, number);
+                            number2 = find_number(&byte_number, AOB, &type_of_input);
+                            run_queries(); // queries read before a change see the bases as they were
                             if (!phfwdAdd(current_base->base, number, number2)) { // This case means that adding redirection went wrong
-                                free(number);
-                                free(number2);
                                 handle_error(current_byte_number, AOB, "ERROR >");
                             }
-                            free(number);
-                            free(number2);
-                            number = number2 = NULL;
+                            journal_append(AOB, JOURNAL_ADD, number, number2);
                         }
                         break;
                 
                     default: // every other case is wrong
-                        free(number);
                         handle_error(byte_number, AOB, "ERROR");
                         break;
                 }
                 break;
 
             case NEW_OPERATOR: // we see that there's a 'N' letter
+                current_byte_number = byte_number; // Using it in order to call ERROR NEW with that number
                 word = read_rest_of_operator(AOB, &byte_number, &type_of_input);
                 if (strcmp(word, "EW") != 0) { // need to check if its really the 'NEW' expression
-                    free(word);
                     handle_error(byte_number, AOB, "ERROR");
                 }
                 else {
                     if (type_of_input == COMMENT) { // case when we have comment right after NEW
                         handle_comment(AOB, &byte_number);
                     }
-                    free(word);
                     word = get_string(AOB, &byte_number, &type_of_input, NEW_OPERATOR); // Getting next string after NEW command
                     if (word == NULL) { // case when there is no following sings to read
 			            handle_error(byte_number, AOB, "ERROR");
@@ -489,22 +1635,43 @@ void handle_input(ArrayOfBases *AOB, PfBase *current_base) {
                         handle_error(byte_number-1, AOB, "ERROR");
                     }
                     if (strcmp(word, "NEW") == 0 || strcmp(word, "DEL") == 0) { // cant have that ID
-                        free(word);
                         handle_error(byte_number, AOB, "ERROR");
                     }
-                    tmp = find_base(AOB, &index, word);
-                    if (tmp == NULL) { // if there's no base with ID we just received
-                        
-                        tmp = insert_base(AOB, index, word);
-                        if (tmp == NULL) { // memory error
-                            free(word);
+                    while (!lexer.eof && (type_of_input == WHITE_SIGN || type_of_input == COMMENT)) { // a '>' may follow, as in NEW ID > PARENT
+                        if (type_of_input == COMMENT) {
+                            handle_comment(AOB, &byte_number);
+                            sign = read_sign();
+                            byte_number++;
+                        }
+                        else sign = skip_white_signs(&byte_number);
+                        type_of_input = recognize_input(sign);
+                    }
+                    tmp = find_base(AOB, word);
+                    if (type_of_input == LARGER_CHARACTER && !lexer.eof) { // the new base is a copy of PARENT
+                        number = get_string(AOB, &byte_number, &type_of_input, NEW_OPERATOR);
+                        if (number == NULL || strcmp(number, "NEW") == 0 || strcmp(number, "DEL") == 0)
+                            handle_error(byte_number, AOB, "ERROR");
+                        PfBase *parent = find_base(AOB, number);
+                        if (tmp != NULL || parent == NULL) // the copy needs a free ID and an existing parent
+                            handle_error(current_byte_number, AOB, "ERROR NEW");
+                        run_queries(); // copying may thaw the parent that queued queries read
+                        tmp = clone_base(AOB, word, parent);
+                        if (tmp == NULL)
                             handle_error(byte_number, AOB, "MEMORY ERROR");
+                        current_base = tmp;
+                        journal_append(AOB, JOURNAL_CLONE, word, number);
+                    }
+                    else {
+                        if (tmp == NULL) { // if there's no base with ID we just received
+                            tmp = insert_base(AOB, word);
+                            if (tmp == NULL) { // memory error
+                                handle_error(byte_number, AOB, "MEMORY ERROR");
+                            }
+                            else current_base = tmp;
                         }
-                        else current_base = tmp;
+                        else current_base = tmp; // if there already is base with such ID, we just take it
+                        journal_append(AOB, JOURNAL_NEW, word, NULL);
                     }
-                    else current_base = tmp; // if there already is base with such ID, we just take it
-                    free(word);
-                    word = NULL;
                 }
                 break;
                         
@@ -513,70 +1680,104 @@ void handle_input(ArrayOfBases *AOB, PfBase *current_base) {
                 current_byte_number = byte_number; // Using it in order to call ERROR DEL with that number
                 word = read_rest_of_operator(AOB, &byte_number, &type_of_input);
                 if (strcmp(word, "EL") != 0) { // need to check if its really 'DEL'
-                    free(word);
                     handle_error(byte_number, AOB, "ERROR");
                 }
                 else {
                         if (type_of_input == COMMENT) { // case when there is comment right after DEL
                         handle_comment(AOB, &byte_number);
                     }
-                    free(word);
                     word = get_string(AOB, &byte_number, &type_of_input, DEL_OPERATOR); // getting ID of base we have to delete
                     if (word == NULL) { // case when there is no following sings to read
 			            handle_error(byte_number, AOB, "ERROR");
 		            }
+                    run_queries();
                     if (current_base != NULL && strcmp(current_base->name, word) == 0) // case when we delete a current base
                         current_base = NULL;
-                    if (is_number(word[0]) )
+                    if (is_number(word[0]) ) {
                         phfwdRemove(current_base->base, word);
+                        journal_append(AOB, JOURNAL_DEL_NUMBER, word, NULL);
+                    }
                     else if (delete_base(AOB, word) == ERROR) { // if deleting goes wrong
-                        free(word);
                         handle_error(current_byte_number, AOB, "ERROR DEL");
                     }
-                    free(word); // if deleting goes fine we just continue
+                    else journal_append(AOB, JOURNAL_DEL_BASE, word, NULL);
+                }
+                break;
+
+            case STATS_OPERATOR: // seeing a 'S' letter in input
+                word = read_token(lexer.position, SIGN_ALPHA, &current_byte_number, &type_of_input);
+                byte_number += current_byte_number + 1;
+                if (strcmp(word, "TATS") != 0 || (!lexer.eof && type_of_input != WHITE_SIGN && type_of_input != COMMENT)) // STATS has to end here
+                    handle_error(byte_number, AOB, "ERROR");
+                run_queries();
+                print_stats(AOB, current_base, byte_number);
+                break;
+
+            case LOAD_OPERATOR: // seeing a 'L' letter in input
+                current_byte_number = byte_number; // Using it in order to call ERROR LOAD with that number
+                word = read_rest_of_operator(AOB, &byte_number, &type_of_input);
+                if (strcmp(word, "OAD") != 0 || (type_of_input != WHITE_SIGN && type_of_input != COMMENT)) // a file name follows after a white sign
+                    handle_error(byte_number, AOB, "ERROR");
+                while (!lexer.eof && (type_of_input == WHITE_SIGN || type_of_input == COMMENT)) {
+                    if (type_of_input == COMMENT) {
+                        handle_comment(AOB, &byte_number);
+                        sign = read_sign();
+                        byte_number++;
+                    }
+                    else sign = skip_white_signs(&byte_number);
+                    type_of_input = recognize_input(sign);
                 }
+                if (lexer.eof)
+                    error_eof(AOB);
+                if (!(lexer.signs[(unsigned char)sign] & SIGN_PATH))
+                    handle_error(byte_number, AOB, "ERROR");
+                size_t path_length;
+                word = read_token(lexer.position - 1, SIGN_PATH, &path_length, &type_of_input); // reading the whole file name
+                byte_number += path_length;
+                run_queries(); // queries read before a change see the bases as they were
+                if (current_base == NULL || !load_rules(AOB, current_base, word))
+                    handle_error(current_byte_number, AOB, "ERROR LOAD");
                 break;
 
             case Q_MARK: // This is case when '?' is before the number
                 if (current_base != NULL) { // if current base is NULL then this operation is wrong
                     do {
-                        sign = getchar();
+                        sign = read_sign();
                         byte_number++;
                         type_of_input = recognize_input(sign);
                         if (type_of_input == COMMENT)
                             handle_comment(AOB, &byte_number);
-                        } while ((type_of_input == WHITE_SIGN || type_of_input == COMMENT) && !feof(stdin)); // deleting all comments all white signs in that loop
-                    if (feof(stdin)) //if we get to the end of the file before finding number
+                        } while ((type_of_input == WHITE_SIGN || type_of_input == COMMENT) && !lexer.eof); // deleting all comments all white signs in that loop
+                    if (lexer.eof) //if we get to the end of the file before finding number
                         error_eof(AOB);
                     else if (!is_number(sign)) //if there is other sing than number and white sign after '?' operator
                         handle_error(byte_number, AOB, "ERROR");
                     else {
-                        number = read_whole_number(&byte_number, sign, &type_of_input); // reading the number
-                        print_numbers(phfwdReverse(current_base->base, number), byte_number, AOB, number); // performing phfwdReverse
-                        free(number);
-                        number = NULL;
+                        number = read_whole_number(&byte_number, &type_of_input); // reading the number
+                        queue_query(current_base->base, number, byte_number, true); // performing phfwdReverse
                     }
                     
                 }
                 else {
-                    free(number);
                     handle_error(byte_number, AOB, "ERROR ?");
                 }
                 break;
 
             case AT:
                 if (current_base != NULL) {
-                    if (feof(stdin)) //if we get to the end of the file before finding number
+                    if (lexer.eof) //if we get to the end of the file before finding number
                         error_eof(AOB);
                     else {
                         number = get_string(AOB, &byte_number, &type_of_input, AT);
-                        printf("%zu\n", phfwdNonTrivialCount(current_base->base, number, max(0, count_digits(number) - 12)));
-                        free(number);
-                        number = NULL;
+                        run_queries();
+                        char count[24];
+                        size_t digits = count_digits(number);
+                        print_line(count, sprintf(count, "%zu", phfwdNonTrivialCount(current_base->base, number, digits > 12 ? digits - 12 : 0)));
+                        if (output.policy == OUTPUT_LINE)
+                            flush_output();
                     }
                 }   
                 else {
-                    free(number);
                     handle_error(byte_number, AOB, "ERROR @");
                 }
                 break;         
@@ -593,6 +1794,11 @@ void handle_input(ArrayOfBases *AOB, PfBase *current_base) {
         }
     
     }
+    run_queries();
+    stop_queries();
+    release_tokens();
+    free(lexer.buffer);
+    flush_output();
 }
 
         
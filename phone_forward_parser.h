@@ -13,7 +13,7 @@
 #include <stdbool.h>
 #include "phone_forward.h"
 #include <string.h>
-#include <ctype.h>
+#include <stdint.h>
 
 /** 
  * Struktura przechowująca bazę przekierowań.
@@ -38,7 +38,19 @@ typedef struct PfBase PfBase;
 /**
  * Enumerator ułatwiający czytanie wejścia.
 */
-enum State_of_program {COMMENT, WHITE_SIGN, NUMBER, Q_MARK, LARGER_CHARACTER, ID, NEW_OPERATOR, DEL_OPERATOR, ERROR, SUCCESS, COMMENT_ON, COMMENT_ALMOST_DONE, AT};
+enum State_of_program {COMMENT, WHITE_SIGN, NUMBER, Q_MARK, LARGER_CHARACTER, ID, NEW_OPERATOR, DEL_OPERATOR, ERROR, SUCCESS, COMMENT_ON, COMMENT_ALMOST_DONE, AT, STATS_OPERATOR, LOAD_OPERATOR};
+
+/**
+ * Enumerator typów rekordów dziennika zmian.
+*/
+enum Journal_record {JOURNAL_NEW = 'N', JOURNAL_DEL_BASE = 'D', JOURNAL_ADD = '>', JOURNAL_DEL_NUMBER = 'R', JOURNAL_CLONE = 'C'};
+
+/**
+ * Enumerator sposobów opróżniania bufora wyjścia. Przy OUTPUT_BLOCK bufor
+ * jest opróżniany, gdy się zapełni, przed oczekiwaniem na dalsze wejście
+ * i przy zakończeniu programu. Przy OUTPUT_LINE dodatkowo po każdym poleceniu.
+*/
+enum Output_policy {OUTPUT_BLOCK, OUTPUT_LINE};
 
 /** @brief Funkcja do czysczenia pamięci po strukturze ArrayOfBases
  * Usuwa pamięć zaalokowaną przez @ref initialize_array_of_bases.
@@ -54,19 +66,35 @@ void clear(ArrayOfBases *AOB);
  * @param[in] AOB - wskaźnik na strukturę ArrayOfBases.
  * @param[in] error_info - wskaźnik na komunikat który ma zostać wypisany.
 */
-void handle_error(int byte_number, ArrayOfBases *AOB, char *error_info);
+void handle_error(size_t byte_number, ArrayOfBases *AOB, char *error_info);
+
+/** @brief Ustawia sposób opróżniania bufora wyjścia.
+ * Domyślnym sposobem jest OUTPUT_BLOCK.
+ * @param[in] policy - sposób opróżniania, zob. @ref Output_policy.
+*/
+void set_output_policy(int policy);
+
+/** @brief Ustawia liczbę wątków pomocniczych wykonujących zapytania.
+ * Zapytania '?' między kolejnymi zmianami baz są zbierane w partie
+ * i wykonywane równolegle przez wątek czytający wejście i wątki pomocnicze,
+ * a ich wyniki są wypisywane w kolejności zapytań. Domyślnie wątków
+ * pomocniczych jest o jeden mniej niż dostępnych procesorów. Funkcję
+ * należy wywołać przed @ref handle_input.
+ * @param[in] count - liczba wątków pomocniczych; 0 oznacza wykonywanie
+ *                    zapytań tylko przez wątek czytający wejście.
+*/
+void set_query_workers(int count);
 
 /** @brief Funkcja wypisująca numery na standardowe wyjście.
  * Funkcja wypisuje numery, każdy od nowej linii, 
- * które są przechowywane w pnum. Może też obsłużyć błąd
+ * które są przechowywane w pnum. Numery trafiają do bufora wyjścia,
+ * zob. @ref set_output_policy. Może też obsłużyć błąd
  * i zakończyć program, jeśli pnum jest puste.
  * @param[in] pnum - Wskaźnik na strukturę PhoneNumbers, z której będziemy wypisywać numery.
  * @param[in] byte_numbers - liczba wczytanych dotąd bajtów.
  * @param[in] AOB - wskaźnik na strukturę ArrayOfBases. 
- * @param[in] number - wskaźnik na napis zaalakowany wcześniej.
- * Używany jest on do zwolnienia pamięci w przypadku błędu.
 */ 
-void print_numbers(PhoneNumbers const *pnum, int byte_numbers, ArrayOfBases *AOB, char *number);
+void print_numbers(PhoneNumbers const *pnum, size_t byte_numbers, ArrayOfBases *AOB);
 
 /** @brief Funkcja tworząca bazę.
  * Funkcja tworzy bazę o podanej nazwie i zwraca wskaźnik na nią.
@@ -76,55 +104,45 @@ void print_numbers(PhoneNumbers const *pnum, int byte_numbers, ArrayOfBases *AOB
 */
 PfBase *create_base(const char *name);
 
-/** @brief Funkcja przesuwająca tablicę o jeden w prawo.
- * Funkcja przesuwa tablicę zawierającą wskaźniki na strukturę PfBase
- * o jeden w prawo, aby można było wprowadzić do tej tablicy nowy wskaźnik
- * w odpowiednim miejscu.
- * @param[in] Array - wskaźnik na tablicę.
- * @param[in] index - indeks od którego tablica ma zostać przesunięta w prawo.
- * @param[in] current_length - bieżąca długość tablicy.
-*/
-void move_array_right(PfBase *Array[], int index, int current_length);
-
-/** @brief Funkcja przesuwająca tablicę o jeden w lewo.
- * Funkcja przesuwa tablicę zawierającą wskaźniki na strukturę PfBase
- * o jeden w lewo, aby zachować jedność tablicy po usunięciu jednego elementu
- * ze środka.
- * @param[in] Array - wskaźnik na tablicę.
- * @param[in] index - indeks od którego tablica ma zostać przesunięta w lewo.
- * @param[in] current_length - bieżąca długość tablicy.
+/** @brief Funkcja wstawiająca bazę w tablicę baz.
+ * Funkcja tworzy bazę o nazwie base_name i dodaje ją do tablicy baz
+ * oraz do tablicy haszującej. Nie sprawdza, czy baza o tej nazwie już
+ * istnieje, robi to @ref find_base.
+ * @param[in] AOB - wskaźnik na strukturę ArrayOfBases, do której wstawiamy bazę.
+ * @param[in] base_name - nazwa bazy, którą mamy wstawić.
+ * @return Wskaźnik na nowo utworzoną i wstawioną bazę, lub NULL
+ *         jeśli nie udało się zaalokować pamięci.
 */
-void move_array_left(PfBase *Array[], int index, int current_length);
+PfBase *insert_base(ArrayOfBases *AOB, const char *base_name);
 
-/** @brief Funkcja wstawiająca bazę w tablicę baz.
- * Funkcja tworzy i wstawia bazę o nazwie base_name na miejscu
- * danym przez parametr i.
+/** @brief Funkcja wstawiająca kopię bazy w tablicę baz.
+ * Działa jak @ref insert_base, ale nowa baza jest kopią bazy @p parent
+ * (zob. @ref phfwdClone) i współdzieli z nią pamięć do czasu zmian.
  * @param[in] AOB - wskaźnik na strukturę ArrayOfBases, do której wstawiamy bazę.
- * @param[in] i - indeks na którym wstawiamy bazę.
  * @param[in] base_name - nazwa bazy, którą mamy wstawić.
- * @return Wskaźnik na nowo utworzoną i wstawioną bazę.
+ * @param[in] parent - wskaźnik na kopiowaną bazę.
+ * @return Wskaźnik na nowo utworzoną i wstawioną bazę, lub NULL
+ *         jeśli nie udało się skopiować bazy.
 */
-PfBase *insert_base(ArrayOfBases *AOB, int i, const char *base_name);
+PfBase *clone_base(ArrayOfBases *AOB, const char *base_name, PfBase *parent);
 
 /** @brief Funkcja znajdująca bazę o podanej nazwie.
- * Funkcja wyszukuje bazę o podanej nazwie w tablicy baz i zwraca wskaźnik na nią,
- * jednocześnie przekazując jej indeks poprzez wskaźnik na niego.
+ * Funkcja wyszukuje bazę o podanej nazwie w tablicy haszującej
+ * i zwraca wskaźnik na nią.
  * @param[in] AOB - wskaźnik na strukturę przechowującą tablicę baz.
- * @param[out] index - wskaźnik na indeks bazy, którą odnajdziemy.
  * @param[in] base_name - nazwa bazy, której szukamy.
  * @return Wskaźnik na odnalezioną bazę, albo NULL jeśli danej bazy nie ma w tablicy.
 */
-PfBase *find_base(ArrayOfBases *AOB, int *index, char *base_name);
+PfBase *find_base(ArrayOfBases *AOB, const char *base_name);
 
-/** @brief Funkcja wyszukuje indeks bazy o podanej nazwie.
- * Funkcja wyszukuje w tablicy baz bazę o podanej nazwie
- * i zwraca jej indeks.
+/** @brief Funkcja zwracająca bazy posortowane według nazw.
+ * Tablica baz nie jest uporządkowana, więc funkcja tworzy jej kopię
+ * posortowaną według nazw. Kopię trzeba zwolnić funkcją free.
  * @param[in] AOB - wskaźnik na strukturę przechowującą tablicę baz.
- * @param[in] base_name - nazwa bazy, którą wyszukujemy.
- * @return indeks odnalezionej bazy, albo -1 jeśli nie udało się 
- *         odnaleźć bazy o podanej nazwie.
+ * @return Wskaźnik na posortowaną tablicę wskaźników na bazy, lub NULL
+ *         jeśli nie udało się zaalokować pamięci.
 */
-int find_index_of_base(ArrayOfBases *AOB, char *base_name);
+PfBase **sorted_bases(ArrayOfBases *AOB);
 
 /** 
  * Funkcja alokuje pamięc na strukturę ArrayOfBases i zwraca
@@ -135,7 +153,8 @@ ArrayOfBases *initialize_array_of_bases();
 
 /** @brief Usuwa bazę o podanej nazwie.
  * Funkcja usuwa bazę o podanej nazwie, wyszukując ją 
- * najpierw w tablicy baz i następnie zwraca odpowiedni komunikat
+ * najpierw w tablicy haszującej, a jej miejsce w tablicy baz zajmuje
+ * ostatnia baza. Następnie zwraca odpowiedni komunikat
  * informujący o sukcesie usuwania.
  * @param[in] AOB - wskaźnik na strukturę przechowującą tablicę baz.
  * @param[in] base_name - nazwa bazy, którą usuwamy.
@@ -144,6 +163,71 @@ ArrayOfBases *initialize_array_of_bases();
 */
 int delete_base(ArrayOfBases *AOB, char *base_name);
 
+/** @brief Zapisuje wszystkie bazy do pliku.
+ * Zapisuje nazwy baz i ich binarne obrazy (zob. @ref phfwdSave), każdy
+ * na pozycji będącej wielokrotnością 8. Jeśli dziennik jest prowadzony,
+ * zapisuje też jego identyfikator i długość, aby przy odtwarzaniu pominąć
+ * rekordy zawarte już w pliku.
+ * @param[in] AOB - wskaźnik na strukturę przechowującą tablicę baz.
+ * @param[in] path - ścieżka do pliku.
+ * @return @p true jeśli zapis się udał, @p false w przeciwnym razie.
+*/
+bool save_bases(ArrayOfBases *AOB, const char *path);
+
+/** @brief Wczytuje bazy z pliku.
+ * Wczytuje bazy zapisane funkcją @ref save_bases. Obrazy baz są
+ * odwzorowywane w pamięci (zob. @ref phfwdLoad), więc czas wczytywania
+ * nie zależy od liczby przekierowań.
+ * @param[in] path - ścieżka do pliku.
+ * @return Wskaźnik na strukturę przechowującą tablicę baz albo NULL,
+ *         jeśli plik nie istnieje, jest uszkodzony lub nie udało się
+ *         zaalokować pamięci.
+*/
+ArrayOfBases *load_bases(const char *path);
+
+/** @brief Otwiera dziennik zmian.
+ * Jeśli plik dziennika istnieje, wykonuje zapisane w nim rekordy na bazach
+ * bezpośrednio przez interfejs @ref phfwdAdd, @ref phfwdRemove,
+ * @ref insert_base i @ref delete_base, pomijając parser. Rekordy, które
+ * zawiera już migawka wczytana funkcją @ref load_bases, są pomijane.
+ * Urwany ostatni
+ * rekord, pozostawiony przez przerwany zapis, jest odcinany. Jeśli plik nie
+ * istnieje, tworzy pusty dziennik. Od tej chwili @ref handle_input dopisuje
+ * do dziennika każdą wykonaną operację NEW, DEL, > oraz DEL numer.
+ * @param[in, out] AOB - wskaźnik na strukturę przechowującą tablicę baz.
+ * @param[in] path - ścieżka do pliku dziennika.
+ * @return @p true jeśli dziennik otwarto, @p false jeśli plik jest
+ *         uszkodzony lub nie udało się go otworzyć.
+*/
+bool open_journal(ArrayOfBases *AOB, const char *path);
+
+/** @brief Dopisuje rekord do dziennika zmian.
+ * Rekordy są buforowane i utrwalane wywołaniem fsync co
+ * JOURNAL_SYNC_RECORDS rekordów, przy pierwszym rekordzie po upływie
+ * JOURNAL_SYNC_MILLISECONDS milisekund od poprzedniego utrwalenia
+ * oraz przy zakończeniu programu, także z błędem. Nic nie robi, jeśli
+ * dziennik nie jest prowadzony.
+ * @param[in, out] AOB - wskaźnik na strukturę przechowującą tablicę baz.
+ * @param[in] type - typ rekordu, zob. @ref Journal_record.
+ * @param[in] first - pierwszy napis rekordu.
+ * @param[in] second - drugi napis rekordu, używany tylko przez JOURNAL_ADD
+ *                     i JOURNAL_CLONE.
+*/
+void journal_append(ArrayOfBases *AOB, int type, const char *first, const char *second);
+
+/** @brief Przenosi zawartość dziennika do migawki.
+ * Zapisuje wszystkie bazy funkcją @ref save_bases do pliku tymczasowego,
+ * który następnie zastępuje plik @p path, i opróżnia dziennik, nadając mu
+ * nowy identyfikator. Po awarii między tymi krokami migawka pomija rekordy
+ * starego dziennika, które już zawiera.
+ * @param[in, out] AOB - wskaźnik na strukturę przechowującą tablicę baz.
+ * @param[in] path - ścieżka do pliku migawki.
+ * @param[in] current_base - wskaźnik na aktualną bazę, zapamiętywaną
+ *                           w opróżnionym dzienniku; może być @p NULL.
+ * @return @p true jeśli zapis się udał, @p false w przeciwnym razie.
+*/
+bool compact_journal(ArrayOfBases *AOB, const char *path, PfBase *current_base);
+
 /** 
  * Funkcja przyporządkowuje znak do odpowiednej kategorii.
  * @param[in] sign - znak, który analizujemy.
@@ -154,6 +238,8 @@ int delete_base(ArrayOfBases *AOB, char *base_name);
            LARGER_CHARACTER jeśli znak to '>'.
            DEL_OPERATOR jeśli znak to 'D'.
            NEW_OPERATOR jeśli znak to 'N'.
+           STATS_OPERATOR jeśli znak to 'S'.
+           LOAD_OPERATOR jeśli znak to 'L'.
            ERROR w przeciwnym wypadku.
 */
 int recognize_input(char sign);
@@ -167,16 +253,17 @@ int recognize_input(char sign);
 void error_eof(ArrayOfBases *AOB);
 
 /** @brief Funkcja czytająca numer ze standardowego wejścia.
- * Funkcja czyta numer ze standardowego wejścia, przy założeniu, że @p sign jest
- * pierwszą cyfrą numeru. Uaktualnia też liczbę wczytanych bajtów poprzez wskaźnik
- * @p byte_number oraz rodzaj znaku wczytanego bezpośrednio po numerze
- * poprzez @p following_sign.
+ * Funkcja czyta numer ze standardowego wejścia, przy założeniu, że ostatni
+ * wczytany znak jest pierwszą cyfrą numeru. Uaktualnia też liczbę wczytanych
+ * bajtów poprzez wskaźnik @p byte_number oraz rodzaj znaku wczytanego
+ * bezpośrednio po numerze poprzez @p following_sign.
  * @param[out] byte_number - wskaźnik na liczbę bajtów.
- * @param[in] sign - pierwsza cyfra numeru.
  * @param[out] following_sign - wskaźnik na rodzaj znaku bezpośrednio po numerze.
- * @return Wskaźnik na napis reprezentujący wczytany numer.
+ * @return Wskaźnik na napis reprezentujący wczytany numer. Napis leży
+ *         w buforze wejścia i jest ważny do końca obsługi bieżącego polecenia;
+ *         nie należy go zwalniać.
 */
-char *read_whole_number(int *byte_number, char sign, int *following_sign);
+char *read_whole_number(size_t *byte_number, int *following_sign);
 
 /** @brief Funkcja szuka numeru w standardowym wejściu.
  * Funkcja szukająca numeru w standardowym wejściu i uruchamiająca
@@ -187,11 +274,9 @@ char *read_whole_number(int *byte_number, char sign, int *following_sign);
  * @param[out] byte_numbers - wskaźnik na liczbę bajtów.
  * @param[in] AOB - wskaźnik na strukturę ArrayOfBases, używanej do zwolnienia pamięci w przypadku błedu wczytywania.
  * @param[out] following_sign - wskaźnik na rodzaj znaku bezpośrednio po numerze.
- * @param[in] number - wskaźnik na napis reprezentujący wcześniej odnaleziony numer.
- * Używany jest on do zwolnienia pamięci w przypadku błędu.
- * @return Wskaźnik na napis reprezentujący wczytany numer.
+ * @return Wskaźnik na napis reprezentujący wczytany numer, zob. @ref read_whole_number.
 */
-char *find_number(int *byte_numbers, ArrayOfBases *AOB, int *following_sign, char *number);
+char *find_number(size_t *byte_numbers, ArrayOfBases *AOB, int *following_sign);
 
 /**
  * Funkcja sprawdzająca czy podany znak jest operatorem.
@@ -205,13 +290,12 @@ bool is_operator(char sign);
  * enumerator w zależności od tego co odnajdzie. Uaktualnia też liczbę wczytanych bajtów.
  * @param[in] AOB - wskaźnik na strukturę ArrayOfBases, używanej do zwolnienia pamięci w przypadku błedu wczytywania.
  * @param[out] byte_number - wskaźnik na liczbę bajtów.
- * @param[in] number - wskaźnik na napis, który trzeba zwolnić w przypadku błędu wczytywania.
  * @return LARGER_CHARACTER, jeśli pierwszym operatorem będzie znak '>'/
            Q_MARK, jeśli pierwszym operatorem będzie znak '?'.
            COMMENT, jeśli pierwszym operatorem będzie znak '$'.
            -1 w przeciwnym razie.
 */
-int search_for_operator(ArrayOfBases *AOB, int *byte_number, char *number);
+int search_for_operator(ArrayOfBases *AOB, size_t *byte_number);
 
 /**
  * Funkcja sprawdzająca czy @p enum_type jest enumeratorem odpowiadającym komentarzowi.
@@ -237,7 +321,7 @@ bool is_number(char x);
  * @param[out] byte_number - wskaźnik na liczbę bajtów.
  * @param[in] AOB - wskaźnik na strukturę ArrayOfBases, używanej do zwolnienia pamięci w przypadku błedu wczytywania.
 */
-void handle_comment(ArrayOfBases *AOB, int *byte_number);
+void handle_comment(ArrayOfBases *AOB, size_t *byte_number);
 
 /**
  * Funkcja sprawdzająca, czy podany znak jest
@@ -255,9 +339,10 @@ bool correct_ID(char sign);
  * @param[in] AOB - wskaźnik na strukturę ArrayOfBases, używanej do zwolnienia pamięci w przypadku błedu wczytywania.
  * @param[out] type_of_input - Typ znaku wczytanego bezpośrednio po identyfikatorze.
  * @param[in] operator - typ operatora tuż przed użyciem tej funkcji.
- * @return Wskaźnik na wczytany identyfikator.
+ * @return Wskaźnik na wczytany identyfikator w buforze wejścia, ważny do końca
+ *         obsługi bieżącego polecenia, albo NULL jeśli identyfikatora nie było.
 */
-char *get_string(ArrayOfBases *AOB, int *byte_numbers, int *type_of_input, size_t operator);
+char *get_string(ArrayOfBases *AOB, size_t *byte_numbers, int *type_of_input, size_t operator);
 
 /** @brief Funkcja wczytuje resztę operatora.
  * Funkcja powinna zostać uruchomiona po zobaczeniu znaku 'N' albo 'D'.
@@ -267,13 +352,16 @@ char *get_string(ArrayOfBases *AOB, int *byte_numbers, int *type_of_input, size_
  * @param[out] byte_numbers - wskaźnik na liczbę bajtów.
  * @param[in] AOB - wskaźnik na strukturę ArrayOfBases, używanej do zwolnienia pamięci w przypadku błedu wczytywania.
  * @param[out] type_of_input - Typ znaku wczytanego bezpośrednio po identyfikatorze.
- * @return Wskaźnik na wczytany operator.
+ * @return Wskaźnik na wczytany operator w buforze wejścia, ważny do końca
+ *         obsługi bieżącego polecenia.
 */
-char *read_rest_of_operator(ArrayOfBases *AOB, int *byte_numbers, int *type_of_input);
+char *read_rest_of_operator(ArrayOfBases *AOB, size_t *byte_numbers, int *type_of_input);
 
 /** @brief Funkcja zajmująca się obsługą wejścia.
  * Funkcja wczytuje wszystkie znaki na standardowym wejściu i zajmuje się ich
- * obsługą zgodnie z wymaganiami programu.
+ * obsługą zgodnie z wymaganiami programu. Wejście jest czytane dużymi
+ * blokami, a numery i identyfikatory są przekazywane do bazy bezpośrednio
+ * z bufora, bez kopiowania.
  * @param[in] AOB - wskaźnik na strukturę ArrayOfBases, która musi zostać zaalokowana poza tą funkcją.
  * @param[in] current_base - wskaźnik na aktualną bazę, w szczególności może byc @p NULL.
 */
@@ -0,0 +1,240 @@
+/** @file
+ * Testy funkcji modułu phone_forward, których nie da się sprawdzić
+ * poleceniami programu phone_forward.
+ *
+ * Użycie: phone_forward_test
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "phone_forward.h"
+#include <stdio.h>
+#include <string.h>
+
+#define RESULT_LENGTH 1024
+
+/**
+ * Czy któryś test się nie powiódł.
+*/
+static bool failed = false;
+
+/** @brief Wypisuje wynik testu.
+ * @param[in] name - nazwa testu.
+ * @param[in] expected - oczekiwany wynik.
+ * @param[in] actual - otrzymany wynik.
+*/
+static void check(char const *name, char const *expected, char const *actual) {
+    if (strcmp(expected, actual) == 0)
+        printf("OK %s\n", name);
+    else {
+        printf("BŁĄD %s: oczekiwano '%s', otrzymano '%s'\n", name, expected, actual);
+        failed = true;
+    }
+}
+
+/** @brief Dopisuje ciąg numerów do napisu.
+ * @param[in] pnum - wskaźnik na ciąg numerów albo NULL; zostaje usunięty.
+ * @param[in, out] result - bufor na RESULT_LENGTH znaków; numery są
+ *                          oddzielone spacjami, NULL dopisujemy jako "NULL".
+*/
+static void append_numbers(PhoneNumbers const *pnum, char *result) {
+    if (pnum == NULL)
+        strncat(result, "NULL", RESULT_LENGTH - strlen(result) - 1);
+    for (size_t i = 0; pnum != NULL && phnumGet(pnum, i) != NULL; i++) {
+        if (i > 0)
+            strncat(result, " ", RESULT_LENGTH - strlen(result) - 1);
+        strncat(result, phnumGet(pnum, i), RESULT_LENGTH - strlen(result) - 1);
+    }
+    phnumDelete(pnum);
+}
+
+/** @brief Zapisuje przekierowanie numeru i numery na niego przekierowane.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] num - wskaźnik na numer.
+ * @param[out] result - bufor na RESULT_LENGTH znaków.
+ * @return Wskaźnik na @p result w postaci "przekierowanie | numery".
+*/
+static char *forwarding(PhoneForward *pf, char const *num, char *result) {
+    result[0] = '\0';
+    append_numbers(phfwdGet(pf, num), result);
+    strncat(result, " | ", RESULT_LENGTH - strlen(result) - 1);
+    append_numbers(phfwdReverse(pf, num), result);
+    return result;
+}
+
+/** @brief Zwraca liczbę przekierowań.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[out] result - bufor na RESULT_LENGTH znaków.
+ * @return Wskaźnik na @p result z liczbą przekierowań.
+*/
+static char *rules(PhoneForward *pf, char *result) {
+    PhoneForwardStats stats;
+    if (!phfwdStats(pf, &stats))
+        return strcpy(result, "ERROR");
+    snprintf(result, RESULT_LENGTH, "%zu", stats.rules);
+    phfwdStatsClear(&stats);
+    return result;
+}
+
+/** @brief Testuje transakcje (zob. @ref phfwdBegin).
+*/
+static void test_transactions(void) {
+    char result[RESULT_LENGTH];
+    PhoneForward *pf = phfwdNew();
+
+    check("commit-without-begin", "false", phfwdCommit(pf) ? "true" : "false");
+
+    phfwdAdd(pf, "5", "6");
+    phfwdBegin(pf);
+    phfwdStageAdd(pf, "1", "2");
+    phfwdStageRemove(pf, "1");
+    phfwdStageAdd(pf, "5", "7");
+    phfwdStageRemove(pf, "5");
+    phfwdCommit(pf);
+    check("add-remove-cancel", "1 | 1", forwarding(pf, "1", result));
+    check("add-remove-cancel-target", "2 | 2", forwarding(pf, "2", result));
+    check("add-remove-cancel-replaced", "6 | 6", forwarding(pf, "6", result));
+    check("add-remove-cancel-rules", "0", rules(pf, result));
+
+    phfwdAdd(pf, "1", "2");
+    phfwdAdd(pf, "34", "2");
+    phfwdBegin(pf);
+    phfwdStageAdd(pf, "1", "3");
+    phfwdStageRemove(pf, "3");
+    phfwdStageAdd(pf, "4", "5");
+    phfwdAbort(pf);
+    check("abort-unchanged", "2 | 1 2 34", forwarding(pf, "2", result));
+    check("abort-unchanged-added", "4 | 4", forwarding(pf, "4", result));
+    check("abort-unchanged-rules", "2", rules(pf, result));
+    check("commit-after-abort", "false", phfwdCommit(pf) ? "true" : "false");
+
+    phfwdAdd(pf, "12", "8");
+    phfwdAdd(pf, "13", "9");
+    phfwdBegin(pf);
+    phfwdStageRemove(pf, "1");
+    phfwdStageAdd(pf, "15", "8");
+    phfwdCommit(pf);
+    check("remove-then-add-below", "8 | 15 8", forwarding(pf, "8", result));
+    check("remove-then-add-below-removed", "12 | 12", forwarding(pf, "12", result));
+    check("remove-then-add-below-sibling", "9 | 9", forwarding(pf, "9", result));
+    check("remove-then-add-below-rules", "2", rules(pf, result));
+    check("remove-then-add-below-other", "2 | 2 34", forwarding(pf, "2", result));
+
+    phfwdDelete(pf);
+}
+
+/**
+ * Strona wyniku @ref phfwdReverseVisit.
+*/
+struct Page {
+    /**
+    * Numery wszystkich dotychczasowych stron oddzielone spacjami.
+    */
+    char *result;
+    /**
+    * Liczba numerów bieżącej strony.
+    */
+    size_t count;
+    /**
+    * Ostatni odwiedzony numer.
+    */
+    char last[RESULT_LENGTH];
+};
+
+/**
+ * typedef dla struktury Page, aby unikac pisania slowa kluczowego "struct"
+ */
+typedef struct Page Page;
+
+/** @brief Dopisuje odwiedzony numer do strony.
+ * @param[in] number - wskaźnik na numer.
+ * @param[in, out] data - wskaźnik na stronę.
+ * @return Wartość @p true.
+*/
+static bool visit_page(char const *number, void *data) {
+    Page *page = data;
+    if (page->result[0] != '\0')
+        strncat(page->result, " ", RESULT_LENGTH - strlen(page->result) - 1);
+    strncat(page->result, number, RESULT_LENGTH - strlen(page->result) - 1);
+    snprintf(page->last, RESULT_LENGTH, "%s", number);
+    page->count++;
+    return true;
+}
+
+/** @brief Zapisuje numery przekierowane na numer, czytane stronami.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] num - wskaźnik na numer.
+ * @param[in] limit - rozmiar strony.
+ * @param[out] result - bufor na RESULT_LENGTH znaków.
+ * @return Wskaźnik na @p result z numerami wszystkich stron.
+*/
+static char *reverse_pages(PhoneForward *pf, char const *num, size_t limit, char *result) {
+    Page page = {result, 0, ""};
+    result[0] = '\0';
+    char const *after = NULL;
+    do {
+        page.count = 0;
+        if (!phfwdReverseVisit(pf, num, after, limit, visit_page, &page))
+            return strcpy(result, "ERROR");
+        after = page.last;
+    } while (page.count == limit);
+    return result;
+}
+
+/** @brief Sprawdza, że strony wyniku @ref phfwdReverseVisit złożone razem
+ * dają wynik @ref phfwdReverse.
+ * @param[in] name - nazwa testu.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @param[in] num - wskaźnik na numer.
+*/
+static void check_pages(char const *name, PhoneForward *pf, char const *num) {
+    char expected[RESULT_LENGTH], actual[RESULT_LENGTH];
+    expected[0] = '\0';
+    append_numbers(phfwdReverse(pf, num), expected);
+    for (size_t limit = 1; limit <= 4; limit++) {
+        reverse_pages(pf, num, limit, actual);
+        if (strcmp(expected, actual) != 0)
+            break;
+    }
+    check(name, expected, actual);
+}
+
+/** @brief Testuje czytanie numerów przekierowanych stronami
+ * (zob. @ref phfwdReverseVisit).
+*/
+static void test_reverse_pages(void) {
+    char result[RESULT_LENGTH];
+    PhoneForward *pf = phfwdNew();
+    phfwdAdd(pf, "12", "25");
+    phfwdAdd(pf, "1", "2");
+    phfwdAdd(pf, "19", "25");
+    // after the page ending with 12 the prefix 1 of it gives 15
+    check("reverse-page-after-prefix", "12 15 19 25", reverse_pages(pf, "25", 1, result));
+    check_pages("reverse-pages", pf, "25");
+
+    unsigned long long state = 12345;
+    for (int i = 0; i < 60; i++) { // short numbers of few digits give many prefixes and equal candidates
+        char num[2][5];
+        for (int j = 0; j < 2; j++) {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            int length = 1 + (state >> 33) % 4;
+            for (int k = 0; k < length; k++)
+                num[j][k] = '0' + (state >> (40 + 3*k)) % 3;
+            num[j][length] = '\0';
+        }
+        phfwdAdd(pf, num[0], num[1]);
+    }
+    check_pages("reverse-pages-random", pf, "2101");
+    check_pages("reverse-pages-random-short", pf, "2");
+    PhoneForward *clone = phfwdClone(pf);
+    phfwdFreeze(clone);
+    check_pages("reverse-pages-frozen", clone, "2101");
+    check_pages("reverse-pages-frozen-prefix", clone, "25");
+    phfwdDelete(clone);
+    phfwdDelete(pf);
+}
+
+int main(void) {
+    test_transactions();
+    test_reverse_pages();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,125 @@
+#!/bin/bash
+# Testy programu phone_forward. Użycie: ./phone_forward_test.sh [program]
+
+program=$(realpath "${1:-./phone_forward}")
+directory=$(mktemp -d)
+trap 'rm -rf "$directory"' EXIT
+failed=0
+
+# check nazwa oczekiwane otrzymane
+check() {
+	if [ "$2" == "$3" ]
+		then echo "OK $1"
+	else
+		echo "BŁĄD $1: oczekiwano '$2', otrzymano '$3'"
+		failed=1
+	fi
+}
+
+# Rekordy dziennika zapisane przed przerwą w danych wejściowych przetrwają
+# zabicie programu.
+journal="$directory/journal"
+mkfifo "$directory/input"
+"$program" -j "$journal" < "$directory/input" > /dev/null &
+pid=$!
+exec 3> "$directory/input"
+{
+	echo "NEW a"
+	for i in $(seq 1 50); do echo "1$i > 2$i"; done
+} >&3
+# Czekamy, aż dziennik urośnie ponad sam nagłówek i przestanie rosnąć.
+echo "" | "$program" -j "$directory/empty_journal"
+empty=$(stat -c %s "$directory/empty_journal")
+size=0
+for attempt in $(seq 1 100); do
+	sleep 0.1
+	previous=$size
+	size=$(stat -c %s "$journal" 2> /dev/null || echo 0)
+	[ "$size" -gt "$empty" ] && [ "$size" == "$previous" ] && break
+done
+{ kill -9 $pid; wait $pid; } 2> /dev/null
+exec 3>&-
+check "journal-idle-burst" "$(printf '21\n250')" "$(printf 'NEW a\n11 ?\n150 ?\n' | "$program" -j "$journal")"
+
+# Migawka bez dziennika nie byłaby nigdy zapisana, więc opcja -s wymaga -j.
+echo "NEW a" | "$program" -s "$directory/snapshot" > /dev/null 2>&1
+check "snapshot-requires-journal" "1" "$?"
+printf 'NEW a\n1 > 2\n' | "$program" -s "$directory/snapshot" -j "$directory/journal2"
+check "snapshot-with-journal" "2" "$(printf 'NEW a\n1 ?\n' | "$program" -s "$directory/snapshot" -j "$directory/journal2")"
+check "snapshot-written" "yes" "$([ -s "$directory/snapshot" ] && echo yes)"
+
+# Migawka kilku baz z kopiami odtwarza te same przekierowania, a migawka
+# z uszkodzonym bajtem albo obcięta jest odrzucana.
+commands='NEW A\n1 > 2\n12 > 34\n13 > 2\nNEW B > A\n5 > 6\n12 > 7\nNEW C > B\nDEL 1\n3 > 2\nNEW D\n7 > 8\n'
+queries=""
+for base in A B C D; do
+	queries="${queries}NEW $base\n1 ?\n12 ?\n13 ?\n5 ?\n? 2\n? 34\n? 6\n? 7\n@ 12345678901234\n@ 23456789012345\n"
+done
+expected=$(printf "$commands$queries" | "$program")
+printf "$commands" | "$program" -j "$directory/journal5"
+echo "" | "$program" -s "$directory/snapshot5" -j "$directory/journal5"
+check "snapshot-round-trip" "$expected" "$(printf "$queries" | "$program" -s "$directory/snapshot5" -j "$directory/journal5b")"
+size=$(stat -c %s "$directory/snapshot5")
+cp "$directory/snapshot5" "$directory/corrupted"
+printf '\377' | dd of="$directory/corrupted" bs=1 seek=$((size / 2)) conv=notrunc 2> /dev/null
+check "snapshot-corrupted" "$(printf 'ERROR SNAPSHOT\n1')" "$(echo "NEW A" | "$program" -s "$directory/corrupted" -j "$directory/journal5c" 2>&1; echo $?)"
+head -c $((size - 1)) "$directory/snapshot5" > "$directory/truncated"
+check "snapshot-truncated" "$(printf 'ERROR SNAPSHOT\n1')" "$(echo "NEW A" | "$program" -s "$directory/truncated" -j "$directory/journal5d" 2>&1; echo $?)"
+
+# W łącznych statystykach pamięć współdzielona przez kopię bazy jest
+# liczona raz, a przekierowania są sumowane.
+statistics=$(printf 'NEW a\n1 > 2\n12 > 3\n13 > 34\nNEW b > a\nSTATS\n' | "$program")
+memory() {
+	echo "$1" | grep "^STATS $2 " | grep -o ' \(forward\|reverse\|list\|number\|free\)_bytes=[0-9]*'
+}
+check "stats-clone-memory" "$(memory "$statistics" a)" "$(memory "$statistics" '\*')"
+check "stats-clone-rules" "rules=6" "$(echo "$statistics" | grep '^STATS \* ' | grep -o 'rules=[0-9]*')"
+
+# Ostatnie przekierowanie w pliku dla LOAD nie musi kończyć się białym znakiem.
+printf '1 > 2\n3>4' > "$directory/rules"
+check "load-without-trailing-newline" "$(printf '2\n4')" "$(printf 'NEW a\nLOAD %s\n1 ?\n3 ?\n' "$directory/rules" | "$program")"
+printf '1 > 2\n3 >' > "$directory/rules"
+printf 'NEW a\nLOAD %s\n' "$directory/rules" | "$program" 2> /dev/null
+check "load-incomplete-rule" "1" "$?"
+
+# Kopia bazy i baza, z której powstała, zmieniają się niezależnie.
+check "clone-write-hidden-from-parent" "$(printf '3\n2')" "$(printf 'NEW A\n1 > 2\nNEW B > A\n1 > 3\n1 ?\nNEW A\n1 ?\n' | "$program")"
+check "parent-write-hidden-from-clone" "$(printf '3\n2\n1\n2')" "$(printf 'NEW A\n1 > 2\nNEW B > A\nNEW A\n1 > 3\n1 ?\nNEW B\n1 ?\n? 2\n' | "$program")"
+check "clone-outlives-parent" "$(printf '2\n1\n2\n4')" "$(printf 'NEW A\n1 > 2\n3 > 4\nNEW B > A\nDEL A\nNEW B\n1 ?\n? 2\n3 ?\n' | "$program")"
+check "clone-existing-base" "ERROR NEW 13" "$(printf 'NEW A\nNEW B\nNEW B > A\n' | "$program" 2>&1 > /dev/null)"
+check "clone-missing-parent" "ERROR NEW 7" "$(printf 'NEW A\nNEW B > C\n' | "$program" 2>&1 > /dev/null)"
+
+# Awaria między zapisaniem migawki a obcięciem dziennika: dziennik jest
+# odtwarzany jeszcze raz na migawce, która zawiera już kopię bazy.
+printf 'NEW A\n1 > 2\nNEW B > A\n3 > 4\n' | "$program" -j "$directory/journal3"
+cp "$directory/journal3" "$directory/journal3.old"
+echo "" | "$program" -s "$directory/snapshot3" -j "$directory/journal3"
+cp "$directory/journal3.old" "$directory/journal3"
+check "clone-replay-over-snapshot" "$(printf '3\n4')" "$(printf 'NEW A\n3 ?\nNEW B\n3 ?\n' | "$program" -s "$directory/snapshot3" -j "$directory/journal3")"
+
+# Odtworzenie dziennika na migawce, która zawiera już jego rekordy, daje
+# ten sam stan każdej bazy co zwykłe odtworzenie dziennika.
+commands='NEW A\n1 > 2\n12 > 3\nNEW B > A\n13 > 4\nDEL 12\nNEW C > B\nNEW A\n5 > 6\nDEL B\nNEW B > A\n7 > 8\nNEW A\n9 > 1\nNEW D\n1 > 9\nNEW C\n1 > 5\n'
+queries=""
+for base in A B C D; do
+	queries="${queries}NEW $base\n"
+	for number in 1 12 13 5 7 2 3 4 6 8 9; do queries="$queries$number ?\n? $number\n"; done
+done
+# dump dziennik [migawka]: stan wszystkich baz, dziennik i migawka nie zmieniają się
+dump() {
+	cp "$1" "$directory/dump_journal"
+	if [ -n "$2" ]
+		then cp "$2" "$directory/dump_snapshot"; printf "$queries" | "$program" -s "$directory/dump_snapshot" -j "$directory/dump_journal"
+	else
+		printf "$queries" | "$program" -j "$directory/dump_journal"
+	fi
+	rm -f "$directory/dump_journal" "$directory/dump_snapshot"
+}
+printf "$commands" | "$program" -j "$directory/journal4"
+cp "$directory/journal4" "$directory/journal4.old"
+expected=$(dump "$directory/journal4")
+echo "" | "$program" -s "$directory/snapshot4" -j "$directory/journal4"
+check "replay-after-compaction" "$expected" "$(dump "$directory/journal4" "$directory/snapshot4")"
+check "replay-over-snapshot" "$expected" "$(dump "$directory/journal4.old" "$directory/snapshot4")"
+
+exit $failed